@@ -0,0 +1,246 @@
+/*
+    Copyright (c) 2016, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "rengine.h"
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define  STB_TRUETYPE_IMPLEMENTATION
+#include <stb_truetype.h>
+
+using namespace rengine;
+using namespace std;
+
+static int groupCount = 1000;
+static int groupSize = 100;
+static int iterations = 20;
+static bool shuffled = true;
+
+/*
+    Compares traversing a Node tree with traversing the same scene stored
+    as a FlatScene. Both passes do what the renderer's build pass does for
+    rectangles: accumulate the transforms and write out the transformed
+    corners of each quad.
+
+    With --shuffle, which is the default, the nodes are allocated in random
+    order before being put into the tree, which is what a scene looks like
+    after it has been changed for a while. On Linux the cache misses of
+    each pass are reported when hardware counters are available.
+ */
+class CacheMissCounter
+{
+public:
+    CacheMissCounter() {
+#ifdef __linux__
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        m_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+    ~CacheMissCounter() {
+#ifdef __linux__
+        if (m_fd >= 0)
+            close(m_fd);
+#endif
+    }
+
+    bool isValid() const { return m_fd >= 0; }
+
+    void start() {
+#ifdef __linux__
+        if (m_fd >= 0) {
+            ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    long long stop() {
+        long long count = 0;
+#ifdef __linux__
+        if (m_fd >= 0) {
+            ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(m_fd, &count, sizeof(count)) != sizeof(count))
+                count = 0;
+        }
+#endif
+        return count;
+    }
+
+private:
+    int m_fd = -1;
+};
+
+static Node *buildTree()
+{
+    // Allocate everything up front, then link it up in shuffled order
+    int count = groupCount * (groupSize + 1) + 1;
+    vector<Node *> nodes;
+    nodes.reserve(count);
+    for (int g=0; g<groupCount; ++g) {
+        nodes.push_back(TransformNode::create());
+        for (int i=0; i<groupSize; ++i)
+            nodes.push_back(RectangleNode::create());
+    }
+    if (shuffled) {
+        vector<Node *> transforms, rects;
+        for (Node *n : nodes)
+            (n->type() == Node::TransformNodeType ? transforms : rects).push_back(n);
+        mt19937 random(1234);
+        shuffle(transforms.begin(), transforms.end(), random);
+        shuffle(rects.begin(), rects.end(), random);
+        nodes.clear();
+        for (int g=0; g<groupCount; ++g) {
+            nodes.push_back(transforms[g]);
+            for (int i=0; i<groupSize; ++i)
+                nodes.push_back(rects[g * groupSize + i]);
+        }
+    }
+
+    Node *root = Node::create();
+    unsigned index = 0;
+    for (int g=0; g<groupCount; ++g) {
+        TransformNode *tx = static_cast<TransformNode *>(nodes[index++]);
+        tx->setMatrix(mat4::translate2D(g % 40 * 10, g / 40 * 10));
+        for (int i=0; i<groupSize; ++i) {
+            RectangleNode *rect = static_cast<RectangleNode *>(nodes[index++]);
+            rect->setGeometry(rect2d::fromXywh(i, i, 10, 10));
+            rect->setColor(vec4(1, 0, 0, 1));
+            tx->append(rect);
+        }
+        root->append(tx);
+    }
+    return root;
+}
+
+static vec2 *emitTree(Node *n, const mat4 &m, vec2 *v)
+{
+    if (n->type() == Node::RectangleNodeType) {
+        const rect2d &r = static_cast<RectangleNode *>(n)->geometry();
+        v[0] = m * r.tl;
+        v[1] = m * vec2(r.tl.x, r.br.y);
+        v[2] = m * vec2(r.br.x, r.tl.y);
+        v[3] = m * r.br;
+        v += 4;
+    }
+    mat4 cm = n->type() == Node::TransformNodeType ? m * static_cast<TransformNode *>(n)->matrix() : m;
+    for (Node *c = n->child(); c; c = c->sibling())
+        v = emitTree(c, cm, v);
+    return v;
+}
+
+static vec2 *emitFlat(FlatScene *scene, vec2 *v)
+{
+    scene->forEachDrawable([&v] (FlatScene::Handle, const mat4 &m, const rect2d &r, vec4, const Texture *, float) {
+        v[0] = m * r.tl;
+        v[1] = m * vec2(r.tl.x, r.br.y);
+        v[2] = m * vec2(r.br.x, r.tl.y);
+        v[3] = m * r.br;
+        v += 4;
+    });
+    return v;
+}
+
+template <typename Pass>
+static void measure(const char *name, CacheMissCounter *counter, Pass pass)
+{
+    pass(); // warm up
+    counter->start();
+    auto start = chrono::steady_clock::now();
+    for (int i=0; i<iterations; ++i)
+        pass();
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / iterations;
+    long long misses = counter->stop();
+    cout << name << ": " << ms << " ms/pass";
+    if (counter->isValid())
+        cout << ", " << (misses / iterations) << " cache misses/pass";
+    cout << endl;
+}
+
+RENGINE_DEFINE_GLOBALS
+
+int main(int argc, char **argv) {
+
+    for (int i=0; i<argc; ++i) {
+        std::string arg(argv[i]);
+        if (i + 1 < argc && arg == "--groups") {
+            groupCount = std::max(1, atoi(argv[++i]));
+        } else if (i + 1 < argc && arg == "--size") {
+            groupSize = std::max(1, atoi(argv[++i]));
+        } else if (i + 1 < argc && arg == "--iterations") {
+            iterations = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--no-shuffle") {
+            shuffled = false;
+        } else if (arg == "-h" || arg == "--help") {
+            cout << "Usage: " << endl
+                 << " > " << argv[0] << " [options]" << endl
+                 << endl
+                 << "Options:" << endl
+                 << "  --groups [x]      Number of transforms below the root" << endl
+                 << "  --size [x]        Rectangles per transform" << endl
+                 << "  --iterations [x]  Number of passes to average over" << endl
+                 << "  --no-shuffle      Allocate nodes in tree order" << endl;
+            return 0;
+        }
+    }
+
+    Node *root = buildTree();
+
+    FlatScene scene;
+    auto start = chrono::steady_clock::now();
+    scene.build(root);
+    double convertMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << "nodes: " << scene.size() << ", conversion: " << convertMs << " ms" << endl;
+
+    vector<vec2> vertices(groupCount * groupSize * 4);
+    CacheMissCounter counter;
+    if (!counter.isValid())
+        cout << "cache miss counters not available" << endl;
+
+    measure("node tree", &counter, [&] { emitTree(root, mat4(), vertices.data()); });
+    measure("flat scene", &counter, [&] {
+        // Invalidate the world transforms so the flat pass does the same work
+        scene.setMatrix(1, scene.matrix(1));
+        emitFlat(&scene, vertices.data());
+    });
+
+    root->destroySubtree();
+    return 0;
+}
@@ -0,0 +1,123 @@
+/*
+    Copyright (c) 2016, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "rengine.h"
+#include "examples.h"
+
+#include <ctime>
+
+#define  STB_TRUETYPE_IMPLEMENTATION
+#include <stb_truetype.h>
+
+static double idleSeconds = 5;
+
+/*
+    Measures what the application costs while it has nothing to do. The
+    scene is static and a single animation is started after --idle
+    seconds. Until then, the application should neither render nor use
+    any noticeable amount of CPU.
+ */
+class IdleBenchWindow : public StandardSurface
+{
+public:
+    typedef Animation<RectangleNodeBase, float, &RectangleNodeBase::setX, &AnimationCurves::linear> Animation_x;
+
+    Node *build() override
+    {
+        RectangleNode *rect = RectangleNode::create(rect2d::fromXywh(0, 0, 100, 100), vec4(1, 0, 0, 1));
+
+        m_animation = std::make_shared<Animation_x>(rect);
+        m_animation->setDuration(0.5);
+        m_animation->newKeyFrame(0) = 0;
+        m_animation->newKeyFrame(1) = 200;
+        animationManager()->start(m_animation, idleSeconds);
+
+        cout << "idling for " << idleSeconds << " seconds..." << endl;
+        m_wallStart = std::chrono::steady_clock::now();
+        m_cpuStart = std::clock();
+
+        return &(*Node::create() << rect);
+    }
+
+    void onAfterRender() override
+    {
+        if (m_animation->isRunning()) {
+            if (!m_idleDone)
+                report("idle");
+            m_idleDone = true;
+            ++m_animatedFrames;
+        } else if (!m_idleDone) {
+            ++m_idleFrames;
+        } else if (!animationManager()->isRunning()) {
+            cout << "animated frames: " << m_animatedFrames << endl;
+            Backend::get()->quit();
+        }
+    }
+
+    void report(const char *phase)
+    {
+        double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_wallStart).count();
+        double cpu = double(std::clock() - m_cpuStart) / CLOCKS_PER_SEC;
+        cout << phase << ": " << wall << " seconds, "
+             << m_idleFrames << " frames rendered, "
+             << cpu << " seconds of CPU time, "
+             << "CPU usage: " << (100.0 * cpu / wall) << "%" << endl;
+    }
+
+private:
+    std::shared_ptr<Animation_x> m_animation;
+    std::chrono::steady_clock::time_point m_wallStart;
+    std::clock_t m_cpuStart;
+    unsigned m_idleFrames = 0;
+    unsigned m_animatedFrames = 0;
+    bool m_idleDone = false;
+};
+
+RENGINE_DEFINE_GLOBALS
+
+int main(int argc, char **argv) {
+
+    for (int i=0; i<argc; ++i) {
+        std::string arg(argv[i]);
+        if (i + 1 < argc && arg == "--idle") {
+            idleSeconds = atof(argv[++i]);
+        } else if (arg == "-h" || arg == "--help") {
+            cout << "Usage: " << endl
+                 << " > " << argv[0] << " [options]" << endl
+                 << endl
+                 << "Options:" << endl
+                 << "  --idle [x]       Seconds before the animation starts" << endl;
+        }
+    }
+
+    RENGINE_BACKEND backend;
+
+    IdleBenchWindow surface;
+    surface.show();
+
+    backend.run();
+
+    return 0;
+}
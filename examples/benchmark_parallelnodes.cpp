@@ -0,0 +1,119 @@
+/*
+    Copyright (c) 2016, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "rengine.h"
+
+#include <thread>
+
+#define  STB_TRUETYPE_IMPLEMENTATION
+#include <stb_truetype.h>
+
+using namespace rengine;
+using namespace std;
+
+static int subtreeCount = 1000;
+static int subtreeSize = 100;
+static int iterations = 10;
+
+/*
+    Measures how fast subtrees can be built and destroyed when the work is
+    spread over several threads, which is what an application building
+    content on the WorkQueue does. Node allocation goes through the
+    allocation pools, so this shows how well they scale with the number
+    of threads.
+ */
+static void buildSubtrees(int count)
+{
+    for (int i=0; i<count; ++i) {
+        Node *root = Node::create();
+        for (int j=1; j<subtreeSize; j+=2) {
+            TransformNode *tx = TransformNode::create();
+            tx->setMatrix(mat4::translate2D(j, 0));
+            tx->append(RectangleNode::create(rect2d::fromXywh(0, 0, 10, 10), vec4(1, 0, 0, 1)));
+            root->append(tx);
+        }
+        root->destroy();
+    }
+}
+
+static double run(int threadCount)
+{
+    auto start = chrono::steady_clock::now();
+    for (int it=0; it<iterations; ++it) {
+        vector<thread> threads;
+        for (int t=0; t<threadCount; ++t)
+            threads.push_back(thread(buildSubtrees, subtreeCount / threadCount));
+        for (thread &t : threads)
+            t.join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    double nodes = double(iterations) * (subtreeCount / threadCount) * threadCount * subtreeSize;
+    return nodes / seconds;
+}
+
+RENGINE_DEFINE_GLOBALS
+
+int main(int argc, char **argv) {
+
+    int maxThreads = std::max(1u, thread::hardware_concurrency());
+
+    for (int i=0; i<argc; ++i) {
+        std::string arg(argv[i]);
+        if (i + 1 < argc && arg == "--threads") {
+            maxThreads = std::max(1, atoi(argv[++i]));
+        } else if (i + 1 < argc && arg == "--subtrees") {
+            subtreeCount = std::max(1, atoi(argv[++i]));
+        } else if (i + 1 < argc && arg == "--size") {
+            subtreeSize = std::max(1, atoi(argv[++i]));
+        } else if (i + 1 < argc && arg == "--iterations") {
+            iterations = std::max(1, atoi(argv[++i]));
+        } else if (arg == "-h" || arg == "--help") {
+            cout << "Usage: " << endl
+                 << " > " << argv[0] << " [options]" << endl
+                 << endl
+                 << "Options:" << endl
+                 << "  --threads [x]     Highest number of threads to run with" << endl
+                 << "  --subtrees [x]    Subtrees built per iteration" << endl
+                 << "  --size [x]        Nodes per subtree" << endl
+                 << "  --iterations [x]  Number of iterations" << endl;
+            return 0;
+        }
+    }
+
+    // Warm up the pools so the first run doesn't pay for growing them
+    run(1);
+
+    double single = 0;
+    for (int threadCount=1; threadCount<=maxThreads; threadCount*=2) {
+        double rate = run(threadCount);
+        if (threadCount == 1)
+            single = rate;
+        cout << "threads: " << threadCount
+             << ", nodes/second: " << int(rate)
+             << ", speedup: " << (rate / single) << endl;
+    }
+
+    return 0;
+}
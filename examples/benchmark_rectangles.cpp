@@ -56,7 +56,7 @@ public:
         }
 
         if (root)
-            root->destroy();
+            root->destroySubtree();
 
         rengine_countFps();
 
@@ -265,10 +265,26 @@ private:
 typedef std::chrono::steady_clock clock;
 typedef std::chrono::steady_clock::time_point time_point;
 
+/*!
+    The AnimationManager advances animations once per frame through tick().
+
+    By default, animations are ticked to the time the frame is expected to
+    be presented, which is the first display refresh after the current time,
+    in phase with the last presentation time reported by the backend. This
+    makes animations run at the right speed regardless of the refresh rate
+    and keeps them on time when frames are dropped. The surface feeds the
+    refresh interval and presentation time from the backend using
+    setFrameInterval() and setPresentationTime().
+
+    With setFixedStep(), each tick advances the clock by a fixed amount,
+    independent of the actual time, which makes animations deterministic
+    for tests and benchmarks.
+ */
 class AnimationManager : public SignalEmitter
 {
 public:
     AnimationManager()
+        : m_running(false)
     {
     }
 
@@ -287,6 +303,50 @@ public:
 
     bool isRunning() const { return m_running; }
 
+    /*!
+        The interval between two display refreshes in seconds, 1/60 by
+        default.
+     */
+    double frameInterval() const { return m_frameInterval; }
+    void setFrameInterval(double seconds) {
+        assert(seconds > 0);
+        m_frameInterval = seconds;
+    }
+
+    /*!
+        The time at which the last frame was presented on screen, or a
+        default constructed time_point if it is not known.
+     */
+    time_point presentationTime() const { return m_presentationTime; }
+    void setPresentationTime(time_point time) { m_presentationTime = time; }
+
+    /*!
+        When set to a value larger than 0, every tick advances the
+        animations by exactly \a seconds, regardless of the time that has
+        actually passed. Set it to 0, the default, to follow the
+        presentation time.
+     */
+    double fixedStep() const { return m_fixedStep; }
+    void setFixedStep(double seconds) {
+        assert(seconds >= 0);
+        // Continue from where the animations are now
+        if (m_fixedStep == 0)
+            m_nextTick = m_lastTick;
+        m_fixedStep = seconds;
+    }
+
+    /*!
+        Returns the time the next call to tick() will advance the
+        animations to.
+     */
+    time_point nextFrameTime() const;
+
+    /*!
+        Returns the earliest time a scheduled animation is due to start, or
+        time_point::max() if no animations are scheduled.
+     */
+    time_point nextScheduledStart() const;
+
 private:
     time_point now();
     void setRunning(bool running);
@@ -299,6 +359,10 @@ private:
     };
 
     time_point m_nextTick;
+    time_point m_lastTick;
+    time_point m_presentationTime;
+    double m_frameInterval = 1.0 / 60.0;
+    double m_fixedStep = 0;
 
     std::list<ManagedAnimation> m_runningAnimations;
     std::list<ManagedAnimation> m_scheduledAnimations;
@@ -308,9 +372,33 @@ private:
 
 inline time_point AnimationManager::now()
 {
-    if (!m_running)
-        m_nextTick = clock::now();
-    return m_nextTick;
+    return nextFrameTime();
+}
+
+inline time_point AnimationManager::nextFrameTime() const
+{
+    if (m_fixedStep > 0)
+        return m_nextTick;
+
+    clock::duration interval = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(m_frameInterval));
+    time_point current = clock::now();
+
+    // The first refresh after now, skipping the ones we missed
+    time_point base = m_presentationTime != time_point() ? m_presentationTime : current;
+    time_point t = base + interval;
+    if (t <= current)
+        t += ((current - t) / interval + 1) * interval;
+
+    // Two ticks inside the same refresh interval end up on the same frame
+    return std::max(t, m_lastTick);
+}
+
+inline time_point AnimationManager::nextScheduledStart() const
+{
+    time_point t = time_point::max();
+    for (const ManagedAnimation &m : m_scheduledAnimations)
+        t = std::min(t, m.start);
+    return t;
 }
 
 inline void AnimationManager::setRunning(bool running)
@@ -367,10 +455,10 @@ inline void AnimationManager::stop(const std::shared_ptr<AbstractAnimation> &ani
 
 inline void AnimationManager::tick()
 {
-    // alternatively:
-    // time_point now = clock::now();
-    time_point now = m_nextTick;
-    m_nextTick += std::chrono::milliseconds(16);
+    time_point now = nextFrameTime();
+    if (m_fixedStep > 0)
+        m_nextTick += std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(m_fixedStep));
+    m_lastTick = now;
 
     // std::cout << "AnimationManager::tick: scheduled=" << m_scheduledAnimations.size()
     //           << ", running=" << m_runningAnimations.size() << std::endl;
@@ -380,7 +468,7 @@ inline void AnimationManager::tick()
     auto si = m_scheduledAnimations.begin();
     while (si != m_scheduledAnimations.end()) {
         assert(!si->animation->isRunning());
-        if (si->start < now) {
+        if (si->start <= now) {
             // Make sure we start at t=0
             si->start = now;
             si->animation->setRunning(true);
@@ -75,5 +75,29 @@ struct ColorFilterNode_sepia {
     }
 };
 
+/*!
+    Drives a ParticleSystemNode from the AnimationManager. The animation runs
+    until it is stopped.
+ */
+class Animation_ParticleSystemNode : public AbstractAnimation
+{
+public:
+    Animation_ParticleSystemNode(ParticleSystemNode *node)
+        : m_node(node)
+    {
+        setIterations(-1);
+    }
+
+    void tick(double time) override {
+        assert(isRunning());
+        m_node->advance(float(time - m_lastTime));
+        m_lastTime = time;
+    }
+
+private:
+    ParticleSystemNode *m_node;
+    double m_lastTime = 0;
+};
+
 
 RENGINE_END_NAMESPACE
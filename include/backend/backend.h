@@ -36,6 +36,7 @@ inline Backend::Backend()
 inline void Backend::quit()
 {
     m_running = false;
+    wakeUp();
 }
 
 inline void Backend::run()
@@ -25,6 +25,8 @@
 
 #pragma once
 
+#include <atomic>
+
 RENGINE_BEGIN_NAMESPACE
 
 class Backend
@@ -38,13 +40,32 @@ public:
     void quit();
     void run();
 
+    /*!
+        Implement in the backend to process pending events. When there is
+        nothing to do, the function should block until there is input, a
+        render request, a timer or a call to wakeUp(), so that an idle
+        application doesn't use any CPU.
+     */
     virtual void processEvents() = 0;
 
+    /*!
+        Implement in the backend to make a blocked processEvents() return.
+        This function is thread-safe.
+     */
+    virtual void wakeUp() { }
+
     virtual SurfaceBackendImpl *createSurface(Surface *) = 0;
     virtual void destroySurface(Surface *, SurfaceBackendImpl *) = 0;
 
+    /*!
+        Returns the address of the OpenGL function \a name, or null if the
+        backend can't resolve it. Used for optional entry points which are
+        not in the GLES 2.0 headers.
+     */
+    virtual void *resolveOpenGLFunction(const char *name) { return nullptr; }
+
 protected:
-    bool m_running = true;
+    std::atomic<bool> m_running { true };
 
     static Backend *m_singleton;
 };
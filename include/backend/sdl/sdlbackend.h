@@ -26,6 +26,8 @@
 
 #include <SDL.h>
 
+#include <atomic>
+
 RENGINE_BEGIN_NAMESPACE
 
 class SDLBackend;
@@ -42,9 +44,15 @@ inline void SDLBackend_die(const char *msg)
 class SDLBackend : public Backend, SurfaceBackendImpl
 {
 public:
+    enum UserEventCode {
+        RenderEvent,
+        TimerEvent,
+        WakeUpEvent
+    };
+
     SDLBackend()
     {
-        if (SDL_Init(SDL_INIT_VIDEO) < 0)
+        if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) < 0)
             SDLBackend_die("Unable to initialize SDL");
         logi << "SDLBackend: created..." << std::endl;
     }
@@ -55,18 +63,26 @@ public:
     }
 
     void processEvents() override;
+    void wakeUp() override;
 
     SurfaceBackendImpl *createSurface(Surface *iface) override;
     void destroySurface(Surface *surface, SurfaceBackendImpl *impl) override;
 
+    void *resolveOpenGLFunction(const char *name) override { return SDL_GL_GetProcAddress(name); }
+
     Renderer *createRenderer() override;
 
     void sendPointerEvent(SDL_Event *e, Event::Type type);
+    void sendPointerMove(std::chrono::steady_clock::time_point targetTime);
+    vec2 pointerPosition(SDL_Event *e) const;
+    std::chrono::steady_clock::time_point eventTime(Uint32 timestamp) const;
+    std::chrono::steady_clock::time_point nextPresentationTime() const;
 
     unsigned devicePixelRatio() const;
 
     bool beginRender() override;
     bool commitRender() override;
+    void releaseRender() override;
 
     void show() override;
     void hide() override;
@@ -75,16 +91,32 @@ public:
     void requestSize(vec2 size) override;
 
     void requestRender() override;
+    void requestRenderAt(std::chrono::steady_clock::time_point time) override;
 
     vec2 dpi() const override;
 
+    double vsyncInterval() const override;
+    std::chrono::steady_clock::time_point presentationTime() const override;
+
+    PointerInputStage *pointerInput() override { return &m_pointerInput; }
 
 private:
     Surface *m_surface = nullptr;
     SDL_Window *m_window = nullptr;
     SDL_GLContext m_gl = nullptr;
 
-    bool m_renderRequested = false;
+    std::atomic<bool> m_renderRequested { false };
+
+    SDL_TimerID m_timer = 0;
+    std::chrono::steady_clock::time_point m_timerTime;
+    // Timer events carry the serial of the timer which posted them, so an
+    // event from a timer which was since replaced or removed is ignored.
+    uintptr_t m_timerSerial = 0;
+
+    // Written on the thread which renders, read on the main thread
+    std::atomic<std::chrono::steady_clock::rep> m_presentationTime { 0 };
+
+    PointerInputStage m_pointerInput;
 };
 
 
@@ -107,21 +139,34 @@ inline vec2 SDLBackend::size() const
 
 inline void SDLBackend::processEvents()
 {
+    // Sleep until there is input, a render request, a timer or a wakeUp()
+    if (!SDL_WaitEvent(nullptr))
+        logw << "SDL_WaitEvent failed: " << SDL_GetError() << std::endl;
+
+    // Only process the events which are queued now, so that events which
+    // are pushed while we process them don't starve the main loop.
+    SDL_PumpEvents();
+    int evt = SDL_PeepEvents(nullptr, 0, SDL_PEEKEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT);
+    if (evt < 0)
+        logw << "SDL_PeepEvents failed: " << SDL_GetError() << std::endl;
+
+    bool render = false;
     SDL_Event event;
-    int evt = SDL_PollEvent(nullptr);
-
-    // This odd-looking construct ensures we do not process events that are
-    // pushed onto the queue after we start processing, so as to not starve the
-    // main loop.
-    while (evt-- > 0) {
-        SDL_PollEvent(&event);
-
+    while (evt-- > 0 && SDL_PollEvent(&event)) {
         switch (event.type) {
             case SDL_USEREVENT: {
-                // reset this before onRender so we don't prevent onRender from
-                // scheduling another one..
-                m_renderRequested = false;
-                m_surface->onRender();
+                if (event.user.code == TimerEvent) {
+                    if (m_timer && (uintptr_t) event.user.data2 == m_timerSerial) {
+                        m_timer = 0;
+                        requestRender();
+                    }
+                    break;
+                } else if (event.user.code == WakeUpEvent) {
+                    break;
+                }
+                // Rendered once the queue is drained, so the frame gets all
+                // of the queued moves
+                render = true;
                 break;
             }
             case SDL_MOUSEBUTTONDOWN: {
@@ -133,7 +178,7 @@ inline void SDLBackend::processEvents()
                 break;
             }
             case SDL_MOUSEMOTION: {
-                sendPointerEvent(&event, Event::PointerMove);
+                m_pointerInput.addMove(pointerPosition(&event), eventTime(event.motion.timestamp));
                 break;
             }
             case SDL_QUIT: {
@@ -145,6 +190,19 @@ inline void SDLBackend::processEvents()
             }
         }
     }
+
+    if (render) {
+        // Moves are delivered once per frame, resampled to when the frame
+        // is expected to be on screen.
+        sendPointerMove(nextPresentationTime());
+        // reset this before onRender so we don't prevent onRender from
+        // scheduling another one..
+        m_renderRequested = false;
+        m_surface->onRender();
+    } else if (!m_renderRequested) {
+        // Without a frame coming up, there is nothing to wait for.
+        sendPointerMove(std::chrono::steady_clock::time_point());
+    }
 }
 
 inline void SDLBackend::sendPointerEvent(SDL_Event *sdlEvent, Event::Type type)
@@ -153,9 +211,50 @@ inline void SDLBackend::sendPointerEvent(SDL_Event *sdlEvent, Event::Type type)
     assert(SDL_GetWindowID(m_window) == sdlEvent->button.windowID);
     assert(m_surface);
 
+    // Moves which happened before the press or release go first, as is.
+    sendPointerMove(std::chrono::steady_clock::time_point());
+
+    vec2 pos = pointerPosition(sdlEvent);
+    std::chrono::steady_clock::time_point time = eventTime(sdlEvent->button.timestamp);
+    m_pointerInput.reset(pos, time);
+
     PointerEvent pe(type);
-    pe.initialize(vec2(sdlEvent->button.x, sdlEvent->button.y) * devicePixelRatio());
-    m_surface->onEvent(&pe);
+    pe.initialize(pos);
+    pe.setTime(time);
+    pe.setTimestamp(time);
+    m_surface->sendEvent(&pe);
+}
+
+inline void SDLBackend::sendPointerMove(std::chrono::steady_clock::time_point targetTime)
+{
+    PointerEvent pe(Event::PointerMove);
+    if (m_pointerInput.takeMove(&pe, targetTime))
+        m_surface->sendEvent(&pe);
+}
+
+inline vec2 SDLBackend::pointerPosition(SDL_Event *sdlEvent) const
+{
+    return vec2(sdlEvent->button.x, sdlEvent->button.y) * devicePixelRatio();
+}
+
+inline std::chrono::steady_clock::time_point SDLBackend::eventTime(Uint32 timestamp) const
+{
+    // SDL timestamps are milliseconds since SDL_Init()
+    Uint32 age = SDL_GetTicks() - timestamp;
+    return std::chrono::steady_clock::now() - std::chrono::milliseconds(age);
+}
+
+inline std::chrono::steady_clock::time_point SDLBackend::nextPresentationTime() const
+{
+    // The first refresh after now, counting from the last presented frame
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point presented = presentationTime();
+    double interval = m_window ? vsyncInterval() : 0;
+    if (interval <= 0 || presented.time_since_epoch().count() == 0)
+        return now;
+    double elapsed = std::chrono::duration<double>(now - presented).count();
+    double frames = std::floor(std::max(0.0, elapsed) / interval) + 1;
+    return presented + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(frames * interval));
 }
 
 inline SurfaceBackendImpl *SDLBackend::createSurface(Surface *surface)
@@ -170,7 +269,7 @@ inline SurfaceBackendImpl *SDLBackend::createSurface(Surface *surface)
 
     SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
     SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 0);
-    SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 0);
+    SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_ALPHA_SIZE, 0);
     SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 1);
     SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 4);
@@ -188,6 +287,11 @@ inline SurfaceBackendImpl *SDLBackend::createSurface(Surface *surface)
 
 inline void SDLBackend::destroySurface(Surface *surface, SurfaceBackendImpl *impl)
 {
+    if (m_timer) {
+        SDL_RemoveTimer(m_timer);
+        m_timer = 0;
+        ++m_timerSerial;
+    }
     SDL_GL_DeleteContext(m_gl);
     SDL_DestroyWindow(m_window);
     m_gl = nullptr;
@@ -215,9 +319,19 @@ inline bool SDLBackend::commitRender()
     assert(m_surface);
     assert(m_gl);
     SDL_GL_SwapWindow(m_window);
+    // With a swap interval of 1, the swap blocks until the frame is queued
+    // for the next refresh, so this is a fair estimate of when it shows up.
+    m_presentationTime = std::chrono::steady_clock::now().time_since_epoch().count();
     return true;
 }
 
+inline void SDLBackend::releaseRender()
+{
+    assert(m_window);
+    assert(m_gl);
+    SDL_GL_MakeCurrent(m_window, nullptr);
+}
+
 inline Renderer *SDLBackend::createRenderer()
 {
     assert(m_surface);
@@ -228,9 +342,8 @@ inline Renderer *SDLBackend::createRenderer()
 }
 
 inline void SDLBackend::requestRender() {
-    if (m_renderRequested)
+    if (m_renderRequested.exchange(true))
         return;
-    m_renderRequested = true;
     // we can't trigger the render synchronously. we need to give a chance
     // to process input, animations, whatever -- so push an event onto the
     // queue and we'll get back to this later.
@@ -238,7 +351,7 @@ inline void SDLBackend::requestRender() {
 
     SDL_UserEvent renderev;
     renderev.type = SDL_USEREVENT;
-    renderev.code = 0;
+    renderev.code = RenderEvent;
     renderev.data1 = this;
     renderev.data2 = NULL;
 
@@ -248,6 +361,56 @@ inline void SDLBackend::requestRender() {
     SDL_PushEvent(&event);
 }
 
+inline Uint32 SDLBackend_timerCallback(Uint32, void *serial)
+{
+    // Called on SDL's timer thread, so just post an event to the main thread
+    SDL_Event event;
+    event.type = SDL_USEREVENT;
+    event.user.type = SDL_USEREVENT;
+    event.user.code = SDLBackend::TimerEvent;
+    event.user.data1 = NULL;
+    event.user.data2 = serial;
+    SDL_PushEvent(&event);
+    return 0;
+}
+
+inline void SDLBackend::requestRenderAt(std::chrono::steady_clock::time_point time)
+{
+    if (m_renderRequested)
+        return;
+
+    int64_t delay = std::chrono::duration_cast<std::chrono::milliseconds>(time - std::chrono::steady_clock::now()).count();
+    if (delay <= 0) {
+        requestRender();
+        return;
+    }
+
+    // Keep the timer we have if it fires earlier
+    if (m_timer) {
+        if (m_timerTime <= time)
+            return;
+        SDL_RemoveTimer(m_timer);
+    }
+
+    m_timerTime = time;
+    m_timer = SDL_AddTimer(delay, SDLBackend_timerCallback, (void *) ++m_timerSerial);
+    if (!m_timer) {
+        logw << "SDL_AddTimer failed: " << SDL_GetError() << std::endl;
+        requestRender();
+    }
+}
+
+inline void SDLBackend::wakeUp()
+{
+    SDL_Event event;
+    event.type = SDL_USEREVENT;
+    event.user.type = SDL_USEREVENT;
+    event.user.code = WakeUpEvent;
+    event.user.data1 = this;
+    event.user.data2 = NULL;
+    SDL_PushEvent(&event);
+}
+
 inline void SDLBackend::show()
 {
     assert(m_window);
@@ -279,6 +442,20 @@ inline vec2 SDLBackend::dpi() const
     return vec2(h, v) * devicePixelRatio();
 }
 
+inline double SDLBackend::vsyncInterval() const
+{
+    assert(m_window);
+    SDL_DisplayMode mode;
+    if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(m_window), &mode) != 0 || mode.refresh_rate <= 0)
+        return 0;
+    return 1.0 / mode.refresh_rate;
+}
+
+inline std::chrono::steady_clock::time_point SDLBackend::presentationTime() const
+{
+    return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(m_presentationTime.load()));
+}
+
 #define RENGINE_BACKEND rengine::SDLBackend
 
 RENGINE_END_NAMESPACE
@@ -31,6 +31,7 @@
 
 #include "hwcomposer_window.h"
 
+#include <atomic>
 #include <thread>
 #include <mutex>
 
@@ -56,14 +57,19 @@ public:
     void show() override;
     bool beginRender() override;
     bool commitRender() override;
+    void releaseRender() override;
     vec2 size() const override;
     void requestSize(vec2) override { logd << "resizing is not supported on this backend" << std::endl; }
 
     void requestRender() override;
+    void requestRenderAt(std::chrono::steady_clock::time_point time) override;
 
     // ### Dummy values to make to make it compile!!!
     vec2 dpi() const override { return vec2(200, 200); }
 
+    double vsyncInterval() const override { return m_vsyncDelta / 1000.0; }
+    std::chrono::steady_clock::time_point presentationTime() const override;
+
     Renderer *createRenderer() override {
         OpenGLRenderer *renderer = new OpenGLRenderer();
         renderer->setTargetSurface(m_surface);
@@ -98,17 +104,20 @@ public:
     SfHwcBackend();
 
     void processEvents() override;
+    void wakeUp() override;
 
     void updateTouch();
 
     SurfaceBackendImpl *createSurface(Surface *surface) override;
     void destroySurface(Surface *surface, SurfaceBackendImpl *impl) override;
 
+    void *resolveOpenGLFunction(const char *name) override { return (void *) eglGetProcAddress(name); }
+
     void cb_invalidate() const { logw << std::endl; }
     void cb_vsync(int display, int64_t timestamp);
     void cb_hotplug(int display, int connected) const { logw << "display=" << display << ", connected=" << connected << std::endl; }
 
-    virtual void notifyPendingEvents() { }
+    virtual void notifyPendingEvents() { wakeUp(); }
 
     SfHwcSurface *hwcSurface = nullptr;
     gralloc_module_t *grallocModule = 0;
@@ -129,6 +138,19 @@ public:
 
     bool m_running = true;
 
+    // processEvents() sleeps on this eventfd. It is written to by render
+    // requests, wakeUp() and the touch device thread.
+    int m_wakeFd = -1;
+    std::atomic<bool> m_renderRequested { true };
+
+    // The earliest render asked for with requestRenderAt(), in nanoseconds
+    // on steady_clock, or 0. processEvents() uses it as its poll timeout.
+    std::atomic<int64_t> m_renderDeadline { 0 };
+
+    // Timestamp of the last vsync in nanoseconds on CLOCK_MONOTONIC, which
+    // is what steady_clock uses. Written from the hwc callback thread.
+    std::atomic<int64_t> m_vsyncTime { 0 };
+
     vec2 predictPointerState(vec2 pos, PointerState *pointerState);
 };
 
@@ -222,6 +244,12 @@ public:
     void lock();
     void unlock();
 
+    /*!
+        Sets an eventfd which is written to whenever a new state has been
+        read from the device.
+     */
+    void setWakeFd(int fd) { m_wakeFd = fd; }
+
     const State &state(int historical = 0) const {
         assert(historical >= 0);
         assert(historical < RENGINE_MAX_TOUCH_HISTORY);
@@ -239,6 +267,7 @@ private:
 
     mtdev *m_dev = 0;
     int m_fd = -1;
+    int m_wakeFd = -1;
 
     int m_minX = -1;
     int m_maxX = -1;
@@ -27,6 +27,8 @@
 #pragma once
 
 #include <sys/time.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 
 RENGINE_BEGIN_NAMESPACE
 
@@ -157,8 +159,13 @@ inline SfHwcBackend::SfHwcBackend()
     hotplug = sfhwc_hooks_hotplug;
     hwcDevice->registerProcs(hwcDevice, this);
 
+    m_wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_wakeFd < 0)
+        logw << "failed to create eventfd, event loop will not sleep" << std::endl;
+
     pointerState.id = -1;
     touchDevice = new SfHwcTouchDevice();
+    touchDevice->setWakeFd(m_wakeFd);
     touchDevice->initialize("/dev/touchscreen");
 
     char *overridePrediction = std::getenv("RENGINE_TOUCH_PREDICTION");
@@ -171,22 +178,63 @@ inline SfHwcBackend::SfHwcBackend()
 
 inline void SfHwcBackend::processEvents()
 {
-    if (hwcSurface && hwcSurface->m_surface) {
-        hwcSurface->m_surface->onRender();
+    // Sleep until there is touch input, a render request, a wakeUp() or
+    // the time of a render requested with requestRenderAt().
+    if (m_wakeFd >= 0) {
+        if (!m_renderRequested) {
+            int timeout = -1;
+            if (int64_t deadline = m_renderDeadline) {
+                int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+                // Round up, waking up early would only poll again
+                timeout = (int) std::max<int64_t>(0, (deadline - now + 999999) / 1000000);
+            }
+            pollfd pfd = { m_wakeFd, POLLIN, 0 };
+            poll(&pfd, 1, timeout);
+        }
+        uint64_t count;
+        ::read(m_wakeFd, &count, sizeof(count));
+    } else {
+        m_renderRequested = true;
+    }
+
+    if (int64_t deadline = m_renderDeadline) {
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        if (now >= deadline && m_renderDeadline.compare_exchange_strong(deadline, 0))
+            m_renderRequested = true;
+    }
 
+    if (hwcSurface && hwcSurface->m_surface) {
         updateTouch();
+
+        if (m_renderRequested.exchange(false))
+            hwcSurface->m_surface->onRender();
+    }
+}
+
+inline void SfHwcBackend::wakeUp()
+{
+    if (m_wakeFd >= 0) {
+        uint64_t one = 1;
+        ::write(m_wakeFd, &one, sizeof(one));
     }
 }
 
-inline void SfHwcBackend::cb_vsync(int /*display*/, int64_t /*time*/)
+inline void SfHwcBackend::cb_vsync(int /*display*/, int64_t timestamp)
 {
     // logi << "vsync.." << std::endl;
+    m_vsyncTime = timestamp;
 }
 
 inline double sfhwc_timeval_to_seconds(timeval t) {
     return t.tv_sec + t.tv_usec / 1000000.0;
 }
 
+// The touch device reports on CLOCK_MONOTONIC, which is what steady_clock uses
+inline std::chrono::steady_clock::time_point sfhwc_timeval_to_time_point(timeval t) {
+    return std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::seconds(t.tv_sec) + std::chrono::microseconds(t.tv_usec)));
+}
+
 inline void SfHwcBackend::updateTouch()
 {
     // m_vsyncMutex.lock();
@@ -274,12 +322,16 @@ inline void SfHwcBackend::updateTouch()
         assert(type != Event::Invalid);
         PointerEvent pe(type);
         pe.initialize(pointerState.pos);
-        hwcSurface->m_surface->onEvent(&pe);
+        pe.setTimestamp(sfhwc_timeval_to_time_point(state.time));
+        pe.setTime(pe.timestamp());
+        hwcSurface->m_surface->sendEvent(&pe);
 
     } else if (pointerState.id > 0) {
         PointerEvent pe(Event::PointerUp);
         pe.initialize(pointerState.pos);
-        hwcSurface->m_surface->onEvent(&pe);
+        pe.setTimestamp(sfhwc_timeval_to_time_point(state.time));
+        pe.setTime(pe.timestamp());
+        hwcSurface->m_surface->sendEvent(&pe);
         pointerState.id = -1;
     }
 }
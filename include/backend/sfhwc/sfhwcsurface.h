@@ -178,6 +178,20 @@ inline bool SfHwcSurface::commitRender()
     return true;
 }
 
+inline void SfHwcSurface::releaseRender()
+{
+	logd << std::endl;
+	eglMakeCurrent(m_eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+inline std::chrono::steady_clock::time_point SfHwcSurface::presentationTime() const
+{
+    int64_t t = m_backend->m_vsyncTime;
+    if (t == 0)
+        return std::chrono::steady_clock::time_point();
+    return std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(t)));
+}
+
 inline vec2 SfHwcSurface::size() const
 {
 	return m_size;
@@ -186,6 +200,22 @@ inline vec2 SfHwcSurface::size() const
 inline void SfHwcSurface::requestRender()
 {
 	logd << std::endl;
+    m_backend->m_renderRequested = true;
+    m_backend->notifyPendingEvents();
+}
+
+inline void SfHwcSurface::requestRenderAt(std::chrono::steady_clock::time_point time)
+{
+    if (time <= std::chrono::steady_clock::now()) {
+        requestRender();
+        return;
+    }
+
+    int64_t t = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    int64_t deadline = m_backend->m_renderDeadline;
+    while ((deadline == 0 || t < deadline) && !m_backend->m_renderDeadline.compare_exchange_weak(deadline, t)) { }
+
+    // Wake the event loop so it sleeps with the new timeout
     m_backend->notifyPendingEvents();
 }
 
@@ -233,6 +263,7 @@ inline void SfHwcSurface::initEgl()
 	    EGL_GREEN_SIZE, 8,
 	    EGL_BLUE_SIZE, 8,
 	    EGL_ALPHA_SIZE, 8,
+	    EGL_STENCIL_SIZE, 8,
 	    EGL_NONE
 	};
 
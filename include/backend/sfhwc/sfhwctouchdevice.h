@@ -30,6 +30,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
 #include <linux/input.h>
 #include <mtdev.h>
 
@@ -75,6 +76,12 @@ inline bool SfHwcTouchDevice::initialize(const char *deviceName)
     }
     m_name = std::string(name);
 
+    // Timestamp events on the monotonic clock so they can be compared with
+    // steady_clock, eg. for latency measurements.
+    int clockId = CLOCK_MONOTONIC;
+    if (ioctl(m_fd, EVIOCSCLOCKID, &clockId) < 0)
+        printf("Failed to set the device's clock to CLOCK_MONOTONIC..\n");
+
     m_thread = std::thread(&SfHwcTouchDevice::run, this);
 
     return true;
@@ -123,6 +130,10 @@ inline void SfHwcTouchDevice::readEvent(const input_event &e)
             memcpy(&m_state[m_stateIndex], &m_pending, sizeof(State));
             m_state[m_stateIndex].time = e.time;
             unlock();
+            if (m_wakeFd >= 0) {
+                uint64_t one = 1;
+                ::write(m_wakeFd, &one, sizeof(one));
+            }
         }
     } else if (e.type == EV_ABS) {
         // printf("        -- got EV_ABS\n");
@@ -27,96 +27,404 @@
 
 #include <assert.h>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <mutex>
+#include <atomic>
 
 RENGINE_BEGIN_NAMESPACE
 
+/*!
+    A pool of memory for objects of type T, used through the create() and
+    destroy() functions which RENGINE_ALLOCATION_POOL_DECLARATION adds to a
+    class.
+
+    The pool is made up of chunks allocated from the heap. Freed slots go
+    onto their chunk's free list and are reused before untouched slots or
+    new chunks. When all chunks are full, the pool grows by a new chunk,
+    roughly doubling its capacity each time, until maxCapacity() has been
+    reached. Beyond that, create() falls back to plain new and the
+    fallback is counted.
+
+    The pool is thread safe, so nodes can be created and destroyed on
+    worker threads, such as when building a subtree on the WorkQueue.
+    Each thread keeps a small cache of free slots which it allocates from
+    and frees into without locking. The cache is refilled from, and
+    flushed back to, the shared chunks in batches under the pool's mutex.
+    A thread's cache is flushed when the thread exits, so a pool must
+    outlive the threads which use it, which is always the case for the
+    static pools of the node classes.
+
+    Empty chunks are kept for reuse by default. Call releaseEmptyChunks()
+    to return them to the heap, or enable setReleaseEmptyChunks() to do so
+    as soon as they become empty. Slots held in thread caches keep their
+    chunks alive, so a pool which releases empty chunks bypasses the
+    caches and locks for every allocation instead. A cache can only be
+    touched by its own thread, so other threads hand their cached slots
+    back the next time they use the pool, or when they exit.
+ */
 template <typename T>
 class AllocationPool
 {
 public:
-    AllocationPool()
-        : m_memory(0)
-        , m_free(0)
-        , m_nextFree(0)
-        , m_poolSize(0)
-    {
+    AllocationPool() { }
+
+    ~AllocationPool() {
+        ThreadCache &cache = threadCache();
+        if (cache.pool == this) {
+            cache.count = 0;
+            cache.pool = 0;
+        }
+
+        // Objects which are still alive keep their memory. This only
+        // happens at exit, so leaking it is harmless.
+        if (m_allocatedCount == 0) {
+            for (Chunk &c : m_chunks)
+                delete [] c.slots;
+        }
     }
 
     /*!
-     * For internal use only, called by setup macroes.
+        Makes sure the pool can hold at least \a blockCount objects without
+        growing. This is what RENGINE_ALLOCATION_POOL does.
      */
-    void setMemory(void *m, unsigned blockCount) {
-        assert(m_memory == 0);
-        assert(m_free == 0);
-        assert(m_nextFree == 0);
-        assert(m_poolSize == 0);
+    void reserve(unsigned blockCount) {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        if (blockCount > m_capacity)
+            addChunk(blockCount - m_capacity);
+    }
 
-        m_poolSize = blockCount;
-        m_memory = (T *) m;
-        m_free = (unsigned *) (m_memory + blockCount);
-        m_nextFree = 0;
-        for (unsigned i=0; i<blockCount; ++i)
-            m_free[i] = i;
+    /*!
+        The smallest number of objects a new chunk is made for. Defaults to
+        32. Chunks grow with the capacity of the pool, up to 4096 objects.
+     */
+    void setChunkSize(unsigned blockCount) {
+        assert(blockCount > 0);
+        std::lock_guard<std::mutex> locker(m_mutex);
+        m_chunkSize = blockCount;
     }
+    unsigned chunkSize() const { std::lock_guard<std::mutex> locker(m_mutex); return m_chunkSize; }
 
-    T *allocate() {
-        assert(!isExhausted());
-        assert(m_memory);
-        assert(m_free);
-        assert(m_free[m_nextFree] < m_poolSize);
+    /*!
+        The maximum number of objects the pool will hold, 0 meaning no
+        limit, which is the default.
+     */
+    void setMaxCapacity(unsigned blockCount) {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        m_maxCapacity = blockCount;
+    }
+    unsigned maxCapacity() const { std::lock_guard<std::mutex> locker(m_mutex); return m_maxCapacity; }
 
-        // std::cout << "AllocationPool::allocate: memory=" << m_memory
-        //           << ", free=" << m_free
-        //           << ", nextFree=" << m_nextFree
-        //           << ", free[nextFree]=" << m_free[m_nextFree] << std::endl;
+    /*!
+        Makes the pool release chunks as soon as they become empty. Chunks
+        which are already empty are released right away. Slots cached by
+        other threads are returned, and their chunks released, the next
+        time those threads allocate or deallocate.
+     */
+    void setReleaseEmptyChunks(bool release) {
+        m_releaseEmptyChunks = release;
+        if (release)
+            releaseEmptyChunks();
+    }
+    bool releasesEmptyChunks() const { return m_releaseEmptyChunks; }
 
-        T *t = m_memory + m_free[m_nextFree++];
-        // std::cout << " --> t=" << (void *) t
-        //           << ", nextFree=" << m_nextFree
-        //           << ", free[nextFree]=" << m_free[m_nextFree] << std::endl;
+    /*!
+        Returns the memory of all chunks which have no objects in them to
+        the heap. The calling thread's cache is flushed first. Other threads
+        are asked to flush theirs the next time they use the pool, so the
+        chunks their slots kept alive are released by a later call.
+     */
+    void releaseEmptyChunks() {
+        m_flushGeneration.fetch_add(1, std::memory_order_relaxed);
+        flushThisThread();
 
-        return new (t) T();
+        std::lock_guard<std::mutex> locker(m_mutex);
+        for (unsigned i=0; i<m_chunks.size(); ) {
+            if (m_chunks[i].used == 0)
+                releaseChunk(i);
+            else
+                ++i;
+        }
     }
 
-    void deallocate(T *t) {
-        assert(m_memory);
-        assert(m_free);
-        assert(m_nextFree > 0);
-        assert(isAlloctated(t));
+    /*!
+        Returns a new T from the pool, or null if the pool is full and can't
+        grow any further.
+     */
+    T *allocate() {
+        Slot *slot = 0;
+        if (m_releaseEmptyChunks) {
+            flushThisThread();
+            std::lock_guard<std::mutex> locker(m_mutex);
+            slot = takeSlot();
+        } else {
+            ThreadCache &cache = cacheForThisThread();
+            if (cache.count == 0)
+                refill(&cache);
+            if (cache.count > 0)
+                slot = cache.slots[--cache.count];
+        }
 
-        unsigned pos = t - m_memory;
+        if (!slot) {
+            ++m_fallbackCount;
+            return 0;
+        }
 
-        --m_nextFree;
-        m_free[m_nextFree] = pos;
+        unsigned allocated = ++m_allocatedCount;
+        unsigned peak = m_peakAllocatedCount;
+        while (allocated > peak && !m_peakAllocatedCount.compare_exchange_weak(peak, allocated)) { }
+
+        return new (slot) T();
+    }
+
+    void deallocate(T *t) {
+        assert(isAllocated(t));
 
         // Call the destructor...
         t->~T();
+        --m_allocatedCount;
+
+        Slot *slot = reinterpret_cast<Slot *>(t);
+        if (m_releaseEmptyChunks) {
+            flushThisThread();
+            std::lock_guard<std::mutex> locker(m_mutex);
+            returnSlot(slot);
+        } else {
+            ThreadCache &cache = cacheForThisThread();
+            if (cache.count == ThreadCache::Size)
+                flush(&cache, ThreadCache::BatchSize);
+            cache.slots[cache.count++] = slot;
+        }
     }
 
-    bool isExhausted() const { return m_nextFree >= m_poolSize; }
-    bool isAlloctated(T *t) const { return unsigned(t - m_memory) < m_poolSize; }
+    bool isAllocated(const T *t) const {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        return chunkIndexOf(t) >= 0;
+    }
+    bool isExhausted() const {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        return m_allocatedCount >= m_capacity && m_maxCapacity > 0 && m_capacity >= m_maxCapacity;
+    }
+
+    /*!
+        The number of objects the pool can hold without growing.
+     */
+    unsigned capacity() const { std::lock_guard<std::mutex> locker(m_mutex); return m_capacity; }
+
+    /*!
+        The number of objects currently allocated from the pool, and the
+        highest that number has been.
+     */
+    unsigned allocatedCount() const { return m_allocatedCount; }
+    unsigned peakAllocatedCount() const { return m_peakAllocatedCount; }
+
+    unsigned chunkCount() const { std::lock_guard<std::mutex> locker(m_mutex); return m_chunks.size(); }
+
+    /*!
+        The number of times create() had to fall back to plain new because
+        the pool had reached its maximum capacity.
+     */
+    unsigned fallbackCount() const { return m_fallbackCount; }
 
 private:
-    T *m_memory;
-    unsigned *m_free;
-    unsigned m_nextFree;
-    unsigned m_poolSize;
+    union Slot {
+        Slot *next;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    struct Chunk {
+        Slot *slots;
+        unsigned blockCount;
+        unsigned used;      // slots which are allocated or in a thread cache
+        unsigned untouched; // slots from here on have never been handed out
+        Slot *freeList;
+    };
+
+    struct ThreadCache {
+        enum {
+            BatchSize = 32,
+            Size = 2 * BatchSize
+        };
+        ~ThreadCache() {
+            if (pool)
+                pool->flush(this, count);
+        }
+        AllocationPool *pool = 0;
+        unsigned count = 0;
+        unsigned flushGeneration = 0;
+        Slot *slots[Size];
+    };
+
+    static ThreadCache &threadCache() {
+        static thread_local ThreadCache cache;
+        return cache;
+    }
+
+    // The cache is shared by all pools of the same type on a thread, which
+    // in practice is only one.
+    // releaseEmptyChunks() bumps the flush generation to make every thread
+    // hand its cached slots back on its next visit.
+    ThreadCache &cacheForThisThread() {
+        ThreadCache &cache = threadCache();
+        unsigned generation = m_flushGeneration.load(std::memory_order_relaxed);
+        if (cache.pool != this) {
+            if (cache.pool)
+                cache.pool->flush(&cache, cache.count);
+            cache.pool = this;
+            cache.flushGeneration = generation;
+        } else if (cache.flushGeneration != generation) {
+            flush(&cache, cache.count);
+            cache.flushGeneration = generation;
+        }
+        return cache;
+    }
+
+    void flushThisThread() {
+        ThreadCache &cache = threadCache();
+        if (cache.pool == this && cache.count > 0)
+            flush(&cache, cache.count);
+    }
+
+    void refill(ThreadCache *cache) {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        while (cache->count < ThreadCache::BatchSize) {
+            Slot *slot = takeSlot();
+            if (!slot)
+                break;
+            cache->slots[cache->count++] = slot;
+            // Don't grow the pool only to fill up the cache
+            if (m_chunks[m_current].used == m_chunks[m_current].blockCount && cache->count > 0)
+                break;
+        }
+    }
+
+    void flush(ThreadCache *cache, unsigned count) {
+        assert(count <= cache->count);
+        std::lock_guard<std::mutex> locker(m_mutex);
+        for (unsigned i=0; i<count; ++i)
+            returnSlot(cache->slots[--cache->count]);
+    }
+
+    Slot *takeSlot() {
+        Chunk *chunk = availableChunk();
+        if (!chunk)
+            return 0;
+
+        Slot *slot;
+        if (chunk->freeList) {
+            slot = chunk->freeList;
+            chunk->freeList = slot->next;
+        } else {
+            assert(chunk->untouched < chunk->blockCount);
+            slot = chunk->slots + chunk->untouched++;
+        }
+        ++chunk->used;
+        return slot;
+    }
+
+    void returnSlot(Slot *slot) {
+        int index = chunkIndexOf(reinterpret_cast<T *>(slot));
+        assert(index >= 0);
+        Chunk &chunk = m_chunks[index];
+        slot->next = chunk.freeList;
+        chunk.freeList = slot;
+        --chunk.used;
+
+        if (chunk.used == 0 && m_releaseEmptyChunks)
+            releaseChunk(index);
+    }
+
+    Chunk *availableChunk() {
+        if (m_current < m_chunks.size()) {
+            Chunk &c = m_chunks[m_current];
+            if (c.used < c.blockCount)
+                return &c;
+        }
+        for (unsigned i=0; i<m_chunks.size(); ++i) {
+            if (m_chunks[i].used < m_chunks[i].blockCount) {
+                m_current = i;
+                return &m_chunks[i];
+            }
+        }
+
+        unsigned size = std::max(m_chunkSize, std::min(m_capacity, 4096u));
+        if (m_maxCapacity > 0) {
+            if (m_capacity >= m_maxCapacity)
+                return 0;
+            size = std::min(size, m_maxCapacity - m_capacity);
+        }
+        return addChunk(size);
+    }
+
+    Chunk *addChunk(unsigned blockCount) {
+        Chunk chunk = { new Slot[blockCount], blockCount, 0, 0, 0 };
+        m_capacity += blockCount;
+
+        // Keep the chunks sorted by address so deallocate() can find them
+        // with a binary search.
+        auto pos = std::lower_bound(m_chunks.begin(), m_chunks.end(), chunk,
+                                    [] (const Chunk &a, const Chunk &b) { return a.slots < b.slots; });
+        m_current = pos - m_chunks.begin();
+        m_chunks.insert(pos, chunk);
+        return &m_chunks[m_current];
+    }
+
+    void releaseChunk(unsigned index) {
+        assert(m_chunks[index].used == 0);
+        delete [] m_chunks[index].slots;
+        m_capacity -= m_chunks[index].blockCount;
+        m_chunks.erase(m_chunks.begin() + index);
+        m_current = 0;
+    }
+
+    int chunkIndexOf(const T *t) const {
+        const Slot *s = reinterpret_cast<const Slot *>(t);
+        auto pos = std::upper_bound(m_chunks.begin(), m_chunks.end(), s,
+                                    [] (const Slot *s, const Chunk &c) { return s < c.slots; });
+        if (pos == m_chunks.begin())
+            return -1;
+        --pos;
+        if (s >= pos->slots + pos->blockCount)
+            return -1;
+        return pos - m_chunks.begin();
+    }
+
+    // Protects the chunks and the settings below
+    mutable std::mutex m_mutex;
+    std::vector<Chunk> m_chunks;
+    unsigned m_current = 0;
+    unsigned m_capacity = 0;
+    unsigned m_chunkSize = 32;
+    unsigned m_maxCapacity = 0;
+
+    std::atomic<unsigned> m_allocatedCount { 0 };
+    std::atomic<unsigned> m_peakAllocatedCount { 0 };
+    std::atomic<unsigned> m_fallbackCount { 0 };
+    std::atomic<bool> m_releaseEmptyChunks { false };
+    std::atomic<unsigned> m_flushGeneration { 0 };
 };
 
+/*!
+    Reserves room for \a Count objects in the pool of \a Type. The pool
+    still grows beyond that when needed, so this is only a hint, and the
+    same can be done at runtime through Type::allocationPool().
+ */
 #define RENGINE_ALLOCATION_POOL(Type, Name, Count) \
-    Type::__allocation_pool_##Name.setMemory(alloca(Count * (sizeof(Type) + sizeof(unsigned))), Count)
+    Type::__allocation_pool_##Name.reserve(Count)
 
 #define RENGINE_ALLOCATION_POOL_DECLARATION(Type, Name)     \
     friend class AllocationPool<Type>;                      \
     static AllocationPool<Type> __allocation_pool_##Name;   \
+    static AllocationPool<Type> *allocationPool() {         \
+        return &__allocation_pool_##Name;                   \
+    }                                                       \
     static Type *create() {                                 \
-        if (__allocation_pool_##Name.isExhausted())         \
+        Type *t = __allocation_pool_##Name.allocate();      \
+        if (!t)                                             \
             return new Type();                              \
-        else  {                                             \
-            Type *t = __allocation_pool_##Name.allocate();  \
-            t->__mark_as_pool_allocated();                  \
-            return t;                                       \
-        }                                                   \
+        t->__mark_as_pool_allocated();                      \
+        return t;                                           \
     }                                                       \
     virtual void destroy() override {                       \
         if (__is_pool_allocated())                          \
@@ -128,14 +436,15 @@ private:
 #define RENGINE_ALLOCATION_POOL_DECLARATION_IN_BASECLASS(Type, Name)     \
     friend class AllocationPool<Type>;                                   \
     static AllocationPool<Type> __allocation_pool_##Name;                \
+    static AllocationPool<Type> *allocationPool() {                      \
+        return &__allocation_pool_##Name;                                \
+    }                                                                    \
     static Type *create() {                                              \
-        if (__allocation_pool_##Name.isExhausted())                      \
+        Type *t = __allocation_pool_##Name.allocate();                   \
+        if (!t)                                                          \
             return new Type();                                           \
-        else  {                                                          \
-            Type *t = __allocation_pool_##Name.allocate();               \
-            t->__mark_as_pool_allocated();                               \
-            return t;                                                    \
-        }                                                                \
+        t->__mark_as_pool_allocated();                                   \
+        return t;                                                        \
     }                                                                    \
     virtual void destroy() {                                             \
         if (__is_pool_allocated())                                       \
@@ -35,6 +35,15 @@ struct KalmanFilter2D
     void initialize(float pos, float velocity);
     void update(float pos, float velocity, float timeDelta);
 
+    /*!
+        Sets how much the position and velocity are expected to deviate from
+        the model between updates and how much the measurements are trusted.
+        Raising the position noise relative to the measurement noise makes
+        the filter follow the input more closely, which suits precise
+        devices like a mouse. The defaults are 0, 0.1 and 0.1.
+     */
+    void setNoise(float positionNoise, float velocityNoise, float measurementNoise);
+
     float position() const { return x.x; }
     float velocity() const { return x.y; }
 
@@ -93,6 +102,15 @@ private:
 
 inline KalmanFilter2D::KalmanFilter2D()
 {
+    setNoise(0.0f, 0.1f, 0.1f);
+}
+
+inline void KalmanFilter2D::setNoise(float positionNoise, float velocityNoise, float measurementNoise)
+{
+    Q = mat2(positionNoise, 0.0f,
+             0.0f, velocityNoise);
+    R = mat2(measurementNoise, 0.0f,
+             0.0f, measurementNoise);
 }
 
 inline void KalmanFilter2D::initialize(float pos, float velocity)
@@ -101,11 +119,6 @@ inline void KalmanFilter2D::initialize(float pos, float velocity)
 
     P = mat2(0.0f, 0.0f,
              0.0f, 0.0f);
-
-    Q = mat2(0.0f, 0.0f,
-             0.0f, 0.1f);
-    R = mat2(0.1f, 0.0f,
-             0.0f, 0.1f);
 }
 
 inline void KalmanFilter2D::update(float pos, float velocity, float dT)
@@ -0,0 +1,98 @@
+/*
+    Copyright (c) 2016, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    Collects latency samples, in seconds, into fixed buckets of half a
+    millisecond up to 200ms, so that percentiles can be read out at any
+    time without storing the samples themselves. Samples beyond the last
+    bucket are counted as overflow.
+ */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram() { reset(); }
+
+    void record(double seconds) {
+        int bucket = seconds <= 0 ? 0 : int(seconds / BucketWidth);
+        ++m_buckets[std::min(bucket, int(BucketCount))];
+        if (m_count == 0 || seconds < m_min)
+            m_min = seconds;
+        if (m_count == 0 || seconds > m_max)
+            m_max = seconds;
+        m_sum += seconds;
+        ++m_count;
+    }
+
+    /*!
+        Returns the latency which \a p percent of the samples are at or
+        below, rounded up to the bucket it falls in. Returns max() if it
+        falls in the overflow, and 0 if there are no samples.
+     */
+    double percentile(double p) const {
+        if (m_count == 0)
+            return 0;
+        unsigned long long target = (unsigned long long) std::ceil(std::max(0.0, std::min(100.0, p)) / 100.0 * m_count);
+        unsigned long long seen = 0;
+        for (int i=0; i<BucketCount; ++i) {
+            seen += m_buckets[i];
+            if (seen >= target && seen > 0)
+                return std::min((i + 1) * BucketWidth, m_max);
+        }
+        return m_max;
+    }
+
+    unsigned long long count() const { return m_count; }
+    unsigned long long overflowCount() const { return m_buckets[BucketCount]; }
+    double average() const { return m_count ? m_sum / m_count : 0; }
+    double min() const { return m_min; }
+    double max() const { return m_max; }
+
+    void reset() {
+        std::fill(m_buckets, m_buckets + BucketCount + 1, 0);
+        m_count = 0;
+        m_sum = 0;
+        m_min = 0;
+        m_max = 0;
+    }
+
+private:
+    enum { BucketCount = 400 };
+    static constexpr double BucketWidth = 0.0005;
+
+    unsigned long long m_buckets[BucketCount + 1];
+    unsigned long long m_count;
+    double m_sum;
+    double m_min;
+    double m_max;
+};
+
+RENGINE_END_NAMESPACE
@@ -77,6 +77,8 @@ struct vec2 {
     bool operator!=(vec2 o) const { return !(*this == o); }
     vec2 operator*(float f) const { return vec2(x*f, y*f); }
 
+    float length() const { return std::sqrt(x*x + y*y); }
+
     float x;
     float y;
 };
@@ -594,6 +596,18 @@ public:
         return (*this) | r.tl | r.br;
     }
 
+    // The intersection of two rects. Check isEmpty() on the result, it is
+    // inverted when the rects don't overlap.
+    rect2d operator&(rect2d r) const {
+        return rect2d(r.tl.x > tl.x ? r.tl.x : tl.x,
+                      r.tl.y > tl.y ? r.tl.y : tl.y,
+                      r.br.x < br.x ? r.br.x : br.x,
+                      r.br.y < br.y ? r.br.y : br.y);
+    }
+
+    bool isEmpty() const { return !(tl.x < br.x && tl.y < br.y); }
+    bool intersects(rect2d r) const { return !(*this & r).isEmpty(); }
+
     bool operator==(rect2d o) const { return tl == o.tl && br == o.br; }
 
     bool contains(vec2 p) const {
@@ -29,15 +29,48 @@
 #include <vector>
 #include <functional>
 #include <algorithm>
+#include <atomic>
+#include <unordered_set>
+#include <unordered_map>
 
 RENGINE_BEGIN_NAMESPACE
 
 template <typename ...Arguments> class Signal;
+class SignalEmitter;
+class SignalQueue;
 
 class SignalBase
 {
 public:
+    SignalBase() : m_id(nextId()) { }
     virtual ~SignalBase() {}
+
+    /*!
+        A number which identifies this signal. Ids are handed out in order
+        of construction and decide which bit of an emitter's connection
+        mask the signal uses.
+     */
+    unsigned id() const { return m_id; }
+
+protected:
+    friend class SignalQueue;
+
+    unsigned maskBit() const { return 1u << (m_id % 32); }
+
+    // Hands the deferred handlers of this signal on \a emitter to \a queue.
+    virtual void scheduleDeferred(SignalQueue *queue, SignalEmitter *emitter, unsigned depth) = 0;
+
+    // Returns true if \a handler is still connected to this signal on
+    // \a emitter with a deferred connection.
+    virtual bool isConnectedDeferred(SignalEmitter *emitter, void *handler) const = 0;
+
+private:
+    static unsigned nextId() {
+        static std::atomic<unsigned> next(0);
+        return next.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    unsigned m_id;
 };
 
 
@@ -47,6 +80,13 @@ class SignalHandler
 public:
     virtual ~SignalHandler() { }
     virtual void onSignal(Arguments ...args) = 0;
+
+private:
+    friend class SignalQueue;
+
+    // Where this handler is called in a SignalQueue flush, learned from the
+    // handlers whose emissions it has been triggered by.
+    unsigned m_deferredDepth = 0;
 };
 
 template<typename ... Arguments>
@@ -60,6 +100,16 @@ private:
 };
 
 
+/*!
+    Base class for objects which emit signals.
+
+    The connections of an emitter are kept in a single array, sorted by
+    signal id, so all handlers of one signal are next to each other and no
+    allocation is made per signal. A 32-bit mask has a bit set for each
+    signal id, modulo 32, which has connections. Emitting a signal which
+    nobody listens to, which is by far the most common case for property
+    setters, is a single test against that mask.
+ */
 class SignalEmitter
 {
 public:
@@ -67,75 +117,378 @@ public:
 
     inline virtual ~SignalEmitter();
 
+    /*!
+        Returns true if any signal may have connections for this emitter.
+     */
+    bool hasConnections() const { return m_connectionMask != 0; }
+
 private:
     template <typename ...Arguments>
     friend class Signal;
-    struct BucketBase
+    friend class SignalQueue;
+
+    struct Connection
     {
-        virtual ~BucketBase() { }
+        unsigned signalId;
+        bool deferred;
+        void *handler;  // a SignalHandler of the signal's argument types
+    };
+
+    std::vector<Connection> *m_connections = nullptr;
+    unsigned m_connectionMask = 0;
+    unsigned m_queuedCount = 0;     // entries in the thread's SignalQueue
+};
+
+
+/*!
+    Collects the emissions of signals with deferred connections, so their
+    handlers can be called once per frame rather than once per change.
+
+    When a signal with deferred connections is emitted, the emitter and
+    signal pair is queued, unless it is already queued. flush() then calls
+    each deferred handler of the queued pairs, and a handler which is
+    connected to several of them, such as a binding which depends on both
+    the x and the width of a node, is only called once.
+
+    Handlers are called in order of their dependency depth. A handler which
+    is triggered by the emissions of another handler is given a greater
+    depth than that handler, and emissions made while handlers run are
+    added to the same flush. So when bindings form a diamond, where C
+    depends on A and on B, and B depends on A, C waits for B and is
+    evaluated once. Depths are learned as handlers run and kept for later
+    flushes, so only the flush which first discovers a dependency may call
+    a handler a second time.
+
+    There is one queue per thread, and nothing flushes it other than an
+    explicit call to flush(). StandardSurface flushes the queue of the
+    thread it runs on after update() and the animations, just before the
+    scene is rendered. Changes made elsewhere, such as in an event handler,
+    are picked up by the next frame, so request one if needed. Emissions
+    on other threads, such as a worker building a subtree, go into that
+    thread's queue and their deferred handlers are not called until that
+    thread flushes it. Deferred connections are meant for objects which
+    live on the thread which renders them.
+ */
+class SignalQueue
+{
+public:
+    /*!
+        The number of times one handler may be called in a single flush()
+        before the handlers are assumed to trigger each other in a cycle and
+        what is left is dropped.
+     */
+    enum { MaxRounds = 64 };
+
+    /*!
+        Returns the queue of the calling thread.
+     */
+    static SignalQueue *current() {
+        static thread_local SignalQueue queue;
+        return &queue;
+    }
+
+    bool isEmpty() const { return m_entries.empty(); }
+    unsigned size() const { return m_entries.size(); }
+
+    inline void post(SignalEmitter *emitter, SignalBase *signal);
+    inline void flush();
+
+    // Removes all queued entries for \a emitter. Called when it is destroyed.
+    inline void cancel(SignalEmitter *emitter);
+
+    // Adds \a handler, connected to \a signal on \a emitter, to the handlers
+    // to call, no earlier than at \a depth. Used by Signal.
+    inline void schedule(SignalEmitter *emitter, SignalBase *signal, SignalHandler<> *handler, unsigned depth);
+
+private:
+    struct Entry {
+        SignalEmitter *emitter;
         SignalBase *signal;
     };
-    std::vector<BucketBase *> *m_buckets = nullptr;
+
+    // A handler waiting to be called, and the connection it was triggered
+    // through, which is checked again before the call.
+    struct Pending {
+        unsigned depth;
+        unsigned sequence;
+        SignalEmitter *emitter;
+        SignalBase *signal;
+        SignalHandler<> *handler;
+        bool operator<(const Pending &o) const {
+            // Reversed, so the heap has the lowest depth on top
+            return depth != o.depth ? depth > o.depth : sequence > o.sequence;
+        }
+    };
+
+    struct EntryHash {
+        size_t operator()(const std::pair<SignalEmitter *, unsigned> &key) const {
+            return std::hash<SignalEmitter *>()(key.first) ^ (size_t(key.second) * 0x9e3779b9u);
+        }
+    };
+
+    inline void dropAll();
+
+    // Emissions not yet handed to their handlers, and for each of them the
+    // lowest depth its handlers may be called at.
+    std::vector<Entry> m_entries;
+    std::unordered_map<std::pair<SignalEmitter *, unsigned>, unsigned, EntryHash> m_queued;
+
+    // A heap of the handlers to call in this flush, and those of them which
+    // have not been called since they were last triggered.
+    std::vector<Pending> m_pending;
+    std::unordered_set<SignalHandler<> *> m_dirty;
+    std::unordered_map<SignalHandler<> *, unsigned> m_calls;
+    unsigned m_sequence = 0;
+
+    // The depth for emissions made by the handler being called, 0 outside
+    unsigned m_emitDepth = 0;
+    bool m_flushing = false;
 };
 
 
 template <typename ...Arguments>
 class Signal : SignalBase
 {
-    struct Bucket : public SignalEmitter::BucketBase
-    {
-        std::vector<SignalHandler<Arguments ...> *> handlers;
-    };
+    typedef SignalEmitter::Connection Connection;
 
 public:
+    using SignalBase::id;
+
+    enum ConnectionType {
+        DirectConnection,
+        DeferredConnection
+    };
+
     void emit(SignalEmitter *emitter, Arguments ... args)
     {
-        if (Bucket *bucket = findBucket(emitter)) {
-            for (auto handler : bucket->handlers)
-                handler->onSignal(args...);
+        if (!(emitter->m_connectionMask & maskBit()))
+            return;
+
+        // A handler may connect to the emitter and reallocate the array, so
+        // index into it rather than holding on to an iterator.
+        std::vector<Connection> &connections = *emitter->m_connections;
+        bool deferred = false;
+        for (unsigned i = firstConnection(emitter);
+             i < connections.size() && connections[i].signalId == id(); ++i) {
+            if (connections[i].deferred)
+                deferred = true;
+            else
+                static_cast<SignalHandler<Arguments ...> *>(connections[i].handler)->onSignal(args...);
         }
+        if (deferred)
+            SignalQueue::current()->post(emitter, this);
     }
 
-    void connect(SignalEmitter *emitter, SignalHandler<Arguments ...> *handler)
+    /*!
+        Connects \a handler to this signal on \a emitter.
+
+        With a DeferredConnection, the handler is not called when the signal
+        is emitted, but once when the thread's SignalQueue is flushed, no
+        matter how many times the signal was emitted in between. This is
+        only supported for signals without arguments.
+     */
+    void connect(SignalEmitter *emitter, SignalHandler<Arguments ...> *handler, ConnectionType type = DirectConnection)
     {
-        Bucket *bucket = findBucket(emitter);
-        if (!bucket) {
-            bucket = new Bucket();
-            bucket->signal = this;
-            if (!emitter->m_buckets) {
-                emitter->m_buckets = new std::vector<SignalEmitter::BucketBase *>();
-            }
-            emitter->m_buckets->push_back(bucket);
-        }
-        bucket->handlers.push_back(handler);
+        assert(type == DirectConnection || sizeof...(Arguments) == 0);
+        if (!emitter->m_connections)
+            emitter->m_connections = new std::vector<Connection>();
+        std::vector<Connection> &connections = *emitter->m_connections;
+
+        // Insert after the existing handlers for this signal so they are
+        // called in the order they were connected.
+        unsigned i = firstConnection(emitter);
+        while (i < connections.size() && connections[i].signalId == id())
+            ++i;
+        Connection c = { id(), type == DeferredConnection, handler };
+        connections.insert(connections.begin() + i, c);
+        emitter->m_connectionMask |= maskBit();
     }
 
     void disconnect(SignalEmitter *emitter, SignalHandler<Arguments ...> *handler)
     {
-        Bucket *bucket = findBucket(emitter);
-        assert(bucket);
-        auto pos = std::find(bucket->handlers.begin(), bucket->handlers.end(), handler);
-        assert(pos != bucket->handlers.end());
-        bucket->handlers.erase(pos);
+        assert(emitter->m_connections);
+        std::vector<Connection> &connections = *emitter->m_connections;
+        unsigned i = firstConnection(emitter);
+        while (i < connections.size() && connections[i].signalId == id() && connections[i].handler != handler)
+            ++i;
+        assert(i < connections.size() && connections[i].signalId == id());
+        connections.erase(connections.begin() + i);
+
+        // Recalculate the mask, as other signals may share our bit
+        unsigned mask = 0;
+        for (const Connection &c : connections)
+            mask |= 1u << (c.signalId % 32);
+        emitter->m_connectionMask = mask;
     }
+
 private:
+    void scheduleDeferred(SignalQueue *queue, SignalEmitter *emitter, unsigned depth) override
+    {
+        scheduleDeferred(queue, emitter, depth, std::integral_constant<bool, sizeof...(Arguments) == 0>());
+    }
 
-    Bucket *findBucket(SignalEmitter *emitter) const
+    void scheduleDeferred(SignalQueue *, SignalEmitter *, unsigned, std::false_type)
     {
-        if (!emitter->m_buckets)
-            return 0;
-        for (SignalEmitter::BucketBase *bucket : *emitter->m_buckets) {
-            if (bucket->signal == this)
-                return static_cast<Bucket *>(bucket);
+        assert(!"deferred connections are only supported for signals without arguments");
+    }
+
+    inline void scheduleDeferred(SignalQueue *queue, SignalEmitter *emitter, unsigned depth, std::true_type);
+
+    bool isConnectedDeferred(SignalEmitter *emitter, void *handler) const override
+    {
+        if (!emitter->m_connections)
+            return false;
+        const std::vector<Connection> &connections = *emitter->m_connections;
+        for (unsigned i = firstConnection(emitter);
+             i < connections.size() && connections[i].signalId == id(); ++i) {
+            if (connections[i].deferred && connections[i].handler == handler)
+                return true;
         }
-        return 0;
+        return false;
+    }
+
+    // Returns the index of the first connection for this signal, or where
+    // it would be inserted.
+    unsigned firstConnection(SignalEmitter *emitter) const
+    {
+        if (!emitter->m_connections)
+            return 0;
+        const std::vector<Connection> &connections = *emitter->m_connections;
+        auto pos = std::lower_bound(connections.begin(), connections.end(), id(),
+                                    [] (const Connection &c, unsigned id) { return c.signalId < id; });
+        return pos - connections.begin();
     }
 };
 
 SignalEmitter::~SignalEmitter()
 {
     onDestruction.emit(this);
-    delete m_buckets;
+    if (m_queuedCount)
+        SignalQueue::current()->cancel(this);
+    delete m_connections;
+}
+
+template <typename ...Arguments>
+inline void Signal<Arguments...>::scheduleDeferred(SignalQueue *queue, SignalEmitter *emitter, unsigned depth, std::true_type)
+{
+    if (!emitter->m_connections)
+        return;
+    std::vector<Connection> &connections = *emitter->m_connections;
+    for (unsigned i = firstConnection(emitter);
+         i < connections.size() && connections[i].signalId == id(); ++i) {
+        if (connections[i].deferred)
+            queue->schedule(emitter, this, static_cast<SignalHandler<> *>(connections[i].handler), depth);
+    }
+}
+
+inline void SignalQueue::post(SignalEmitter *emitter, SignalBase *signal)
+{
+    auto inserted = m_queued.insert(std::make_pair(std::make_pair(emitter, signal->id()), m_emitDepth));
+    if (!inserted.second) {
+        inserted.first->second = std::max(inserted.first->second, m_emitDepth);
+        return;
+    }
+    Entry e = { emitter, signal };
+    m_entries.push_back(e);
+    ++emitter->m_queuedCount;
+}
+
+inline void SignalQueue::schedule(SignalEmitter *emitter, SignalBase *signal, SignalHandler<> *handler, unsigned depth)
+{
+    if (handler->m_deferredDepth < depth)
+        handler->m_deferredDepth = depth;
+    m_dirty.insert(handler);
+    Pending p = { handler->m_deferredDepth, m_sequence++, emitter, signal, handler };
+    m_pending.push_back(p);
+    std::push_heap(m_pending.begin(), m_pending.end());
+    ++emitter->m_queuedCount;
+}
+
+inline void SignalQueue::flush()
+{
+    if (m_flushing)
+        return;
+    m_flushing = true;
+
+    while (true) {
+        // Hand the queued emissions to their handlers. This runs again after
+        // each call, so emissions made by a handler are ordered together
+        // with what is already pending.
+        for (const Entry &e : m_entries) {
+            --e.emitter->m_queuedCount;
+            e.signal->scheduleDeferred(this, e.emitter, m_queued[std::make_pair(e.emitter, e.signal->id())]);
+        }
+        m_entries.clear();
+        m_queued.clear();
+
+        if (m_pending.empty())
+            break;
+
+        std::pop_heap(m_pending.begin(), m_pending.end());
+        Pending p = m_pending.back();
+        m_pending.pop_back();
+
+        if (!p.emitter) // destroyed by an earlier handler
+            continue;
+        --p.emitter->m_queuedCount;
+
+        // The handler may have been disconnected, and even deleted, since it
+        // was scheduled, so check before touching it.
+        if (!m_dirty.count(p.handler) || !p.signal->isConnectedDeferred(p.emitter, p.handler))
+            continue;
+
+        // Triggered again from deeper down since, so wait until then
+        if (p.depth != p.handler->m_deferredDepth) {
+            schedule(p.emitter, p.signal, p.handler, p.handler->m_deferredDepth);
+            continue;
+        }
+
+        if (++m_calls[p.handler] > MaxRounds) {
+            logw << "deferred handlers are still being triggered after " << MaxRounds
+                 << " calls, dropping " << m_pending.size() + m_entries.size() << " queued emissions" << std::endl;
+            dropAll();
+            break;
+        }
+
+        m_dirty.erase(p.handler);
+        m_emitDepth = p.depth + 1;
+        p.handler->onSignal();
+        m_emitDepth = 0;
+    }
+
+    m_dirty.clear();
+    m_calls.clear();
+    m_flushing = false;
+}
+
+inline void SignalQueue::dropAll()
+{
+    for (const Entry &e : m_entries)
+        --e.emitter->m_queuedCount;
+    for (const Pending &p : m_pending) {
+        if (p.emitter)
+            --p.emitter->m_queuedCount;
+    }
+    m_entries.clear();
+    m_queued.clear();
+    m_pending.clear();
+}
+
+inline void SignalQueue::cancel(SignalEmitter *emitter)
+{
+    for (Pending &p : m_pending) {
+        if (p.emitter == emitter)
+            p.emitter = 0;
+    }
+    for (unsigned i=0; i<m_entries.size(); ) {
+        if (m_entries[i].emitter == emitter) {
+            m_queued.erase(std::make_pair(emitter, m_entries[i].signal->id()));
+            m_entries.erase(m_entries.begin() + i);
+        } else {
+            ++i;
+        }
+    }
+    emitter->m_queuedCount = 0;
 }
 
 #define RENGINE_SIGNALEMITTER_DEFINE_SIGNALS                                        \
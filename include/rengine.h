@@ -79,6 +79,7 @@ RENGINE_END_NAMESPACE
 #include "common/allocationpool.h"
 #include "common/colormatrix.h"
 #include "common/kalmanfilter.h"
+#include "common/latencyhistogram.h"
 
 #include "object/property.h"
 #include "object/signal.h"
@@ -87,17 +88,22 @@ RENGINE_END_NAMESPACE
 #include "backend/backend_decl.h"
 
 #include "windowsystem/event.h"
+#include "windowsystem/pointerinput.h"
 #include "windowsystem/surface.h"
 
 #include "scenegraph/opengl.h"
 #include "scenegraph/node.h"
 #include "scenegraph/noderef.h"
 #include "scenegraph/texture.h"
+#include "scenegraph/listnode.h"
+#include "scenegraph/particlesystemnode.h"
 #include "scenegraph/renderer.h"
+#include "scenegraph/openglprogrambinarycache.h"
 #include "scenegraph/openglshaderprogram.h"
 #include "scenegraph/opengltexture.h"
 #include "scenegraph/openglrenderer.h"
 #include "scenegraph/layoutnode.h"
+#include "scenegraph/flatscene.h"
 
 #include "animationsystem/animation.h"
 #include "animationsystem/animationappliers.h"
@@ -112,6 +118,9 @@ RENGINE_END_NAMESPACE
 #endif
 
 #include "util/workqueue.h"
+#include "util/mipmapjob.h"
+#include "util/scenemirror.h"
+#include "util/pointertargetindex.h"
 #include "util/standardsurface.h"
 #include "util/units.h"
 #include "util/glyphs.h"
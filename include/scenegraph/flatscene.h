@@ -0,0 +1,408 @@
+/*
+    Copyright (c) 2016, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    A data-oriented alternative to the Node tree for scenes which are
+    mostly made of rectangles, textures, transforms and opacity.
+
+    Nodes are 32-bit handles into arrays kept in depth-first order. The
+    hierarchy (kind, parent, end of subtree) lives in one set of arrays and
+    each kind keeps its own data, such as matrices or geometry, in separate
+    arrays. Because parents always come before their children, world
+    matrices and opacities are computed in a single linear pass over the
+    transform and opacity nodes only, and the drawables can be visited in
+    paint order without chasing a single pointer. Every node refers to the
+    world matrix and opacity of its nearest enclosing transform and
+    opacity node, so nodes which change neither have no per-node state to
+    update.
+
+    A scene is either built directly, using the begin and end functions in
+    depth-first order, or converted from an existing Node tree with
+    build(Node *), which is the migration path for existing code. Node
+    types which have no equivalent here become groups, so their children
+    are kept but the node itself has no effect. 3D projections are not
+    supported.
+
+    The properties of existing nodes can be changed at any time, but the
+    structure can only be appended to. To restructure a scene, clear() it
+    and build it again, which is a linear copy and typically cheaper than
+    the equivalent number of node allocations.
+ */
+class FlatScene
+{
+public:
+    typedef uint32_t Handle;
+    static const Handle InvalidHandle = 0xffffffff;
+
+    enum Kind : uint8_t {
+        GroupKind,
+        TransformKind,
+        OpacityKind,
+        RectangleKind,
+        TextureKind
+    };
+
+    void clear();
+    void reserve(unsigned nodeCount);
+
+    /*!
+        Converts the tree at \a root into this scene, replacing what was
+        there before. Returns the handle of the root, which is always 0.
+     */
+    Handle build(Node *root);
+
+    /*!
+        Opens a new node as the last child of the currently open node, or
+        as a new root if no node is open. Children are added until the
+        matching end().
+     */
+    Handle beginGroup() { return begin(GroupKind, 0); }
+    Handle beginTransform(const mat4 &matrix);
+    Handle beginOpacity(float opacity);
+    Handle beginRectangle(const rect2d &geometry, vec4 color);
+    Handle beginTexture(const rect2d &geometry, const Texture *texture);
+    void end();
+
+    Handle addRectangle(const rect2d &geometry, vec4 color) { Handle h = beginRectangle(geometry, color); end(); return h; }
+    Handle addTexture(const rect2d &geometry, const Texture *texture) { Handle h = beginTexture(geometry, texture); end(); return h; }
+
+    unsigned size() const { return m_kind.size(); }
+    Kind kind(Handle h) const { return Kind(m_kind.at(h)); }
+    Handle parent(Handle h) const { return m_parent.at(h); }
+
+    /*!
+        Returns the handle one past the last descendant of \a h, so the
+        subtree of \a h is the range [h, subtreeEnd(h)).
+     */
+    Handle subtreeEnd(Handle h) const { return m_end.at(h); }
+
+    /*!
+        Returns the node \a h was converted from, or null if the scene was
+        not built from a Node tree.
+     */
+    Node *sourceNode(Handle h) const { return h < m_sourceNodes.size() ? m_sourceNodes[h] : 0; }
+
+    const mat4 &matrix(Handle h) const;
+    void setMatrix(Handle h, const mat4 &matrix);
+    float opacity(Handle h) const;
+    void setOpacity(Handle h, float opacity);
+    const rect2d &geometry(Handle h) const;
+    void setGeometry(Handle h, const rect2d &geometry);
+    vec4 color(Handle h) const;
+    void setColor(Handle h, vec4 color);
+    const Texture *texture(Handle h) const;
+    void setTexture(Handle h, const Texture *texture);
+
+    /*!
+        Recomputes the world matrices and opacities after a transform or an
+        opacity has changed. This is a single pass over the hierarchy and is
+        called implicitly by the functions that need it.
+     */
+    void update();
+
+    const mat4 &worldMatrix(Handle h) { update(); return m_worldMatrices[m_matrixSpace.at(h)]; }
+    float worldOpacity(Handle h) { update(); return m_worldOpacities[m_opacitySpace.at(h)]; }
+
+    /*!
+        Calls \a visit for each rectangle and texture in paint order, as
+        visit(handle, worldMatrix, geometry, color, texture, opacity).
+     */
+    template <typename Visitor>
+    void forEachDrawable(Visitor visit);
+
+private:
+    Handle begin(Kind kind, uint32_t data);
+
+    // The hierarchy, one entry per node in depth-first order
+    std::vector<uint8_t> m_kind;
+    std::vector<Handle> m_parent;
+    std::vector<Handle> m_end;
+    std::vector<uint32_t> m_data;   // index into the arrays of the node's kind
+    std::vector<uint32_t> m_matrixSpace;    // index into m_worldMatrices
+    std::vector<uint32_t> m_opacitySpace;   // index into m_worldOpacities
+
+    // Per-kind data
+    std::vector<mat4> m_matrices;
+    std::vector<uint32_t> m_matrixParentSpace;
+    std::vector<float> m_opacities;
+    std::vector<uint32_t> m_opacityParentSpace;
+    std::vector<rect2d> m_geometries;
+    std::vector<vec4> m_colors;
+    std::vector<const Texture *> m_textures;
+    std::vector<Handle> m_drawables;   // in the same order as m_geometries
+
+    // Derived by update(). Entry 0 is the space outside any transform or
+    // opacity node, the others belong to m_matrices and m_opacities.
+    std::vector<mat4> m_worldMatrices = std::vector<mat4>(1);
+    std::vector<float> m_worldOpacities = std::vector<float>(1, 1.0f);
+    bool m_worldDirty = false;
+
+    std::vector<Node *> m_sourceNodes;
+    Handle m_open = InvalidHandle;
+};
+
+inline void FlatScene::clear()
+{
+    m_kind.clear();
+    m_parent.clear();
+    m_end.clear();
+    m_data.clear();
+    m_matrixSpace.clear();
+    m_opacitySpace.clear();
+    m_matrices.clear();
+    m_matrixParentSpace.clear();
+    m_opacities.clear();
+    m_opacityParentSpace.clear();
+    m_geometries.clear();
+    m_colors.clear();
+    m_textures.clear();
+    m_drawables.clear();
+    m_worldMatrices.resize(1);
+    m_worldOpacities.resize(1);
+    m_sourceNodes.clear();
+    m_worldDirty = false;
+    m_open = InvalidHandle;
+}
+
+inline void FlatScene::reserve(unsigned nodeCount)
+{
+    m_kind.reserve(nodeCount);
+    m_parent.reserve(nodeCount);
+    m_end.reserve(nodeCount);
+    m_data.reserve(nodeCount);
+    m_matrixSpace.reserve(nodeCount);
+    m_opacitySpace.reserve(nodeCount);
+}
+
+inline FlatScene::Handle FlatScene::begin(Kind kind, uint32_t data)
+{
+    assert(m_kind.size() < InvalidHandle);
+    Handle h = m_kind.size();
+    m_kind.push_back(kind);
+    m_parent.push_back(m_open);
+    m_end.push_back(h + 1);
+    m_data.push_back(data);
+
+    uint32_t matrixSpace = m_open == InvalidHandle ? 0 : m_matrixSpace[m_open];
+    uint32_t opacitySpace = m_open == InvalidHandle ? 0 : m_opacitySpace[m_open];
+    if (kind == TransformKind) {
+        m_matrixParentSpace.push_back(matrixSpace);
+        matrixSpace = data + 1;
+        m_worldMatrices.push_back(mat4());
+        m_worldDirty = true;
+    } else if (kind == OpacityKind) {
+        m_opacityParentSpace.push_back(opacitySpace);
+        opacitySpace = data + 1;
+        m_worldOpacities.push_back(1);
+        m_worldDirty = true;
+    }
+    m_matrixSpace.push_back(matrixSpace);
+    m_opacitySpace.push_back(opacitySpace);
+
+    m_open = h;
+    return h;
+}
+
+inline void FlatScene::end()
+{
+    assert(m_open != InvalidHandle);
+    Handle h = m_open;
+    m_end[h] = m_kind.size();
+    m_open = m_parent[h];
+}
+
+inline FlatScene::Handle FlatScene::beginTransform(const mat4 &matrix)
+{
+    m_matrices.push_back(matrix);
+    return begin(TransformKind, m_matrices.size() - 1);
+}
+
+inline FlatScene::Handle FlatScene::beginOpacity(float opacity)
+{
+    m_opacities.push_back(opacity);
+    return begin(OpacityKind, m_opacities.size() - 1);
+}
+
+inline FlatScene::Handle FlatScene::beginRectangle(const rect2d &geometry, vec4 color)
+{
+    m_geometries.push_back(geometry);
+    m_colors.push_back(color);
+    m_textures.push_back(0);
+    Handle h = begin(RectangleKind, m_geometries.size() - 1);
+    m_drawables.push_back(h);
+    return h;
+}
+
+inline FlatScene::Handle FlatScene::beginTexture(const rect2d &geometry, const Texture *texture)
+{
+    m_geometries.push_back(geometry);
+    m_colors.push_back(vec4());
+    m_textures.push_back(texture);
+    Handle h = begin(TextureKind, m_geometries.size() - 1);
+    m_drawables.push_back(h);
+    return h;
+}
+
+inline FlatScene::Handle FlatScene::build(Node *root)
+{
+    assert(root);
+    clear();
+
+    // Walk the tree iteratively, opening each node on the way down and
+    // closing it once its last child is done.
+    Node *n = root;
+    while (n) {
+        switch (n->type()) {
+        case Node::TransformNodeType:
+            beginTransform(static_cast<TransformNode *>(n)->matrix());
+            break;
+        case Node::OpacityNodeType:
+            beginOpacity(static_cast<OpacityNode *>(n)->opacity());
+            break;
+        case Node::RectangleNodeType:
+            beginRectangle(static_cast<RectangleNode *>(n)->geometry(), static_cast<RectangleNode *>(n)->color());
+            break;
+        case Node::TextureNodeType:
+            beginTexture(static_cast<TextureNode *>(n)->geometry(), static_cast<TextureNode *>(n)->texture());
+            break;
+        default:
+            beginGroup();
+            break;
+        }
+        m_sourceNodes.push_back(n);
+
+        if (n->child()) {
+            n = n->child();
+            continue;
+        }
+        end();
+        while (n != root && !n->sibling()) {
+            n = n->parent();
+            end();
+        }
+        n = n == root ? 0 : n->sibling();
+    }
+    assert(m_open == InvalidHandle);
+    return 0;
+}
+
+inline const mat4 &FlatScene::matrix(Handle h) const
+{
+    assert(kind(h) == TransformKind);
+    return m_matrices[m_data[h]];
+}
+
+inline void FlatScene::setMatrix(Handle h, const mat4 &matrix)
+{
+    assert(kind(h) == TransformKind);
+    m_matrices[m_data[h]] = matrix;
+    m_worldDirty = true;
+}
+
+inline float FlatScene::opacity(Handle h) const
+{
+    assert(kind(h) == OpacityKind);
+    return m_opacities[m_data[h]];
+}
+
+inline void FlatScene::setOpacity(Handle h, float opacity)
+{
+    assert(kind(h) == OpacityKind);
+    m_opacities[m_data[h]] = opacity;
+    m_worldDirty = true;
+}
+
+inline const rect2d &FlatScene::geometry(Handle h) const
+{
+    assert(kind(h) == RectangleKind || kind(h) == TextureKind);
+    return m_geometries[m_data[h]];
+}
+
+inline void FlatScene::setGeometry(Handle h, const rect2d &geometry)
+{
+    assert(kind(h) == RectangleKind || kind(h) == TextureKind);
+    m_geometries[m_data[h]] = geometry;
+}
+
+inline vec4 FlatScene::color(Handle h) const
+{
+    assert(kind(h) == RectangleKind);
+    return m_colors[m_data[h]];
+}
+
+inline void FlatScene::setColor(Handle h, vec4 color)
+{
+    assert(kind(h) == RectangleKind);
+    m_colors[m_data[h]] = color;
+}
+
+inline const Texture *FlatScene::texture(Handle h) const
+{
+    assert(kind(h) == TextureKind);
+    return m_textures[m_data[h]];
+}
+
+inline void FlatScene::setTexture(Handle h, const Texture *texture)
+{
+    assert(kind(h) == TextureKind);
+    m_textures[m_data[h]] = texture;
+}
+
+inline void FlatScene::update()
+{
+    if (!m_worldDirty)
+        return;
+
+    // Transforms and opacity nodes are stored in depth-first order too, so
+    // the parent space has always been updated first.
+    const unsigned matrixCount = m_matrices.size();
+    for (unsigned i=0; i<matrixCount; ++i)
+        m_worldMatrices[i + 1] = m_worldMatrices[m_matrixParentSpace[i]] * m_matrices[i];
+    const unsigned opacityCount = m_opacities.size();
+    for (unsigned i=0; i<opacityCount; ++i)
+        m_worldOpacities[i + 1] = m_worldOpacities[m_opacityParentSpace[i]] * m_opacities[i];
+    m_worldDirty = false;
+}
+
+template <typename Visitor>
+void FlatScene::forEachDrawable(Visitor visit)
+{
+    update();
+    const unsigned count = m_drawables.size();
+    for (unsigned i=0; i<count; ++i) {
+        Handle h = m_drawables[i];
+        visit(h, m_worldMatrices[m_matrixSpace[h]], m_geometries[i], m_colors[i], m_textures[i],
+              m_worldOpacities[m_opacitySpace[h]]);
+    }
+}
+
+RENGINE_END_NAMESPACE
@@ -0,0 +1,384 @@
+/*
+    Copyright (c) 2016, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <limits>
+#include <vector>
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    The RectangleListNode draws many solid rectangles as a single node.
+
+    Geometry and colors are stored in contiguous arrays, one entry per
+    rectangle, and the renderer draws the whole list with one batched draw
+    call rather than visiting a RectangleNode per rectangle. The list is
+    positioned by its TransformNode ancestors and is affected by opacity and
+    other layered ancestors like any other node.
+
+    The renderer keeps the list in a vertex buffer and only uploads the
+    rectangles which have changed. Changing entries through setRect() or
+    setColor() tracks this automatically. When writing directly into rects()
+    or colors(), call markDirty() with the range which was changed.
+
+    Colors are given as non-premultiplied RGBA, like RectangleNode.
+ */
+class RectangleListNode : public Node
+{
+public:
+    RENGINE_ALLOCATION_POOL_DECLARATION(RectangleListNode, rengine_RectangleListNode);
+
+    static RectangleListNode *create(unsigned size) {
+        auto node = create();
+        node->resize(size);
+        return node;
+    }
+
+    unsigned size() const { return (unsigned) m_rects.size(); }
+
+    /*!
+        Resizes the list to \a size entries. New entries are empty and
+        transparent.
+     */
+    virtual void resize(unsigned size) {
+        m_rects.resize(size);
+        m_colors.resize(size);
+        markDirty(0, size);
+    }
+
+    rect2d rect(unsigned i) const { return m_rects[i]; }
+    void setRect(unsigned i, rect2d rect) {
+        m_rects[i] = rect;
+        markDirty(i, 1);
+    }
+
+    vec4 color(unsigned i) const { return m_colors[i]; }
+    void setColor(unsigned i, vec4 color) {
+        m_colors[i] = color;
+        markDirty(i, 1);
+    }
+
+    rect2d *rects() { return m_rects.data(); }
+    vec4 *colors() { return m_colors.data(); }
+
+    /*!
+        Marks \a count entries starting at \a first as changed, so they will
+        be uploaded with the next frame.
+     */
+    void markDirty(unsigned first, unsigned count) {
+        m_dirtyBegin = std::min(m_dirtyBegin, first);
+        m_dirtyEnd = std::max(m_dirtyEnd, std::min(first + count, size()));
+        m_boundsDirty = true;
+        markChanged();
+    }
+
+    /*!
+        Returns the rectangle enclosing all entries in the list.
+     */
+    rect2d boundingRect() const;
+
+    // For use by the renderer
+    bool isDirty() const { return m_dirtyBegin < m_dirtyEnd; }
+    unsigned dirtyBegin() const { return m_dirtyBegin; }
+    unsigned dirtyEnd() const { return m_dirtyEnd; }
+    void resetDirty() {
+        m_dirtyBegin = std::numeric_limits<unsigned>::max();
+        m_dirtyEnd = 0;
+    }
+
+    /*!
+        Returns a number which is unique to this node for the lifetime of
+        the application. The renderer uses it to tell a node apart from
+        one which was created at the same address after it was destroyed.
+     */
+    unsigned serial() const { return m_serial; }
+
+    RENGINE_NODE_DEFINE_FROM_FUNCTION(RectangleListNode, RectangleListNodeType);
+
+protected:
+    RectangleListNode(Type type = RectangleListNodeType)
+        : Node(type)
+        , m_serial(nextSerial())
+    {
+    }
+
+    static unsigned nextSerial() {
+        static std::atomic<unsigned> serial(0);
+        return ++serial;
+    }
+
+    std::vector<rect2d> m_rects;
+    std::vector<vec4> m_colors;
+    mutable rect2d m_bounds;
+    unsigned m_dirtyBegin = std::numeric_limits<unsigned>::max();
+    unsigned m_dirtyEnd = 0;
+    unsigned m_serial;
+    mutable bool m_boundsDirty = true;
+};
+
+/*!
+    The SpriteListNode is the textured sibling of RectangleListNode. All
+    sprites are drawn from the same texture, typically an atlas, using a
+    texture coordinate rectangle per sprite. The sprite's color is
+    multiplied with the texture, so use white to draw the texture as is.
+
+    The texture is expected to be in RGBA format. Without a texture, the
+    sprites are drawn as solid rectangles.
+ */
+class SpriteListNode : public RectangleListNode
+{
+public:
+    RENGINE_ALLOCATION_POOL_DECLARATION(SpriteListNode, rengine_SpriteListNode);
+
+    static SpriteListNode *create(unsigned size, const Texture *texture) {
+        auto node = create();
+        node->resize(size);
+        node->setTexture(texture);
+        return node;
+    }
+
+    const Texture *texture() const { return m_texture; }
+    /*!
+        Also requests a preprocess, so subclasses which derive their entries
+        from the texture, such as NinePatchNode, pick up the new size.
+     */
+    void setTexture(const Texture *texture) {
+        m_texture = texture;
+        requestPreprocess();
+    }
+
+    /*!
+        Resizes the list to \a size entries. New entries are empty, white and
+        cover the full texture.
+     */
+    void resize(unsigned size) override {
+        unsigned oldSize = this->size();
+        RectangleListNode::resize(size);
+        m_texCoords.resize(size, rect2d(0, 0, 1, 1));
+        for (unsigned i=oldSize; i<size; ++i)
+            m_colors[i] = vec4(1, 1, 1, 1);
+    }
+
+    rect2d texCoords(unsigned i) const { return m_texCoords[i]; }
+    void setTexCoords(unsigned i, rect2d texCoords) {
+        m_texCoords[i] = texCoords;
+        markDirty(i, 1);
+    }
+
+    rect2d *texCoords() { return m_texCoords.data(); }
+
+    RENGINE_NODE_DEFINE_FROM_FUNCTION(SpriteListNode, SpriteListNodeType);
+
+protected:
+    SpriteListNode(Type type = SpriteListNodeType)
+        : RectangleListNode(type)
+    {
+    }
+
+    const Texture *m_texture = nullptr;
+    std::vector<rect2d> m_texCoords;
+};
+
+/*!
+    The NinePatchNode draws a texture into geometry() the way CSS draws a
+    border-image. The texture is cut into nine pieces by margins() given in
+    texture pixels: four corners which are drawn at their natural size,
+    four edges which are stretched or tiled along one axis, and the center
+    which is stretched or tiled along both.
+
+    The pieces are generated as entries in the underlying SpriteListNode,
+    so a nine-patch is a single node which is drawn in a single draw call,
+    rather than nine texture nodes.
+
+    If geometry() is smaller than the margins, the corners are scaled down
+    so they fit.
+ */
+class NinePatchNode : public SpriteListNode
+{
+public:
+    enum EdgeMode {
+        Stretch,
+        Tile
+    };
+
+    RENGINE_ALLOCATION_POOL_DECLARATION(NinePatchNode, rengine_NinePatchNode);
+
+    static NinePatchNode *create(const Texture *texture, vec4 margins, rect2d geometry) {
+        auto node = create();
+        node->setTexture(texture);
+        node->setMargins(margins);
+        node->setGeometry(geometry);
+        return node;
+    }
+
+    /*!
+        The left, top, right and bottom margins in texture pixels, stored
+        as x, y, z and w.
+     */
+    vec4 margins() const { return m_margins; }
+    void setMargins(vec4 margins) {
+        m_margins = margins;
+        requestPreprocess();
+    }
+
+    rect2d geometry() const { return m_geometry; }
+    void setGeometry(rect2d geometry) {
+        m_geometry = geometry;
+        requestPreprocess();
+    }
+
+    /*!
+        How the edges and center are filled along the horizontal and
+        vertical axis. Tiled pieces are repeated at their natural size and
+        the last one is cut off. The default is Stretch for both.
+     */
+    EdgeMode horizontalMode() const { return (EdgeMode) m_horizontalMode; }
+    EdgeMode verticalMode() const { return (EdgeMode) m_verticalMode; }
+    void setEdgeMode(EdgeMode horizontal, EdgeMode vertical) {
+        m_horizontalMode = horizontal;
+        m_verticalMode = vertical;
+        requestPreprocess();
+    }
+
+    void onPreprocess() override;
+
+    RENGINE_NODE_DEFINE_FROM_FUNCTION(NinePatchNode, NinePatchNodeType);
+
+protected:
+    NinePatchNode()
+        : SpriteListNode(NinePatchNodeType)
+        , m_horizontalMode(Stretch)
+        , m_verticalMode(Stretch)
+    {
+    }
+
+    struct Span {
+        float from;
+        float to;
+        float texFrom;
+        float texTo;
+    };
+    static void layoutAxis(float from, float to, float first, float last, float textureSize,
+                           EdgeMode mode, std::vector<Span> *spans);
+
+    vec4 m_margins;
+    rect2d m_geometry;
+    unsigned m_horizontalMode : 1;
+    unsigned m_verticalMode : 1;
+};
+
+inline rect2d RectangleListNode::boundingRect() const
+{
+    if (m_boundsDirty) {
+        m_boundsDirty = false;
+        if (m_rects.empty()) {
+            m_bounds = rect2d();
+        } else {
+            m_bounds = m_rects[0];
+            for (const rect2d &r : m_rects)
+                m_bounds |= r;
+        }
+    }
+    return m_bounds;
+}
+
+inline void NinePatchNode::onPreprocess()
+{
+    if (!m_texture) {
+        resize(0);
+        return;
+    }
+
+    vec2 textureSize = m_texture->size();
+    std::vector<Span> columns;
+    std::vector<Span> rows;
+    layoutAxis(m_geometry.left(), m_geometry.right(), m_margins.x, m_margins.z, textureSize.x, horizontalMode(), &columns);
+    layoutAxis(m_geometry.top(), m_geometry.bottom(), m_margins.y, m_margins.w, textureSize.y, verticalMode(), &rows);
+
+    resize(columns.size() * rows.size());
+    unsigned i = 0;
+    for (const Span &row : rows) {
+        for (const Span &column : columns) {
+            m_rects[i] = rect2d(column.from, row.from, column.to, row.to);
+            m_texCoords[i] = rect2d(column.texFrom, row.texFrom, column.texTo, row.texTo);
+            ++i;
+        }
+    }
+    markDirty(0, size());
+}
+
+/*!
+    Splits [from, to] along one axis into the spans for the first margin,
+    the middle and the last margin, and maps each of them to its part of
+    the texture.
+ */
+inline void NinePatchNode::layoutAxis(float from, float to, float first, float last, float textureSize,
+                                      EdgeMode mode, std::vector<Span> *spans)
+{
+    spans->clear();
+    float size = to - from;
+    if (size <= 0 || textureSize <= 0)
+        return;
+
+    float texFirst = first / textureSize;
+    float texLast = 1.0f - last / textureSize;
+    float sourceMiddle = textureSize - first - last;
+
+    // Scale the margins down if they don't fit
+    if (first + last > size) {
+        float scale = size / (first + last);
+        first *= scale;
+        last *= scale;
+    }
+
+    if (first > 0)
+        spans->push_back({ from, from + first, 0.0f, texFirst });
+
+    float middleFrom = from + first;
+    float middleTo = to - last;
+    if (middleTo > middleFrom && sourceMiddle > 0) {
+        if (mode == Stretch || sourceMiddle < 1) {
+            spans->push_back({ middleFrom, middleTo, texFirst, texLast });
+        } else {
+            for (float pos = middleFrom; pos < middleTo; pos += sourceMiddle) {
+                float end = std::min(pos + sourceMiddle, middleTo);
+                float texEnd = texFirst + (texLast - texFirst) * (end - pos) / sourceMiddle;
+                spans->push_back({ pos, end, texFirst, texEnd });
+            }
+        }
+    }
+
+    if (last > 0)
+        spans->push_back({ to - last, to, texLast, 1.0f });
+}
+
+#define RENGINE_LISTNODE_DEFINE_ALLOCATION_POOLS                                           \
+    RENGINE_ALLOCATION_POOL_DEFINITION(rengine::RectangleListNode, rengine_RectangleListNode); \
+    RENGINE_ALLOCATION_POOL_DEFINITION(rengine::SpriteListNode, rengine_SpriteListNode);       \
+    RENGINE_ALLOCATION_POOL_DEFINITION(rengine::NinePatchNode, rengine_NinePatchNode);
+
+RENGINE_END_NAMESPACE
@@ -29,6 +29,7 @@
 #include <vector>
 #include <algorithm>
 #include <iostream>
+#include <atomic>
 
 RENGINE_BEGIN_NAMESPACE
 
@@ -64,17 +65,22 @@ class Node : public SignalEmitter
 {
 public:
     enum Type {
-        BasicNodeType         = 0,
-        TransformNodeType     = 1,
-        OpacityNodeType       = 2,
-        ColorFilterNodeType   = 3,
-        BlurNodeType          = 4,
-        ShadowNodeType        = 5,
-
-        RectangleNodeBaseType = (1 << 6),
-        RectangleNodeType     = 1 | RectangleNodeBaseType,
-        TextureNodeType       = 2 | RectangleNodeBaseType,
-        RenderNodeType        = 3 | RectangleNodeBaseType,
+        BasicNodeType          = 0,
+        TransformNodeType      = 1,
+        OpacityNodeType        = 2,
+        ColorFilterNodeType    = 3,
+        BlurNodeType           = 4,
+        ShadowNodeType         = 5,
+        RectangleListNodeType  = 6,
+        SpriteListNodeType     = 7,
+        ParticleSystemNodeType = 8,
+        ClipNodeType           = 9,
+        NinePatchNodeType      = 10,
+
+        RectangleNodeBaseType  = (1 << 6),
+        RectangleNodeType      = 1 | RectangleNodeBaseType,
+        TextureNodeType        = 2 | RectangleNodeBaseType,
+        RenderNodeType         = 3 | RectangleNodeBaseType,
     };
 
     /*!
@@ -236,7 +242,10 @@ public:
      */
     Type type() const { return m_type; }
 
-    void requestPreprocess() { m_preprocess = true; }
+    void requestPreprocess() {
+        m_preprocess = true;
+        markChanged();
+    }
     void preprocess() {
         if (m_preprocess) {
             m_preprocess = false;
@@ -253,6 +262,11 @@ public:
         case Node::TransformNodeType: std::cout << "TransormNode"; break;
         case Node::RectangleNodeType: std::cout << "RectangleNode"; break;
         case Node::TextureNodeType: std::cout << "TextureNodeType"; break;
+        case Node::RectangleListNodeType: std::cout << "RectangleListNode"; break;
+        case Node::SpriteListNodeType: std::cout << "SpriteListNode"; break;
+        case Node::ParticleSystemNodeType: std::cout << "ParticleSystemNode"; break;
+        case Node::ClipNodeType: std::cout << "ClipNode"; break;
+        case Node::NinePatchNodeType: std::cout << "NinePatchNode"; break;
         default: std::cout << "Node(type=" << n->type() << ")"; break;
         }
         std::cout << "(" << n << ") parent=" << n->parent()
@@ -267,6 +281,23 @@ public:
         }
     }
 
+    /*!
+     * Removes this node from its parent and destroys it together with all
+     * its descendants.
+     *
+     * The subtree is walked iteratively and nodes are not unlinked from
+     * their parents one at a time, so this is linear in the size of the
+     * subtree, even for very wide trees in debug builds, and will not
+     * overflow the stack for very deep ones. Calling destroy() on a node
+     * with children does the same, but destroySubtree() makes the intent
+     * explicit at the call site.
+     */
+    void destroySubtree() {
+        if (m_parent)
+            m_parent->remove(this);
+        destroyNodes(this, this);
+    }
+
     RENGINE_ALLOCATION_POOL_DECLARATION_IN_BASECLASS(Node, rengine_Node);
 
     void __mark_as_pool_allocated() { m_poolAllocated = true; }
@@ -276,10 +307,85 @@ public:
      * State variable used by the event dispatch.
      */
     bool isPointerTarget() const { return m_pointerTarget; }
-    void setPointerTarget(bool target) { m_pointerTarget = target; }
+    void setPointerTarget(bool target) {
+        if (m_pointerTarget == target)
+            return;
+        m_pointerTarget = target;
+        s_geometryGeneration.fetch_add(1, std::memory_order_relaxed);
+        invalidateHitTest(true);
+    }
+
+    /*!
+     * Returns a counter which changes whenever something that affects
+     * pointer hit testing may have changed: a transform, the structure of a
+     * tree, the geometry of a RectangleNodeBase or a node's pointer target
+     * state. Used to notice that a handler has changed the scene while an
+     * event is being delivered.
+     */
+    static unsigned hitTestGeneration() {
+        return s_worldTransformGeneration.load(std::memory_order_relaxed)
+             + s_geometryGeneration.load(std::memory_order_relaxed);
+    }
+
+    /*!
+     * Change stamps, which let the renderer, a SceneMirror or a spatial
+     * index find what has changed since they last looked without visiting
+     * the whole tree. Each change is stamped with the current change epoch:
+     *
+     * changeStamp() is the last time a property of this node which affects
+     * how it is drawn changed.
+     *
+     * hitTestStamp() is the last time this node's own transform or
+     * geometry changed, or it was moved to a new parent.
+     *
+     * subtreeChangeStamp() is the last time anything at or below this node
+     * changed, including children being added or removed.
+     *
+     * subtreeStructureStamp() is the last time pointer targets may have
+     * been added, removed or reordered at or below this node.
+     *
+     * A user calls advanceChangeEpoch() when it synchronizes, which returns
+     * the epoch it has now seen all changes of. Anything stamped later than
+     * that has changed since.
+     */
+    unsigned changeStamp() const { return m_changeStamp; }
+    unsigned hitTestStamp() const { return m_hitTestStamp; }
+    unsigned subtreeChangeStamp() const { return m_subtreeChangeStamp; }
+    unsigned subtreeStructureStamp() const { return m_subtreeStructureStamp; }
+    static unsigned advanceChangeEpoch() {
+        return s_changeEpoch.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /*!
+     * Records that something which affects how this node is drawn has
+     * changed. The property setters call this, and so should subclasses
+     * which keep state of their own for the renderer.
+     */
+    void markChanged() { stampChange(ContentChange); }
 
     virtual bool onPointerEvent(PointerEvent *e) { return false; }
 
+    /*!
+     * Returns the accumulated matrix of this node and all its TransformNode
+     * ancestors, which maps from this node's coordinate system into that of
+     * the tree's root.
+     *
+     * The result is cached in this node and its ancestors. Changing a
+     * transform or reparenting a node marks the caches in that subtree as
+     * stale, and only those are recalculated on their next use. Querying
+     * many nodes in the same tree will therefore only visit each ancestor
+     * once.
+     */
+    mat4 worldMatrix() { return updateWorldTransform()->matrix; }
+
+    /*!
+     * Returns the inverse of worldMatrix(), which maps from the tree's root
+     * into this node's coordinate system. \a invertible is set to false if
+     * the world matrix has no inverse. The inverse is cached together with
+     * the world matrix.
+     */
+    mat4 inverseWorldMatrix(bool *invertible = 0);
+
 protected:
     virtual void onPreprocess() { }
 
@@ -295,19 +401,71 @@ protected:
         , m_preprocess(false)
         , m_poolAllocated(false)
         , m_pointerTarget(false)
+        , m_worldTransformDirty(true)
+        , m_changeStamp(0)
+        , m_hitTestStamp(0)
+        , m_subtreeChangeStamp(0)
+        , m_subtreeStructureStamp(0)
+        , m_worldTransform(0)
     {
     }
 
     /*!
      * Node destructor.
      *
-     * A Node will delete all its children when the destructor runs.
+     * A Node will delete all its children when the destructor runs. By
+     * then the destructors of subclasses have run, so they still see the
+     * node's children.
      */
     virtual ~Node() {
         if (m_parent)
             m_parent->remove(this);
-        while (m_child)
-            m_child->destroy();
+        if (m_child) {
+            Node *first = m_child;
+            m_child = 0;
+            destroyNodes(first, first->m_prev);
+        }
+        if (m_worldTransform)
+            m_worldTransform->destroy();
+    }
+
+    /*!
+     * Destroys the nodes from \a first to \a last, linked through m_next,
+     * along with all their descendants.
+     *
+     * The nodes are queued on a per-thread list. Destroying a node queues
+     * its children from ~Node(), after the subclass destructors have run,
+     * and only the outermost call empties the list. So no node is unlinked
+     * from its parent one by one and the destructors never recurse. This
+     * keeps tearing down a tree linear in its size and independent of its
+     * depth, with the freed nodes going back to their pools through the
+     * thread's allocation cache.
+     */
+    static void destroyNodes(Node *first, Node *last) {
+        Teardown &teardown = currentTeardown();
+        last->m_next = teardown.pending;
+        teardown.pending = first;
+        if (teardown.active)
+            return;
+
+        teardown.active = true;
+        while (Node *n = teardown.pending) {
+            teardown.pending = n->m_next;
+            n->m_parent = 0;
+            n->m_next = 0;
+            n->m_prev = 0;
+            n->destroy();
+        }
+        teardown.active = false;
+    }
+
+    struct Teardown {
+        Node *pending = 0;
+        bool active = false;
+    };
+    static Teardown &currentTeardown() {
+        static thread_local Teardown teardown;
+        return teardown;
     }
 
 
@@ -320,9 +478,73 @@ protected:
      */
     void setParent(Node *p) {
         assert(m_parent == 0 || p == 0);
+        // The parent's list of children changes. Moving a leaf which is not
+        // a pointer target can not add, remove or reorder any targets though.
+        Node *changed = p ? p : m_parent;
+        changed->stampChange(m_pointerTarget || m_child ? StructureChange : 0);
         m_parent = p;
+        invalidateWorldTransform();
+        invalidateHitTest(false);
+    }
+
+    /*!
+     * Marks the cached world matrices of this node and its descendants as
+     * stale. The recalculation is deferred until the next call to
+     * worldMatrix().
+     */
+    void invalidateWorldTransform();
+
+    /*!
+     * Stamps this node and its ancestors with the current change epoch.
+     * Set \a structural when pointer targets may have been added, removed
+     * or reordered below this node, rather than just moved.
+     */
+    void invalidateHitTest(bool structural) {
+        stampChange(structural ? StructureChange : (ContentChange | HitTestChange));
     }
 
+    enum ChangeFlag {
+        ContentChange = 0x1,
+        HitTestChange = 0x2,
+        StructureChange = 0x4
+    };
+    void stampChange(unsigned flags);
+
+    void invalidateGeometry() {
+        s_geometryGeneration.fetch_add(1, std::memory_order_relaxed);
+        invalidateHitTest(false);
+    }
+
+    // Allocated on first use, from its own pool, so nodes which are never
+    // asked for their world matrix don't carry the two matrices around.
+    struct WorldTransform {
+        mat4 matrix;
+        mat4 inverse;
+        bool inverseValid = false;
+        bool invertible = false;
+        bool poolAllocated = false;
+
+        static AllocationPool<WorldTransform> __allocation_pool_rengine_WorldTransform;
+        static WorldTransform *create() {
+            WorldTransform *t = __allocation_pool_rengine_WorldTransform.allocate();
+            if (!t)
+                return new WorldTransform();
+            t->poolAllocated = true;
+            return t;
+        }
+        void destroy() {
+            if (poolAllocated)
+                __allocation_pool_rengine_WorldTransform.deallocate(this);
+            else
+                delete this;
+        }
+    };
+    WorldTransform *updateWorldTransform();
+
+    static std::atomic<unsigned> s_worldTransformGeneration;
+    static std::atomic<unsigned> s_geometryGeneration;
+    static std::atomic<unsigned> s_changeEpoch;
+
     Node *m_parent;
     Node *m_child;
     Node *m_next;
@@ -332,13 +554,24 @@ protected:
     unsigned m_preprocess : 1;
     unsigned m_poolAllocated : 1;
     unsigned m_pointerTarget : 1;
-    unsigned m_reserved : 21; // 32 - 11
+    unsigned m_worldTransformDirty : 1;
+    unsigned m_reserved : 20; // 32 - 12
+
+    unsigned m_changeStamp;
+    unsigned m_hitTestStamp;
+    unsigned m_subtreeChangeStamp;
+    unsigned m_subtreeStructureStamp;
+
+    WorldTransform *m_worldTransform;
 };
 
 class OpacityNode : public Node {
 public:
     float opacity() const { return m_opacity; }
-    void setOpacity(float opacity) { m_opacity = opacity; }
+    void setOpacity(float opacity) {
+        m_opacity = opacity;
+        markChanged();
+    }
 
     RENGINE_ALLOCATION_POOL_DECLARATION(OpacityNode, rengine_OpacityNode);
 
@@ -365,10 +598,17 @@ class TransformNode : public Node
 {
 public:
     mat4 matrix() const { return m_matrix; }
-    void setMatrix(mat4 m) { m_matrix = m; }
+    void setMatrix(mat4 m) {
+        m_matrix = m;
+        invalidateWorldTransform();
+        invalidateHitTest(false);
+    }
 
     float projectionDepth() const { return m_projectionDepth; }
-    void setProjectionDepth(float d) { m_projectionDepth = d; }
+    void setProjectionDepth(float d) {
+        m_projectionDepth = d;
+        markChanged();
+    }
 
     RENGINE_ALLOCATION_POOL_DECLARATION(TransformNode, rengine_TransformNode);
 
@@ -380,6 +620,10 @@ public:
     }
 
     static mat4 matrixFor(Node *descendant, Node *root = 0) {
+        // The cached world matrix is relative to the top of the tree.
+        if (root == 0 || root->parent() == 0)
+            return descendant->worldMatrix();
+
         Node *n = descendant;
         mat4 m;
         while (true) {
@@ -412,6 +656,105 @@ protected:
     float m_projectionDepth;
 };
 
+/*!
+ * A stale node never has a valid descendant, since validating a node
+ * validates its ancestors first. So the walk can skip every subtree which
+ * is already stale, and repeated changes between two queries only visit
+ * each node once.
+ */
+inline void Node::invalidateWorldTransform()
+{
+    s_worldTransformGeneration.fetch_add(1, std::memory_order_relaxed);
+    if (m_worldTransformDirty)
+        return;
+
+    m_worldTransformDirty = true;
+    Node *n = this;
+    Node *c = m_child;
+    while (true) {
+        while (c && c->m_worldTransformDirty)
+            c = c->sibling();
+        if (c) {
+            c->m_worldTransformDirty = true;
+            n = c;
+            c = n->m_child;
+            continue;
+        }
+        if (n == this)
+            break;
+        c = n->sibling();
+        n = n->m_parent;
+    }
+}
+
+/*!
+ * The walk up stops at the first ancestor which already carries the
+ * stamps, since whoever stamped it in this epoch also stamped everything
+ * above it. This node itself may have been stamped under a different
+ * parent, so the walk always continues to its current parent.
+ */
+inline void Node::stampChange(unsigned flags)
+{
+    unsigned epoch = s_changeEpoch.load(std::memory_order_relaxed);
+    bool structural = flags & StructureChange;
+    if (flags & ContentChange)
+        m_changeStamp = epoch;
+    if (flags & HitTestChange)
+        m_hitTestStamp = epoch;
+    m_subtreeChangeStamp = epoch;
+    if (structural)
+        m_subtreeStructureStamp = epoch;
+    for (Node *n = m_parent; n; n = n->m_parent) {
+        if (n->m_subtreeChangeStamp == epoch && (!structural || n->m_subtreeStructureStamp == epoch))
+            break;
+        n->m_subtreeChangeStamp = epoch;
+        if (structural)
+            n->m_subtreeStructureStamp = epoch;
+    }
+}
+
+inline Node::WorldTransform *Node::updateWorldTransform()
+{
+    if (!m_worldTransformDirty)
+        return m_worldTransform;
+
+    // Validating the ancestors first means each one is calculated at most
+    // once, regardless of how many descendants are queried. The stale
+    // ancestors form an unbroken chain above this node, since a stale node
+    // only has stale descendants, so they are collected and validated from
+    // the top down without recursing.
+    static thread_local std::vector<Node *> chain;
+    for (Node *n = this; n && n->m_worldTransformDirty; n = n->m_parent)
+        chain.push_back(n);
+
+    while (!chain.empty()) {
+        Node *n = chain.back();
+        chain.pop_back();
+        if (!n->m_worldTransform)
+            n->m_worldTransform = WorldTransform::create();
+        mat4 m = n->m_parent ? n->m_parent->m_worldTransform->matrix : mat4();
+        if (TransformNode *tn = TransformNode::from(n))
+            m = m * tn->matrix();
+        n->m_worldTransform->matrix = m;
+        n->m_worldTransform->inverseValid = false;
+        n->m_worldTransformDirty = false;
+    }
+
+    return m_worldTransform;
+}
+
+inline mat4 Node::inverseWorldMatrix(bool *invertible)
+{
+    WorldTransform *wt = updateWorldTransform();
+    if (!wt->inverseValid) {
+        wt->inverse = wt->matrix.inverted(&wt->invertible);
+        wt->inverseValid = true;
+    }
+    if (invertible)
+        *invertible = wt->invertible;
+    return wt->inverse;
+}
+
 class SimplifiedTransformNode : public TransformNode
 {
 public:
@@ -525,6 +868,7 @@ public:
         if (x == m_geometry.x())
             return;
         m_geometry.setX(x);
+        invalidateGeometry();
         onXChanged.emit(this);
     }
 
@@ -533,6 +877,7 @@ public:
         if (y == m_geometry.y())
             return;
         m_geometry.setY(y);
+        invalidateGeometry();
         onYChanged.emit(this);
     }
 
@@ -551,6 +896,7 @@ public:
         if (w == m_geometry.width())
             return;
         m_geometry.setWidth(w);
+        invalidateGeometry();
         onWidthChanged.emit(this);
     }
 
@@ -559,6 +905,7 @@ public:
         if (h == m_geometry.height())
             return;
         m_geometry.setHeight(h);
+        invalidateGeometry();
         onHeightChanged.emit(this);
     }
 
@@ -571,6 +918,7 @@ public:
         if (!updateX && !updateY && !updateW && !updateH)
             return;
         m_geometry = rect;
+        invalidateGeometry();
         if (updateX) onXChanged.emit(this);
         if (updateY) onYChanged.emit(this);
         if (updateW) onWidthChanged.emit(this);
@@ -615,6 +963,7 @@ public:
         if (c == m_color)
             return;
         m_color = color;
+        markChanged();
         onColorChanged.emit(this);
     }
 
@@ -639,7 +988,10 @@ protected:
 class TextureNode : public RectangleNodeBase {
 public:
     const Texture *texture() const { return m_texture; }
-    void setTexture(const Texture *texture) { m_texture = texture; }
+    void setTexture(const Texture *texture) {
+        m_texture = texture;
+        markChanged();
+    }
 
     RENGINE_ALLOCATION_POOL_DECLARATION(TextureNode, rengine_TextureNode);
 
@@ -663,12 +1015,15 @@ protected:
 
 class ColorFilterNode : public Node {
 public:
-    void setColorMatrix(mat4 matrix) { m_colorMatrix = matrix; }
+    void setColorMatrix(mat4 matrix) {
+        m_colorMatrix = matrix;
+        markChanged();
+    }
     mat4 colorMatrix() const { return m_colorMatrix; }
 
     RENGINE_ALLOCATION_POOL_DECLARATION(ColorFilterNode, rengine_ColorFilterNode);
 
-    ColorFilterNode *create(mat4 matrix) {
+    static ColorFilterNode *create(mat4 matrix) {
         auto node = create();
         node->setColorMatrix(matrix);
         return node;
@@ -689,7 +1044,10 @@ class BlurNode : public Node {
 public:
     enum { StaticType = BlurNodeType };
 
-    void setRadius(unsigned radius) { m_radius = radius; }
+    void setRadius(unsigned radius) {
+        m_radius = radius;
+        markChanged();
+    }
     unsigned radius() const { return m_radius; }
 
     RENGINE_ALLOCATION_POOL_DECLARATION(BlurNode, rengine_BlurNode);
@@ -712,13 +1070,22 @@ class ShadowNode : public Node {
 public:
     enum { StaticType = ShadowNodeType };
 
-    void setRadius(unsigned radius) { m_radius = radius; }
+    void setRadius(unsigned radius) {
+        m_radius = radius;
+        markChanged();
+    }
     unsigned radius() const { return m_radius; }
 
-    void setOffset(vec2 offset) { m_offset = offset; }
+    void setOffset(vec2 offset) {
+        m_offset = offset;
+        markChanged();
+    }
     vec2 offset() const { return m_offset; }
 
-    void setColor(vec4 color) { m_color = color; }
+    void setColor(vec4 color) {
+        m_color = color;
+        markChanged();
+    }
     vec4 color() const { return m_color; }
 
     RENGINE_ALLOCATION_POOL_DECLARATION(ShadowNode, rengine_ShadowNode);
@@ -741,6 +1108,42 @@ protected:
     vec4 m_color;
 };
 
+/*!
+    The ClipNode clips its subtree to clipRect(), given in the node's local
+    coordinate system.
+
+    When the accumulated transform keeps the clip rect axis-aligned, the
+    clip is applied with the scissor test, which is practically free.
+    Rotated or skewed clips fall back to the stencil buffer. Descendants
+    which fall completely outside the clip are not drawn at all.
+
+    Clipping is not supported below a 3D projection, the ClipNode has no
+    effect there.
+ */
+class ClipNode : public Node {
+public:
+    rect2d clipRect() const { return m_clipRect; }
+    void setClipRect(rect2d rect) {
+        m_clipRect = rect;
+        markChanged();
+    }
+
+    RENGINE_ALLOCATION_POOL_DECLARATION(ClipNode, rengine_ClipNode);
+
+    static ClipNode *create(rect2d rect) {
+        auto node = create();
+        node->setClipRect(rect);
+        return node;
+    }
+
+    RENGINE_NODE_DEFINE_FROM_FUNCTION(ClipNode, ClipNodeType);
+
+protected:
+    ClipNode() : Node(ClipNodeType) { }
+
+    rect2d m_clipRect;
+};
+
 
 class RenderNode : public RectangleNodeBase {
 public:
@@ -751,7 +1154,9 @@ public:
         is called:
          - GL_BLEND is enabled
          - GL_DEPTH_TEST is disabled
-         - GL_STENCIL_TEST is disabled
+         - GL_STENCIL_TEST and GL_SCISSOR_TEST are disabled, unless the
+           node is inside a ClipNode, in which case they should be left
+           alone
          - glDepthMask(false) is used
          - glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA) is used
          - No buffers are bound and all attributes are disabled
@@ -780,10 +1185,16 @@ protected:
     RENGINE_ALLOCATION_POOL_DEFINITION(rengine::RectangleNode, rengine_RectangleNode);                        \
     RENGINE_ALLOCATION_POOL_DEFINITION(rengine::ColorFilterNode, rengine_ColorFilterNode);                    \
     RENGINE_ALLOCATION_POOL_DEFINITION(rengine::BlurNode, rengine_BlurNode);                                  \
-    RENGINE_ALLOCATION_POOL_DEFINITION(rengine::ShadowNode, rengine_ShadowNode);
+    RENGINE_ALLOCATION_POOL_DEFINITION(rengine::ShadowNode, rengine_ShadowNode);                              \
+    RENGINE_ALLOCATION_POOL_DEFINITION(rengine::ClipNode, rengine_ClipNode);                                  \
+    RENGINE_ALLOCATION_POOL_DEFINITION(rengine::Node::WorldTransform, rengine_WorldTransform);
 
 #define RENGINE_NODE_DEFINE_SIGNALS                                                 \
                                                                                     \
+    std::atomic<unsigned> rengine::Node::s_worldTransformGeneration(1);             \
+    std::atomic<unsigned> rengine::Node::s_geometryGeneration(0);                   \
+    std::atomic<unsigned> rengine::Node::s_changeEpoch(1);                          \
+                                                                                    \
     rengine::Signal<> rengine::RectangleNodeBase::onXChanged;                       \
     rengine::Signal<> rengine::RectangleNodeBase::onYChanged;                       \
     rengine::Signal<> rengine::RectangleNodeBase::onWidthChanged;                   \
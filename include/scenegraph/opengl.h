@@ -35,9 +35,11 @@
          // the functions in openglrenderer.h
 #        include <GLES2/gl2.h>
 #    endif
-#    define RENGINE_GLSL(code) "#define highp\n#define mediump\n#define lowp\n"#code
+#    define RENGINE_GLSL_PREAMBLE "#define highp\n#define mediump\n#define lowp\n"
 #else
 #    include <EGL/egl.h>
 #    include <GLES2/gl2.h>
-#    define RENGINE_GLSL(code) #code
-#endif
\ No newline at end of file
+#    define RENGINE_GLSL_PREAMBLE ""
+#endif
+
+#define RENGINE_GLSL(code) RENGINE_GLSL_PREAMBLE #code
\ No newline at end of file
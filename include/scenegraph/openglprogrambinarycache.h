@@ -0,0 +1,335 @@
+/*
+    Copyright (c) 2016, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef GL_PROGRAM_BINARY_LENGTH_OES
+#define GL_PROGRAM_BINARY_LENGTH_OES      0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS_OES 0x87FE
+#endif
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    The OpenGLProgramBinaryCache stores linked shader programs on disk so
+    they can be loaded with glProgramBinary rather than compiled from source
+    the next time the application starts.
+
+    The cache is enabled by setting the RENGINE_PROGRAM_CACHE_DIR
+    environment variable to an existing, writable directory, or by calling
+    setDirectory() before programs are initialized. It needs
+    glGetProgramBinary/glProgramBinary, either from the core API or from
+    GL_OES_get_program_binary, resolved through the Backend.
+
+    Each program is stored in its own file, named after a hash of its
+    shader sources and attribute bindings. The file records the full source
+    hash, the driver's vendor, renderer and version strings, the binary
+    format and a checksum of the binary. An entry which doesn't match in
+    every respect, or which the driver refuses to link, is deleted and the
+    program is compiled from source and stored again.
+ */
+class OpenGLProgramBinaryCache
+{
+public:
+    OpenGLProgramBinaryCache();
+
+    void setDirectory(const std::string &dir) { m_directory = dir; }
+    const std::string &directory() const { return m_directory; }
+
+    /*!
+        Returns true if the cache has a directory and the driver supports
+        program binaries.
+     */
+    bool isEnabled();
+
+    /*!
+        Tries to fill \a program from the cache. \a program must be created
+        but not linked. Returns true if \a program was successfully linked
+        from the cached binary.
+     */
+    bool load(GLuint program, const char *vsh, const char *fsh, const std::vector<const char *> &attrs);
+
+    /*!
+        Stores the linked \a program in the cache.
+     */
+    void store(GLuint program, const char *vsh, const char *fsh, const std::vector<const char *> &attrs);
+
+    /*!
+        Returns the key of a program: a hash of its shader sources and
+        attribute bindings.
+     */
+    static uint64_t sourceHash(const char *vsh, const char *fsh, const std::vector<const char *> &attrs);
+
+    /*!
+        Returns the file name used for the entry with \a sourceHash.
+     */
+    std::string pathFor(uint64_t sourceHash) const;
+
+    /*!
+        Writes an entry to \a path. The entry is written to a temporary file
+        first and then renamed into place. Returns false on failure.
+     */
+    static bool writeEntry(const std::string &path, uint64_t sourceHash, const std::string &driver,
+                           GLenum format, const std::vector<char> &binary);
+
+    /*!
+        Reads the entry at \a path into \a format and \a binary. Returns
+        false if the file is missing, truncated or corrupt, or if it was
+        written for other sources or another driver.
+     */
+    static bool readEntry(const std::string &path, uint64_t sourceHash, const std::string &driver,
+                          GLenum *format, std::vector<char> *binary);
+
+    static uint64_t hash(const void *data, size_t size, uint64_t h = 14695981039346656037ull) {
+        const unsigned char *bytes = (const unsigned char *) data;
+        for (size_t i=0; i<size; ++i) {
+            h ^= bytes[i];
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+
+private:
+    typedef void (GL_APIENTRYP GetProgramBinaryFunction)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+    typedef void (GL_APIENTRYP ProgramBinaryFunction)(GLuint program, GLenum binaryFormat, const void *binary, GLint length);
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t driverLength;
+        uint64_t sourceHash;
+        uint32_t format;
+        uint32_t length;
+        uint64_t checksum;
+    };
+
+    enum { FileFormatVersion = 1 };
+
+    std::string m_directory;
+    std::string m_driver;
+    GetProgramBinaryFunction m_getProgramBinary = nullptr;
+    ProgramBinaryFunction m_programBinary = nullptr;
+    bool m_resolved = false;
+};
+
+inline OpenGLProgramBinaryCache::OpenGLProgramBinaryCache()
+{
+    if (const char *dir = std::getenv("RENGINE_PROGRAM_CACHE_DIR"))
+        m_directory = dir;
+}
+
+inline bool OpenGLProgramBinaryCache::isEnabled()
+{
+    if (m_directory.empty())
+        return false;
+
+    if (!m_resolved) {
+        m_resolved = true;
+
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+        // Clear the error in case the enum isn't known to the driver
+        while (glGetError() != GL_NO_ERROR) { }
+
+        Backend *backend = Backend::get();
+        if (formats > 0 && backend) {
+            m_getProgramBinary = (GetProgramBinaryFunction) backend->resolveOpenGLFunction("glGetProgramBinary");
+            m_programBinary = (ProgramBinaryFunction) backend->resolveOpenGLFunction("glProgramBinary");
+            if (!m_getProgramBinary || !m_programBinary) {
+                m_getProgramBinary = (GetProgramBinaryFunction) backend->resolveOpenGLFunction("glGetProgramBinaryOES");
+                m_programBinary = (ProgramBinaryFunction) backend->resolveOpenGLFunction("glProgramBinaryOES");
+            }
+        }
+
+        if (m_getProgramBinary && m_programBinary) {
+            m_driver = std::string((const char *) glGetString(GL_VENDOR)) + "|"
+                       + (const char *) glGetString(GL_RENDERER) + "|"
+                       + (const char *) glGetString(GL_VERSION);
+            logd << "program binary cache in: " << m_directory << std::endl;
+        } else {
+            logw << "program binaries not supported, cache disabled" << std::endl;
+            m_getProgramBinary = nullptr;
+            m_programBinary = nullptr;
+        }
+    }
+
+    return m_programBinary != nullptr;
+}
+
+inline uint64_t OpenGLProgramBinaryCache::sourceHash(const char *vsh, const char *fsh, const std::vector<const char *> &attrs)
+{
+    // Include the terminators so the boundaries between strings count.
+    uint64_t h = hash(vsh, std::strlen(vsh) + 1);
+    h = hash(fsh, std::strlen(fsh) + 1, h);
+    for (const char *a : attrs)
+        h = hash(a, std::strlen(a) + 1, h);
+    return h;
+}
+
+inline std::string OpenGLProgramBinaryCache::pathFor(uint64_t sourceHash) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long) sourceHash);
+    return m_directory + name;
+}
+
+inline bool OpenGLProgramBinaryCache::readEntry(const std::string &path, uint64_t sourceHash, const std::string &driver,
+                                                GLenum *format, std::vector<char> *binary)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    // The sizes in the header must add up to the size of the file, so a
+    // truncated or corrupt header can't make us allocate or read garbage.
+    long fileSize = -1;
+    if (fseek(file, 0, SEEK_END) == 0)
+        fileSize = ftell(file);
+    rewind(file);
+
+    Header header;
+    std::string storedDriver;
+    bool valid = fread(&header, sizeof(Header), 1, file) == 1
+                 && std::memcmp(header.magic, "rengine", 8) == 0
+                 && header.version == FileFormatVersion
+                 && header.sourceHash == sourceHash
+                 && header.driverLength == driver.size()
+                 && header.length > 0
+                 && fileSize == long(sizeof(Header) + header.driverLength + header.length);
+    if (valid) {
+        storedDriver.resize(header.driverLength);
+        binary->resize(header.length);
+        valid = (header.driverLength == 0 || fread(&storedDriver[0], header.driverLength, 1, file) == 1)
+                && storedDriver == driver
+                && fread(binary->data(), header.length, 1, file) == 1
+                && hash(binary->data(), binary->size()) == header.checksum;
+    }
+    fclose(file);
+
+    if (!valid) {
+        binary->clear();
+        return false;
+    }
+    *format = header.format;
+    return true;
+}
+
+inline bool OpenGLProgramBinaryCache::writeEntry(const std::string &path, uint64_t sourceHash, const std::string &driver,
+                                                 GLenum format, const std::vector<char> &binary)
+{
+    Header header;
+    std::memcpy(header.magic, "rengine", 8);
+    header.version = FileFormatVersion;
+    header.driverLength = driver.size();
+    header.sourceHash = sourceHash;
+    header.format = format;
+    header.length = binary.size();
+    header.checksum = hash(binary.data(), binary.size());
+
+    // Write to a temporary file and rename it into place so a crash or a
+    // concurrent writer never leaves a truncated entry behind.
+    std::string tmp = path + ".tmp";
+    FILE *file = fopen(tmp.c_str(), "wb");
+    if (!file)
+        return false;
+    bool ok = fwrite(&header, sizeof(Header), 1, file) == 1
+              && (driver.empty() || fwrite(driver.data(), driver.size(), 1, file) == 1)
+              && fwrite(binary.data(), binary.size(), 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+inline bool OpenGLProgramBinaryCache::load(GLuint program, const char *vsh, const char *fsh, const std::vector<const char *> &attrs)
+{
+    if (!isEnabled())
+        return false;
+
+    uint64_t key = sourceHash(vsh, fsh, attrs);
+    std::string path = pathFor(key);
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+    fclose(file);
+
+    GLenum format = 0;
+    std::vector<char> binary;
+    bool valid = readEntry(path, key, m_driver, &format, &binary);
+    if (valid) {
+        m_programBinary(program, format, binary.data(), binary.size());
+        GLint status = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        valid = status == GL_TRUE;
+        while (glGetError() != GL_NO_ERROR) { }
+    }
+
+    if (!valid) {
+        logw << "discarding stale program binary: " << path << std::endl;
+        remove(path.c_str());
+        return false;
+    }
+
+    logd << "program loaded from: " << path << std::endl;
+    return true;
+}
+
+inline void OpenGLProgramBinaryCache::store(GLuint program, const char *vsh, const char *fsh, const std::vector<const char *> &attrs)
+{
+    if (!isEnabled())
+        return;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+    if (length <= 0)
+        return;
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    m_getProgramBinary(program, length, &length, &format, binary.data());
+    if (glGetError() != GL_NO_ERROR || length <= 0)
+        return;
+    binary.resize(length);
+
+    uint64_t key = sourceHash(vsh, fsh, attrs);
+    std::string path = pathFor(key);
+    if (!writeEntry(path, key, m_driver, format, binary)) {
+        logw << "failed to write program binary: " << path << std::endl;
+        return;
+    }
+
+    logd << "program stored in: " << path << std::endl;
+}
+
+RENGINE_END_NAMESPACE
@@ -30,9 +30,15 @@
 #include <alloca.h>
 #include <iomanip>
 #include <cstring>
+#include <unordered_map>
+#include <memory>
 
 #include "openglrenderer_shaders.h"
 
+#ifndef GL_STENCIL_INDEX8
+#define GL_STENCIL_INDEX8 0x8D48
+#endif
+
 RENGINE_BEGIN_NAMESPACE
 
 class OpenGLRenderer : public Renderer
@@ -73,14 +79,15 @@ public:
 
     struct Element {
         Node *node;
-        unsigned vboOffset;         // offset into vbo for flattened, rect and layer nodes
+        unsigned vboOffset;         // offset into vbo for flattened, rect, clip and layer nodes, index into m_listStates for list nodes
         float z;                    // only valid when 'projection' is set
         unsigned texture;           // only valid during rendering when 'layered' is set.
         unsigned sourceTexture;     // only valid during rendering when 'layered' is set and we have a shadow node
-        unsigned groupSize : 29;    // The size of this group, used with 'projection' and 'layered'. Packed to ft into 32-bit
+        unsigned groupSize : 28;    // The size of this group, used with 'projection', 'layered' and clip nodes. Packed to ft into 32-bit
                                     // The groupSize is the number of nodes inside the group, excluding the parent.
         unsigned projection : 1;    // 3d subtree
         unsigned layered : 1;       // subtree is flattened into a layer (texture)
+        unsigned cached : 1;        // 'layered' subtree which was promoted, the texture is kept across frames
         unsigned completed : 1;     // used during the actual rendering to know we're done with it
 
         bool operator<(const Element &e) const { return e.completed || z < e.z; }
@@ -94,8 +101,8 @@ public:
         UpdateTextureBgrProgram     = 0x04,
         UpdateAlphaTextureProgram   = 0x08,
         UpdateColorFilterProgram    = 0x10,
-        UpdateBlurProgram           = 0x20,
-        UpdateShadowProgram         = 0x40,
+        UpdateRectangleListProgram  = 0x20,
+        UpdateSpriteListProgram     = 0x40,
         UpdateAllPrograms           = 0xffffffff
     };
 
@@ -106,9 +113,12 @@ public:
 
     void initialize() override;
     bool render() override;
-    void frameSwapped() override { m_texturePool.compact(); }
+    void frameSwapped() override;
     bool readPixels(int x, int y, int w, int h, unsigned *pixels) override;
 
+    void openRenderTarget(vec2 size) override;
+    Texture *closeRenderTarget() override;
+
     void prepass(Node *n);
     void build(Node *n);
     void drawColorQuad(unsigned bufferOffset, vec4 color);
@@ -116,6 +126,7 @@ public:
     void drawColorFilterQuad(unsigned bufferOffset, GLuint texId, mat4 cm);
     void drawBlurQuad(unsigned bufferOffset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step);
     void drawShadowQuad(unsigned bufferOffset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step, vec4 color);
+    void drawListNode(Element *e);
     void activateShader(const Program *shader);
     void projectQuad(vec2 a, vec2 b, vec2 *v);
     void render(Element *first, Element *last);
@@ -123,8 +134,129 @@ public:
     void setDefaultOpenGLState();
     rect2d boundingRectFor(unsigned vertexOffset) const { return rect2d(m_vertices[vertexOffset], m_vertices[vertexOffset + 3]); }
 
+    /*!
+        Clip nodes are applied with the scissor test when their device space
+        quad is an axis-aligned rectangle, and by writing the quad into the
+        stencil buffer otherwise. pushClip() is called when rendering reaches
+        the clip element and popClip() once its group is done.
+     */
+    void pushClip(Element *e);
+    void popClip();
+    void writeStencil(unsigned vertexOffset, GLenum op);
+    void applyClipState();
+    bool isCulled(const vec2 *v) const;
+    rect2d scissorRectFor(unsigned vertexOffset) const;
+    static bool isAxisAligned(const vec2 *v);
+
     void ensureMatrixUpdated(ProgramUpdate bit, Program *p);
 
+    /*!
+        Programs are compiled the first time the prepass finds a node which
+        needs them. compileProgram() compiles the program for \a bit, one of
+        the ProgramUpdate values, unless it is already compiled.
+     */
+    void compileProgram(ProgramUpdate bit);
+    bool isProgramCompiled(ProgramUpdate bit) const { return (m_compiledPrograms & bit) != 0; }
+
+    /*!
+        Compiles up to \a count of the programs which have not been needed
+        yet. Returns true if there are more programs left to compile.
+     */
+    bool prewarmPrograms(unsigned count = 1);
+
+    /*!
+        When enabled, one of the remaining programs is compiled after each
+        frame has been swapped, starting after the first frame, so effects
+        used later don't stall the frame they first appear in.
+     */
+    void setProgramPrewarmEnabled(bool enabled) { m_prewarmPrograms = enabled; }
+
+    /*!
+        Returns the time from the renderer was created until the first frame
+        was swapped, or zero if that hasn't happened yet.
+     */
+    std::chrono::steady_clock::duration timeToFirstFrame() const { return m_timeToFirstFrame; }
+
+    /*!
+        Textures in AutomaticMipmaps mode which are drawn at less than \a
+        scale of their size for \a frames consecutive frames get mipmaps
+        generated. Setting scale to 0 disables automatic mipmapping.
+     */
+    void setAutomaticMipmapThreshold(float scale, unsigned frames) {
+        m_mipmapScaleThreshold = scale;
+        m_mipmapFrameThreshold = frames;
+    }
+    void trackMinification(const Texture *texture, const vec2 *v);
+    void updateMipmaps();
+
+    /*!
+        Tuning for automatic layer promotion. A subtree becomes a candidate
+        when its draw cost, roughly the number of primitives with effects
+        counting extra, is at least \a minimumCost. A candidate which has
+        not changed for \a stableFrames frames is promoted: it is rendered
+        into a texture once and drawn from that texture until it changes.
+        When the cached textures take more than \a memoryBudget bytes, the
+        layers which save the least per byte are demoted.
+     */
+    struct LayerPromotionPolicy {
+        unsigned minimumCost = 32;
+        unsigned stableFrames = 30;
+        size_t memoryBudget = 16 * 1024 * 1024;
+    };
+
+    struct LayerPromotionStats {
+        unsigned candidates = 0;        // expensive, cacheable subtrees seen in the last frame
+        unsigned promotedLayers = 0;    // layers currently promoted
+        unsigned cachedDraws = 0;       // layers drawn from their texture in the last frame
+        unsigned layerRenders = 0;      // layers rendered into their texture in the last frame
+        unsigned promotions = 0;        // total number of promotions
+        unsigned demotions = 0;         // total number of demotions
+        size_t bytes = 0;               // memory held by cached layers
+    };
+
+    /*!
+        When enabled, the renderer observes how often subtrees change and
+        what they cost to draw, and caches stable, expensive subtrees in
+        textures. Subtrees containing RenderNodes or below a 3D projection
+        are never promoted.
+
+        Changes are detected from the nodes' change stamps, and candidate
+        subtrees which have not changed since the last frame are not visited
+        again, so the per-frame cost of a promoted layer does not depend on
+        its size. Pixel changes to a texture which is drawn inside a
+        promoted layer are not noticed. Call invalidateLayerCache() after
+        uploading new content into such a texture.
+
+        Disabled by default.
+     */
+    void setLayerPromotionEnabled(bool enabled) { m_layerPromotion = enabled; }
+    bool isLayerPromotionEnabled() const { return m_layerPromotion; }
+    void setLayerPromotionPolicy(const LayerPromotionPolicy &policy) { m_layerPromotionPolicy = policy; }
+    const LayerPromotionPolicy &layerPromotionPolicy() const { return m_layerPromotionPolicy; }
+    const LayerPromotionStats &layerPromotionStats() const { return m_layerPromotionStats; }
+    void invalidateLayerCache();
+
+    struct LayerCacheEntry {
+        uint64_t hash = 0;
+        uint64_t contentHash = 0;       // the subtree's hash, without the transform
+        unsigned cost = 0;
+        unsigned stableFrames = 0;
+        unsigned frame = 0;             // last frame the subtree was seen
+        unsigned usedFrame = 0;         // last frame the texture was drawn
+        vec2 translation;               // device translation of the subtree this frame
+        vec2 cachedTranslation;         // device translation when the texture was rendered
+        rect2d bounds;                  // device rect of the texture when it was rendered
+        GLuint texture = 0;
+        bool promoted = false;
+    };
+
+    bool observe(Node *n, const mat4 &m, bool in3d, uint64_t *hash, unsigned *cost);
+    void observeCandidate(Node *n, LayerCacheEntry *entry, const mat4 &m, uint64_t hash, unsigned cost);
+    LayerCacheEntry *promotedLayerFor(Node *n);
+    void buildCachedLayer(Node *n, LayerCacheEntry *entry);
+    void demoteLayer(LayerCacheEntry *entry);
+    void updateLayerCache();
+
     Program prog_texture;
     Program prog_texture_bgr;
     struct : public Program {
@@ -141,10 +273,48 @@ public:
         int radius;
         int sigma;
         int step;
-    } prog_blur;
-    struct : public BlurProgram {
         int color;
-    } prog_shadow;
+    };
+
+    /*!
+        Returns the blur program specialized for \a radius, or the shadow
+        program if \a shadow is set. The programs are compiled on demand
+        and kept in a cache keyed by radius bucket and effect.
+     */
+    BlurProgram *blurProgram(int radius, bool shadow);
+    std::unordered_map<unsigned, std::unique_ptr<BlurProgram>> m_blurPrograms;
+
+    struct ListProgram : public Program {
+        int matrix3d;
+        int farPlane;
+    };
+    ListProgram prog_rectangleList;
+    ListProgram prog_spriteList;
+
+    // The transform of a list node, captured during build()
+    struct ListState {
+        mat4 m2d;
+        mat4 m3d;
+        float farPlane;
+    };
+
+    // A list node's vertex buffer. Positions, colors and, for sprites,
+    // texture coordinates are stored one after the other, each with room for
+    // 'capacity' quads.
+    struct ListBuffer {
+        GLuint id = 0;
+        unsigned capacity = 0;
+        unsigned serial = 0;
+        unsigned frame = 0;
+    };
+
+    // Quads are drawn with 16-bit indices, so a draw covers at most this many
+    enum { MaxQuadsPerListDraw = 65536 / 4 };
+    // Frames a list buffer survives without being drawn before it is deleted
+    enum { ListBufferRetainFrames = 8 };
+
+    void uploadList(RectangleListNode *node, ListBuffer *buffer);
+    void releaseUnusedListBuffers();
 
     unsigned m_numLayeredNodes;
     unsigned m_numTextureNodes;
@@ -152,6 +322,9 @@ public:
     unsigned m_numTransformNodes;
     unsigned m_numTransformNodesWith3d;
     unsigned m_numRenderNodes;
+    unsigned m_numListNodes;
+    unsigned m_numClipNodes;
+    unsigned m_numStencilClips;
     unsigned m_additionalQuads;
 
     unsigned m_vertexIndex;
@@ -163,20 +336,62 @@ public:
     mat4 m_m3d;    // below a 3d projection subtree
     float m_farPlane;
     rect2d m_layerBoundingBox;
+    rect2d m_clipBoundingBox;   // device space bounds of the current clip during build()
     vec2 m_surfaceSize;
 
+    struct ClipState {
+        Element *end;
+        unsigned vboOffset;
+        rect2d scissor;
+        bool stencil;
+    };
+    std::vector<ClipState> m_clipStack;
+    unsigned m_stencilDepth;
+
     TexturePool m_texturePool;
+    OpenGLProgramBinaryCache m_programCache;
+
+    float m_mipmapScaleThreshold;
+    unsigned m_mipmapFrameThreshold;
+    std::unordered_map<const Texture *, unsigned> m_minifiedTextures;
+    std::vector<const Texture *> m_minifiedThisFrame;
+
+    std::vector<ListState> m_listStates;
+    std::unordered_map<const Node *, ListBuffer> m_listBuffers;
+    std::vector<char> m_listScratch;
+    GLuint m_quadIndexBuffer;
+    unsigned m_frameCounter;
+
+    std::unordered_map<const Node *, LayerCacheEntry> m_layerCache;
+    unsigned m_observedEpoch = 0;
+    LayerPromotionPolicy m_layerPromotionPolicy;
+    LayerPromotionStats m_layerPromotionStats;
+
+    unsigned m_requiredPrograms;
+    unsigned m_compiledPrograms;
+    std::chrono::steady_clock::time_point m_createdAt;
+    std::chrono::steady_clock::duration m_timeToFirstFrame;
+    std::chrono::steady_clock::duration m_programCompileTime;
 
     const Program *m_activeShader;
     GLuint m_texCoordBuffer;
     GLuint m_vertexBuffer;
     GLuint m_fbo;
 
+    OpenGLTexture *m_renderTarget;
+    GLuint m_renderTargetFbo;
+    GLuint m_renderTargetStencil;
+
     unsigned m_matrixState;
 
     bool m_render3d : 1;
     bool m_layered : 1;
     bool m_srgb : 1;
+    bool m_prewarmPrograms : 1;
+    bool m_firstFrameSwapped : 1;
+    bool m_clipped : 1;
+    bool m_layerPromotion : 1;
+    bool m_inCachedLayer : 1;
 
 };
 
@@ -194,6 +409,7 @@ inline void OpenGLRenderer::projectQuad(vec2 a, vec2 b, vec2 *v)
 
 inline void OpenGLRenderer::ensureMatrixUpdated(ProgramUpdate bit, Program *p)
 {
+    assert(isProgramCompiled(bit));
     if (m_matrixState & bit) {
         m_matrixState &= ~bit;
         glUniformMatrix4fv(p->matrix, 1, true, m_proj.m);
@@ -206,30 +422,111 @@ inline OpenGLRenderer::OpenGLRenderer()
     , m_numRectangleNodes(0)
     , m_numTransformNodes(0)
     , m_numTransformNodesWith3d(0)
+    , m_numListNodes(0)
+    , m_numClipNodes(0)
+    , m_numStencilClips(0)
     , m_additionalQuads(0)
     , m_vertexIndex(0)
     , m_elementIndex(0)
     , m_vertices(0)
     , m_elements(0)
     , m_farPlane(0)
+    , m_stencilDepth(0)
+    , m_mipmapScaleThreshold(0.5f)
+    , m_mipmapFrameThreshold(10)
+    , m_quadIndexBuffer(0)
+    , m_frameCounter(0)
+    , m_requiredPrograms(0)
+    , m_compiledPrograms(0)
+    , m_createdAt(std::chrono::steady_clock::now())
+    , m_timeToFirstFrame(0)
+    , m_programCompileTime(0)
     , m_activeShader(0)
     , m_texCoordBuffer(0)
     , m_vertexBuffer(0)
     , m_fbo(0)
+    , m_renderTarget(nullptr)
+    , m_renderTargetFbo(0)
+    , m_renderTargetStencil(0)
     , m_matrixState(UpdateAllPrograms)
     , m_render3d(false)
     , m_layered(false)
     , m_srgb(false)
+    , m_prewarmPrograms(false)
+    , m_firstFrameSwapped(false)
+    , m_clipped(false)
+    , m_layerPromotion(false)
+    , m_inCachedLayer(false)
 {
     initialize();
 }
 
 inline OpenGLRenderer::~OpenGLRenderer()
 {
+    // Hand the cached layers to the pool so they are deleted with it
+    for (auto &it : m_layerCache) {
+        if (it.second.texture)
+            m_texturePool.release(it.second.texture);
+    }
     glDeleteBuffers(1, &m_texCoordBuffer);
     glDeleteBuffers(1, &m_vertexBuffer);
+    glDeleteBuffers(1, &m_quadIndexBuffer);
+    for (auto &it : m_listBuffers)
+        glDeleteBuffers(1, &it.second.id);
+
+    assert(m_fbo == 0);
+    assert(!m_renderTarget);
+}
 
+inline void OpenGLRenderer::openRenderTarget(vec2 size)
+{
+    assert(!m_renderTarget);
     assert(m_fbo == 0);
+
+    m_renderTarget = new OpenGLTexture();
+    m_renderTarget->setMipmapMode(Texture::NoMipmaps);
+    m_renderTarget->upload(size.x, size.y, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenFramebuffers(1, &m_renderTargetFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_renderTargetFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_renderTarget->textureId(), 0);
+
+    // For clips which need the stencil buffer
+    glGenRenderbuffers(1, &m_renderTargetStencil);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_renderTargetStencil);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_STENCIL_INDEX8, size.x, size.y);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_renderTargetStencil);
+
+#ifndef NDEBUG
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        logw << "render target FBO failed, size=" << size << ", error="
+             << std::hex << glCheckFramebufferStatus(GL_FRAMEBUFFER) << std::dec << std::endl;
+        assert(false);
+    }
+#endif
+
+    m_fbo = m_renderTargetFbo;
+}
+
+inline Texture *OpenGLRenderer::closeRenderTarget()
+{
+    assert(m_renderTarget);
+    assert(m_fbo == m_renderTargetFbo);
+
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteRenderbuffers(1, &m_renderTargetStencil);
+    glDeleteFramebuffers(1, &m_renderTargetFbo);
+    m_renderTargetStencil = 0;
+    m_renderTargetFbo = 0;
+    m_fbo = 0;
+
+    Texture *texture = m_renderTarget;
+    m_renderTarget = nullptr;
+    return texture;
 }
 
 inline bool OpenGLRenderer::readPixels(int x, int y, int w, int h, unsigned *bytes)
@@ -262,53 +559,6 @@ inline void OpenGLRenderer::initialize()
     // Create the vertex coordinate buffer
     glGenBuffers(1, &m_vertexBuffer);
 
-    std::vector<const char *> attrsVT;
-    attrsVT.push_back("aV");
-    attrsVT.push_back("aT");
-
-    std::vector<const char *> attrsV;
-    attrsV.push_back("aV");
-
-    // Default texture shader
-    prog_texture.initialize(openglrenderer_vsh_texture(), openglrenderer_fsh_texture(), attrsVT);
-    prog_texture.matrix = prog_texture.resolve("m");
-
-    // BGRA texture shader
-    prog_texture_bgr.initialize(openglrenderer_vsh_texture(), openglrenderer_fsh_texture_bgra(), attrsVT);
-    prog_texture_bgr.matrix = prog_texture.resolve("m");
-
-    // Alpha texture shader
-    prog_alphaTexture.initialize(openglrenderer_vsh_texture(), openglrenderer_fsh_texture_alpha(), attrsVT);
-    prog_alphaTexture.matrix = prog_alphaTexture.resolve("m");
-    prog_alphaTexture.alpha = prog_alphaTexture.resolve("alpha");
-
-    // Solid color shader...
-    prog_solid.initialize(openglrenderer_vsh_solid(), openglrenderer_fsh_solid(), attrsV);
-    prog_solid.matrix = prog_solid.resolve("m");
-    prog_solid.color = prog_solid.resolve("color");
-
-    // Color filter shader..
-    prog_colorFilter.initialize(openglrenderer_vsh_texture(), openglrenderer_fsh_texture_colorfilter(), attrsVT);
-    prog_colorFilter.matrix = prog_solid.resolve("m");
-    prog_colorFilter.colorMatrix = prog_colorFilter.resolve("CM");
-
-    // Blur shader
-    prog_blur.initialize(openglrenderer_vsh_blur(), openglrenderer_fsh_blur(), attrsVT);
-    prog_blur.matrix = prog_blur.resolve("m");
-    prog_blur.dims = prog_blur.resolve("dims");
-    prog_blur.radius = prog_blur.resolve("radius");
-    prog_blur.sigma = prog_blur.resolve("sigma");
-    prog_blur.step = prog_blur.resolve("step");
-
-    // Shadow shader
-    prog_shadow.initialize(openglrenderer_vsh_blur(), openglrenderer_fsh_shadow(), attrsVT);
-    prog_shadow.matrix = prog_shadow.resolve("m");
-    prog_shadow.dims = prog_shadow.resolve("dims");
-    prog_shadow.radius = prog_shadow.resolve("radius");
-    prog_shadow.sigma = prog_shadow.resolve("sigma");
-    prog_shadow.step = prog_shadow.resolve("step");
-    prog_shadow.color = prog_shadow.resolve("color");
-
     // Using srgb for everything needs a bit more thought as it results in
     // really washed out colors for rectangles and image textures.
     const char *extensions = (const char *) glGetString(GL_EXTENSIONS);
@@ -345,6 +595,127 @@ inline void OpenGLRenderer::initialize()
 
 }
 
+inline void OpenGLRenderer::compileProgram(ProgramUpdate bit)
+{
+    if (m_compiledPrograms & bit)
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+
+    static const std::vector<const char *> attrsVT = { "aV", "aT" };
+    static const std::vector<const char *> attrsV = { "aV" };
+
+    switch (bit) {
+    case UpdateTextureProgram:
+        prog_texture.initialize(openglrenderer_vsh_texture(), openglrenderer_specialize(openglrenderer_fsh_texture(), 0).c_str(), attrsVT, &m_programCache);
+        prog_texture.matrix = prog_texture.resolve("m");
+        break;
+    case UpdateTextureBgrProgram:
+        prog_texture_bgr.initialize(openglrenderer_vsh_texture(), openglrenderer_specialize(openglrenderer_fsh_texture(), PermutationBgr).c_str(), attrsVT, &m_programCache);
+        prog_texture_bgr.matrix = prog_texture_bgr.resolve("m");
+        break;
+    case UpdateAlphaTextureProgram:
+        prog_alphaTexture.initialize(openglrenderer_vsh_texture(), openglrenderer_specialize(openglrenderer_fsh_texture(), PermutationOpacity).c_str(), attrsVT, &m_programCache);
+        prog_alphaTexture.matrix = prog_alphaTexture.resolve("m");
+        prog_alphaTexture.alpha = prog_alphaTexture.resolve("alpha");
+        break;
+    case UpdateSolidProgram:
+        prog_solid.initialize(openglrenderer_vsh_solid(), openglrenderer_fsh_solid(), attrsV, &m_programCache);
+        prog_solid.matrix = prog_solid.resolve("m");
+        prog_solid.color = prog_solid.resolve("color");
+        break;
+    case UpdateColorFilterProgram:
+        prog_colorFilter.initialize(openglrenderer_vsh_texture(), openglrenderer_fsh_texture_colorfilter(), attrsVT, &m_programCache);
+        prog_colorFilter.matrix = prog_colorFilter.resolve("m");
+        prog_colorFilter.colorMatrix = prog_colorFilter.resolve("CM");
+        break;
+    case UpdateRectangleListProgram:
+    case UpdateSpriteListProgram: {
+        bool sprites = bit == UpdateSpriteListProgram;
+        ListProgram *program = sprites ? &prog_spriteList : &prog_rectangleList;
+        static const std::vector<const char *> attrsVC = { "aV", "aC" };
+        static const std::vector<const char *> attrsVTC = { "aV", "aT", "aC" };
+        unsigned flags = sprites ? PermutationTextured : 0;
+        program->initialize(openglrenderer_specialize(openglrenderer_vsh_list(), flags).c_str(),
+                            openglrenderer_specialize(openglrenderer_fsh_list(), flags).c_str(),
+                            sprites ? attrsVTC : attrsVC,
+                            &m_programCache);
+        program->matrix = program->resolve("m");
+        program->matrix3d = program->resolve("m3d");
+        program->farPlane = program->resolve("farPlane");
+    }   break;
+    default:
+        assert(false);
+        return;
+    }
+
+    m_compiledPrograms |= bit;
+    // A freshly linked program has no matrix set yet
+    m_matrixState |= bit;
+
+    auto duration = std::chrono::steady_clock::now() - start;
+    m_programCompileTime += duration;
+    logd << "compiled program " << std::hex << bit << std::dec << " in "
+         << std::chrono::duration_cast<std::chrono::microseconds>(duration).count() << " us" << std::endl;
+}
+
+inline OpenGLRenderer::BlurProgram *OpenGLRenderer::blurProgram(int radius, bool shadow)
+{
+    int bucket = openglrenderer_radiusBucket(radius);
+    unsigned key = (bucket << 1) | (shadow ? 1 : 0);
+    std::unique_ptr<BlurProgram> &program = m_blurPrograms[key];
+    if (program)
+        return program.get();
+
+    auto start = std::chrono::steady_clock::now();
+
+    static const std::vector<const char *> attrsVT = { "aV", "aT" };
+    std::string fsh = openglrenderer_specialize(openglrenderer_fsh_blur(), shadow ? PermutationShadow : 0, bucket);
+    program.reset(new BlurProgram());
+    program->initialize(openglrenderer_vsh_blur(), fsh.c_str(), attrsVT, &m_programCache);
+    program->matrix = program->resolve("m");
+    program->dims = program->resolve("dims");
+    program->radius = program->resolve("radius");
+    program->sigma = program->resolve("sigma");
+    program->step = program->resolve("step");
+    program->color = shadow ? program->resolve("color") : -1;
+
+    m_programCompileTime += std::chrono::steady_clock::now() - start;
+    logd << "compiled " << (shadow ? "shadow" : "blur") << " program for radius bucket " << bucket << std::endl;
+    return program.get();
+}
+
+inline bool OpenGLRenderer::prewarmPrograms(unsigned count)
+{
+    for (unsigned bit = UpdateSolidProgram; bit <= UpdateSpriteListProgram; bit <<= 1) {
+        if (m_compiledPrograms & bit)
+            continue;
+        if (count == 0)
+            return true;
+        compileProgram((ProgramUpdate) bit);
+        --count;
+    }
+    return false;
+}
+
+inline void OpenGLRenderer::frameSwapped()
+{
+    m_texturePool.compact();
+
+    if (!m_firstFrameSwapped) {
+        m_firstFrameSwapped = true;
+        m_timeToFirstFrame = std::chrono::steady_clock::now() - m_createdAt;
+        logi << "time to first frame: "
+             << std::chrono::duration_cast<std::chrono::milliseconds>(m_timeToFirstFrame).count() << " ms, "
+             << "of which compiling programs: "
+             << std::chrono::duration_cast<std::chrono::milliseconds>(m_programCompileTime).count() << " ms" << std::endl;
+        return;
+    }
+
+    if (m_prewarmPrograms)
+        m_prewarmPrograms = prewarmPrograms(1);
+}
+
 /*!
 
     Draws a quad using the 'solid' program. \a v is a vector of 8 floats,
@@ -394,14 +765,17 @@ inline void OpenGLRenderer::drawTextureQuad(unsigned offset, GLuint texId, float
 
 inline void OpenGLRenderer::drawBlurQuad(unsigned offset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step)
 {
-    activateShader(&prog_blur);
-    ensureMatrixUpdated(UpdateBlurProgram, &prog_blur);
-
-    glUniform1i(prog_blur.radius, radius);
-    glUniform4f(prog_blur.dims, renderSize.x, renderSize.y, textureSize.x, textureSize.y);
+    BlurProgram *program = blurProgram(radius, false);
+    activateShader(program);
+    // Blur programs are many and seldom used, so don't bother tracking them
+    // in m_matrixState.
+    glUniformMatrix4fv(program->matrix, 1, true, m_proj.m);
+
+    glUniform1i(program->radius, radius);
+    glUniform4f(program->dims, renderSize.x, renderSize.y, textureSize.x, textureSize.y);
     float sigma = 0.3 * radius + 0.8;
-    glUniform1f(prog_blur.sigma, sigma * sigma * 2.0);
-    glUniform2f(prog_blur.step, step.x, step.y);
+    glUniform1f(program->sigma, sigma * sigma * 2.0);
+    glUniform2f(program->step, step.x, step.y);
 
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void *) (offset * sizeof(vec2)));
     glBindTexture(GL_TEXTURE_2D, texId);
@@ -410,21 +784,183 @@ inline void OpenGLRenderer::drawBlurQuad(unsigned offset, GLuint texId, int radi
 
 inline void OpenGLRenderer::drawShadowQuad(unsigned offset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step, vec4 color)
 {
-    activateShader(&prog_shadow);
-    ensureMatrixUpdated(UpdateShadowProgram, &prog_shadow);
+    BlurProgram *program = blurProgram(radius, true);
+    activateShader(program);
+    glUniformMatrix4fv(program->matrix, 1, true, m_proj.m);
 
-    glUniform1i(prog_shadow.radius, radius);
-    glUniform4f(prog_shadow.dims, renderSize.x, renderSize.y, textureSize.x, textureSize.y);
+    glUniform1i(program->radius, radius);
+    glUniform4f(program->dims, renderSize.x, renderSize.y, textureSize.x, textureSize.y);
     float sigma = 0.3 * radius + 0.8;
-    glUniform1f(prog_shadow.sigma, sigma * sigma * 2.0);
-    glUniform2f(prog_shadow.step, step.x, step.y);
-    glUniform4f(prog_shadow.color, color.x, color.y, color.z, color.w);
+    glUniform1f(program->sigma, sigma * sigma * 2.0);
+    glUniform2f(program->step, step.x, step.y);
+    glUniform4f(program->color, color.x, color.y, color.z, color.w);
 
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void *) (offset * sizeof(vec2)));
     glBindTexture(GL_TEXTURE_2D, texId);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 }
 
+/*!
+    Draws the RectangleListNode, SpriteListNode, ParticleSystemNode or
+    NinePatchNode in \a e with one draw call per MaxQuadsPerListDraw
+    entries, uploading what has changed first.
+ */
+inline void OpenGLRenderer::drawListNode(Element *e)
+{
+    RectangleListNode *node = static_cast<RectangleListNode *>(e->node);
+    bool sprites = node->type() != Node::RectangleListNodeType;
+    const Texture *texture = sprites ? static_cast<SpriteListNode *>(node)->texture() : nullptr;
+    const ListState &state = m_listStates[e->vboOffset];
+
+    ListBuffer &buffer = m_listBuffers[node];
+    if (buffer.serial != node->serial()) {
+        // Fresh entry, or a new node at the address of a destroyed one.
+        buffer.serial = node->serial();
+        buffer.capacity = 0;
+    }
+    buffer.frame = m_frameCounter;
+    if (!buffer.id)
+        glGenBuffers(1, &buffer.id);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer.id);
+    uploadList(node, &buffer);
+
+    if (!m_quadIndexBuffer) {
+        std::vector<GLushort> indices(MaxQuadsPerListDraw * 6);
+        for (unsigned i=0; i<MaxQuadsPerListDraw; ++i) {
+            GLushort *q = indices.data() + i * 6;
+            GLushort v = i * 4;
+            q[0] = v; q[1] = v + 1; q[2] = v + 2;
+            q[3] = v + 2; q[4] = v + 1; q[5] = v + 3;
+        }
+        glGenBuffers(1, &m_quadIndexBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_quadIndexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+    } else {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_quadIndexBuffer);
+    }
+
+    // Sprites without a texture are drawn as plain rectangles
+    ListProgram *program = texture ? &prog_spriteList : &prog_rectangleList;
+    assert(isProgramCompiled(texture ? UpdateSpriteListProgram : UpdateRectangleListProgram));
+    activateShader(program);
+    glUniformMatrix4fv(program->matrix, 1, true, (m_proj * state.m2d).m);
+    glUniformMatrix4fv(program->matrix3d, 1, true, state.m3d.m);
+    glUniform1f(program->farPlane, state.farPlane);
+    if (texture)
+        glBindTexture(GL_TEXTURE_2D, texture->textureId());
+
+    unsigned colorOffset = buffer.capacity * 4 * sizeof(vec2);
+    unsigned texCoordOffset = colorOffset + buffer.capacity * 4 * sizeof(unsigned);
+    int colorAttribute = texture ? 2 : 1;
+    for (unsigned first=0; first<node->size(); first+=MaxQuadsPerListDraw) {
+        unsigned count = std::min<unsigned>(MaxQuadsPerListDraw, node->size() - first);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void *) (size_t) (first * 4 * sizeof(vec2)));
+        glVertexAttribPointer(colorAttribute, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, (void *) (size_t) (colorOffset + first * 4 * sizeof(unsigned)));
+        if (texture)
+            glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void *) (size_t) (texCoordOffset + first * 4 * sizeof(vec2)));
+        glDrawElements(GL_TRIANGLES, count * 6, GL_UNSIGNED_SHORT, 0);
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    // Put back the vertex and texture coordinate buffers the other draw
+    // functions expect.
+    setDefaultOpenGLState();
+}
+
+/*!
+    Uploads the changed entries of \a node into the currently bound \a
+    buffer, or all of them if the buffer needs to grow.
+ */
+inline void OpenGLRenderer::uploadList(RectangleListNode *node, ListBuffer *buffer)
+{
+    bool sprites = node->type() != Node::RectangleListNodeType;
+    unsigned size = node->size();
+    unsigned first;
+    unsigned last;
+    if (size > buffer->capacity) {
+        buffer->capacity = std::max(size, buffer->capacity + buffer->capacity / 2);
+        unsigned bytesPerQuad = 4 * (sizeof(vec2) + sizeof(unsigned) + (sprites ? sizeof(vec2) : 0));
+        glBufferData(GL_ARRAY_BUFFER, buffer->capacity * bytesPerQuad, 0, GL_DYNAMIC_DRAW);
+        first = 0;
+        last = size;
+    } else if (node->isDirty()) {
+        first = node->dirtyBegin();
+        last = std::min(node->dirtyEnd(), size);
+    } else {
+        return;
+    }
+    node->resetDirty();
+    if (first >= last)
+        return;
+
+    unsigned count = last - first;
+    m_listScratch.resize(count * 4 * sizeof(vec2));
+
+    // Positions, in the same order as the other quads: tl, bl, tr, br
+    vec2 *v = (vec2 *) m_listScratch.data();
+    const rect2d *rects = node->rects() + first;
+    for (unsigned i=0; i<count; ++i) {
+        const rect2d &r = rects[i];
+        v[0] = r.tl;
+        v[1] = vec2(r.left(), r.bottom());
+        v[2] = vec2(r.right(), r.top());
+        v[3] = r.br;
+        v += 4;
+    }
+    glBufferSubData(GL_ARRAY_BUFFER, first * 4 * sizeof(vec2), count * 4 * sizeof(vec2), m_listScratch.data());
+
+    // Colors, premultiplied into 8-bit RGBA
+    unsigned *c = (unsigned *) m_listScratch.data();
+    const vec4 *colors = node->colors() + first;
+    for (unsigned i=0; i<count; ++i) {
+        const vec4 &color = colors[i];
+        unsigned char p[4] = { (unsigned char) (color.x * color.w * 255.0f + 0.5f),
+                               (unsigned char) (color.y * color.w * 255.0f + 0.5f),
+                               (unsigned char) (color.z * color.w * 255.0f + 0.5f),
+                               (unsigned char) (color.w * 255.0f + 0.5f) };
+        unsigned packed;
+        memcpy(&packed, p, sizeof(packed));
+        c[0] = c[1] = c[2] = c[3] = packed;
+        c += 4;
+    }
+    unsigned colorOffset = buffer->capacity * 4 * sizeof(vec2);
+    glBufferSubData(GL_ARRAY_BUFFER, colorOffset + first * 4 * sizeof(unsigned), count * 4 * sizeof(unsigned), m_listScratch.data());
+
+    if (sprites) {
+        vec2 *t = (vec2 *) m_listScratch.data();
+        const rect2d *texCoords = static_cast<SpriteListNode *>(node)->texCoords() + first;
+        for (unsigned i=0; i<count; ++i) {
+            const rect2d &r = texCoords[i];
+            t[0] = r.tl;
+            t[1] = vec2(r.left(), r.bottom());
+            t[2] = vec2(r.right(), r.top());
+            t[3] = r.br;
+            t += 4;
+        }
+        unsigned texCoordOffset = colorOffset + buffer->capacity * 4 * sizeof(unsigned);
+        glBufferSubData(GL_ARRAY_BUFFER, texCoordOffset + first * 4 * sizeof(vec2), count * 4 * sizeof(vec2), m_listScratch.data());
+    }
+}
+
+/*!
+    Deletes the vertex buffers of list nodes which have not been drawn for
+    ListBufferRetainFrames frames. Lists that are hidden briefly, or culled
+    for a frame or two, keep their buffers; lists that are gone for longer
+    may have been destroyed, and if not, they are uploaded again the next
+    time they are drawn.
+ */
+inline void OpenGLRenderer::releaseUnusedListBuffers()
+{
+    for (auto it = m_listBuffers.begin(); it != m_listBuffers.end(); ) {
+        if (m_frameCounter - it->second.frame >= ListBufferRetainFrames) {
+            glDeleteBuffers(1, &it->second.id);
+            it = m_listBuffers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
 inline void OpenGLRenderer::activateShader(const Program *shader)
 {
     if (shader == m_activeShader)
@@ -462,16 +998,36 @@ inline void OpenGLRenderer::activateShader(const Program *shader)
 inline void OpenGLRenderer::prepass(Node *n)
 {
     n->preprocess();
+
+    bool storedInCachedLayer = m_inCachedLayer;
+    if (m_layerPromotion && !m_inCachedLayer && n->child()) {
+        if (const LayerCacheEntry *entry = promotedLayerFor(n)) {
+            ++m_numLayeredNodes;
+            m_requiredPrograms |= UpdateTextureProgram;
+            // Drawn from the texture, nothing below it is needed.
+            if (entry->texture)
+                return;
+            m_inCachedLayer = true;
+        }
+    }
+
     switch (n->type()) {
     case Node::TextureNodeType: {
         TextureNode *tn = static_cast<TextureNode *>(n);
-        if (tn->width() != 0.0f && tn->height() != 0.0f && tn->texture() != nullptr)
+        if (tn->width() != 0.0f && tn->height() != 0.0f && tn->texture() != nullptr) {
             ++m_numTextureNodes;
+            Texture::Format format = tn->texture()->format();
+            m_requiredPrograms |= (format == Texture::BGRA_32 || format == Texture::BGRx_32)
+                                  ? UpdateTextureBgrProgram
+                                  : UpdateTextureProgram;
+        }
     }   break;
     case Node::RectangleNodeType: {
         RectangleNode *rn = static_cast<RectangleNode *>(n);
-        if (rn->width() != 0.0f && rn->height() != 0.0f && !(rn->color().w < RENGINE_RENDERER_ALPHA_THRESHOLD))
+        if (rn->width() != 0.0f && rn->height() != 0.0f && !(rn->color().w < RENGINE_RENDERER_ALPHA_THRESHOLD)) {
             ++m_numRectangleNodes;
+            m_requiredPrograms |= UpdateSolidProgram;
+        }
     }   break;
     case Node::TransformNodeType:
         ++m_numTransformNodes;
@@ -480,28 +1036,57 @@ inline void OpenGLRenderer::prepass(Node *n)
         break;
     // All layered nodes take this path..
     case Node::ColorFilterNodeType:
-        if (!static_cast<ColorFilterNode *>(n)->colorMatrix().isIdentity())
+        if (!static_cast<ColorFilterNode *>(n)->colorMatrix().isIdentity()) {
             ++m_numLayeredNodes;
+            m_requiredPrograms |= UpdateColorFilterProgram;
+        }
         break;
     case Node::OpacityNodeType:
-        if (static_cast<OpacityNode *>(n)->opacity() < 1)
+        if (static_cast<OpacityNode *>(n)->opacity() < 1) {
             ++m_numLayeredNodes;
+            m_requiredPrograms |= UpdateAlphaTextureProgram;
+        }
         break;
     case Node::BlurNodeType:
         if (static_cast<BlurNode *>(n)->radius() > 0) {
             ++m_numLayeredNodes;
             m_additionalQuads += 2;
+            blurProgram(static_cast<BlurNode *>(n)->radius(), false);
         }
         break;
     case Node::ShadowNodeType:
         if (static_cast<ShadowNode *>(n)->color().w > 0) {
             ++m_numLayeredNodes;
             m_additionalQuads += 3;
+            blurProgram(static_cast<ShadowNode *>(n)->radius(), true);
+            // The source is drawn on top of the shadow with the texture program
+            m_requiredPrograms |= UpdateTextureProgram;
         }
         break;
     case Node::RenderNodeType:
         ++m_numRenderNodes;
         break;
+    case Node::ClipNodeType:
+        ++m_numClipNodes;
+        // Non-rectangular clips draw their shape into the stencil buffer
+        m_requiredPrograms |= UpdateSolidProgram;
+        break;
+    case Node::RectangleListNodeType:
+        if (static_cast<RectangleListNode *>(n)->size() > 0) {
+            ++m_numListNodes;
+            m_requiredPrograms |= UpdateRectangleListProgram;
+        }
+        break;
+    case Node::SpriteListNodeType:
+    case Node::ParticleSystemNodeType:
+    case Node::NinePatchNodeType:
+        if (static_cast<SpriteListNode *>(n)->size() > 0) {
+            ++m_numListNodes;
+            m_requiredPrograms |= static_cast<SpriteListNode *>(n)->texture()
+                                  ? UpdateSpriteListProgram
+                                  : UpdateRectangleListProgram;
+        }
+        break;
 
     default:
         // ignore...
@@ -510,10 +1095,19 @@ inline void OpenGLRenderer::prepass(Node *n)
 
     for (Node *c = n->child(); c; c = c->sibling())
         prepass(c);
+
+    m_inCachedLayer = storedInCachedLayer;
 }
 
 inline void OpenGLRenderer::build(Node *n)
 {
+    if (m_layerPromotion && !m_inCachedLayer && n->child()) {
+        if (LayerCacheEntry *entry = promotedLayerFor(n)) {
+            buildCachedLayer(n, entry);
+            return;
+        }
+    }
+
     switch (n->type()) {
     case Node::TextureNodeType:
     case Node::RectangleNodeType: {
@@ -544,9 +1138,16 @@ inline void OpenGLRenderer::build(Node *n)
             v[2] = m_m2d * vec2(p2.x, p1.y);
             v[3] = m_m2d * p2;
         }
+
+        if (m_clipped && isCulled(v))
+            break;
+
         m_vertexIndex += 4;
         m_elementIndex += 1;
 
+        if (n->type() == Node::TextureNodeType && m_mipmapScaleThreshold > 0)
+            trackMinification(static_cast<TextureNode *>(n)->texture(), v);
+
         // Add to the bounding box if we're in inside a layer
         if (m_layered) {
             for (int i=0; i<4; ++i)
@@ -599,9 +1200,15 @@ inline void OpenGLRenderer::build(Node *n)
             || (n->type() == Node::ShadowNodeType && static_cast<ShadowNode *>(n)->color().w > 0);
 
         bool storedTextureed = m_layered;
+        bool storedClipped = m_clipped;
         Element *e = 0;
         rect2d storedBox = m_layerBoundingBox;
 
+        // Blur and shadow spread content from outside the clip into it, so
+        // nothing below them can be culled.
+        if (useTexture && (n->type() == Node::BlurNodeType || n->type() == Node::ShadowNodeType))
+            m_clipped = false;
+
         if (useTexture) {
             m_layered = true;
             e = m_elements + m_elementIndex++;
@@ -616,6 +1223,8 @@ inline void OpenGLRenderer::build(Node *n)
         for (Node *c = n->child(); c; c = c->sibling())
             build(c);
 
+        m_clipped = storedClipped;
+
         if (e) {
             m_layered = storedTextureed;
             e->groupSize = (m_elements + m_elementIndex) - e - 1;
@@ -672,6 +1281,97 @@ inline void OpenGLRenderer::build(Node *n)
 
     } return;
 
+    case Node::RectangleListNodeType:
+    case Node::SpriteListNodeType:
+    case Node::ParticleSystemNodeType:
+    case Node::NinePatchNodeType: {
+        RectangleListNode *ln = static_cast<RectangleListNode *>(n);
+        if (ln->size() == 0)
+            break;
+
+        rect2d bounds = ln->boundingRect();
+        if (m_layered || m_clipped) {
+            vec2 v[4];
+            if (m_render3d) {
+                projectQuad(bounds.tl, bounds.br, v);
+            } else {
+                v[0] = m_m2d * bounds.tl;
+                v[1] = m_m2d * vec2(bounds.left(), bounds.bottom());
+                v[2] = m_m2d * vec2(bounds.right(), bounds.top());
+                v[3] = m_m2d * bounds.br;
+            }
+            if (m_clipped && isCulled(v))
+                break;
+            if (m_layered) {
+                for (int i=0; i<4; ++i)
+                    m_layerBoundingBox |= v[i];
+            }
+        }
+
+        // The list is transformed in the vertex shader, so we only record
+        // the current transform rather than computing vertices.
+        Element *e = m_elements + m_elementIndex++;
+        e->node = n;
+        e->vboOffset = m_listStates.size();
+        ListState state = { m_m2d, m_render3d ? m_m3d : mat4(), m_render3d ? m_farPlane : 0.0f };
+        m_listStates.push_back(state);
+
+        if (m_render3d)
+            e->z = (m_m3d * vec3(bounds.center())).z;
+    } break;
+
+    case Node::ClipNodeType: {
+        // Elements below a 3D projection are sorted, which would break up
+        // the clip's group, so clipping is ignored there.
+        if (m_render3d)
+            break;
+
+        rect2d clip = static_cast<ClipNode *>(n)->clipRect();
+        if (clip.isEmpty())
+            return;
+
+        vec2 *v = m_vertices + m_vertexIndex;
+        v[0] = m_m2d * clip.tl;
+        v[1] = m_m2d * vec2(clip.left(), clip.bottom());
+        v[2] = m_m2d * vec2(clip.right(), clip.top());
+        v[3] = m_m2d * clip.br;
+
+        const float inf = std::numeric_limits<float>::infinity();
+        rect2d box(inf, inf, -inf, -inf);
+        for (int i=0; i<4; ++i)
+            box |= v[i];
+        if (m_clipped)
+            box = box & m_clipBoundingBox;
+        // Everything inside is clipped away
+        if (box.isEmpty())
+            return;
+
+        Element *e = m_elements + m_elementIndex++;
+        e->node = n;
+        e->vboOffset = m_vertexIndex;
+        m_vertexIndex += 4;
+
+        bool storedClipped = m_clipped;
+        rect2d storedBox = m_clipBoundingBox;
+        m_clipped = true;
+        m_clipBoundingBox = box;
+
+        for (Node *c = n->child(); c; c = c->sibling())
+            build(c);
+
+        m_clipped = storedClipped;
+        m_clipBoundingBox = storedBox;
+
+        e->groupSize = (m_elements + m_elementIndex) - e - 1;
+        if (e->groupSize == 0) {
+            // Nothing to clip, drop it again.
+            --m_elementIndex;
+            m_vertexIndex -= 4;
+        } else if (!isAxisAligned(v)) {
+            ++m_numStencilClips;
+        }
+    } return;
+
     case Node::RenderNodeType: {
         Element *e = m_elements + m_elementIndex++;
         e->node = n;
@@ -697,6 +1397,400 @@ inline void OpenGLRenderer::build(Node *n)
 
 }
 
+/*!
+    Hashes the properties which affect how \a n and its subtree are drawn
+    into \a hash and sums up their draw cost into \a cost, then updates the
+    layer cache entry for \a n if it is a candidate for promotion. \a m is
+    the device transform of \a n. Returns false if the subtree can't be
+    cached.
+ */
+inline bool OpenGLRenderer::observe(Node *n, const mat4 &m, bool in3d, uint64_t *hash, unsigned *cost)
+{
+    // A candidate which was observed last frame and has not changed since
+    // keeps its hash and cost, so its subtree is not visited. Preprocessing
+    // stamps the node too, so there is nothing to preprocess in it either.
+    if (!in3d && n->subtreeChangeStamp() <= m_observedEpoch) {
+        auto it = m_layerCache.find(n);
+        if (it != m_layerCache.end() && it->second.frame + 1 == m_frameCounter) {
+            LayerCacheEntry *entry = &it->second;
+            *hash = entry->contentHash;
+            *cost = entry->cost;
+            observeCandidate(n, entry, m, entry->contentHash, entry->cost);
+            return true;
+        }
+    }
+
+    // The subtree is observed before prepass, so it has to be up to date.
+    n->preprocess();
+
+    typedef OpenGLProgramBinaryCache H;
+    Node::Type type = n->type();
+    uint64_t h = H::hash(&type, sizeof(type));
+    h = H::hash(&n, sizeof(n), h);
+    unsigned c = 0;
+    bool cacheable = true;
+    mat4 childMatrix = m;
+    bool child3d = in3d;
+
+    switch (type) {
+    case Node::RectangleNodeType: {
+        RectangleNode *rn = static_cast<RectangleNode *>(n);
+        rect2d geometry = rn->geometry();
+        vec4 color = rn->color();
+        h = H::hash(&geometry, sizeof(geometry), h);
+        h = H::hash(&color, sizeof(color), h);
+        c = 1;
+    }   break;
+    case Node::TextureNodeType: {
+        TextureNode *tn = static_cast<TextureNode *>(n);
+        rect2d geometry = tn->geometry();
+        const Texture *texture = tn->texture();
+        GLuint id = texture ? texture->textureId() : 0;
+        h = H::hash(&geometry, sizeof(geometry), h);
+        h = H::hash(&texture, sizeof(texture), h);
+        h = H::hash(&id, sizeof(id), h);
+        c = 1;
+    }   break;
+    case Node::TransformNodeType: {
+        TransformNode *tn = static_cast<TransformNode *>(n);
+        float depth = tn->projectionDepth();
+        h = H::hash(tn->matrix().m, sizeof(tn->matrix().m), h);
+        h = H::hash(&depth, sizeof(depth), h);
+        if (depth > 0)
+            child3d = true;
+        if (!child3d)
+            childMatrix = m * tn->matrix();
+    }   break;
+    case Node::OpacityNodeType: {
+        float opacity = static_cast<OpacityNode *>(n)->opacity();
+        h = H::hash(&opacity, sizeof(opacity), h);
+        c = opacity < 1 ? 8 : 0;
+    }   break;
+    case Node::ColorFilterNodeType: {
+        const mat4 &cm = static_cast<ColorFilterNode *>(n)->colorMatrix();
+        h = H::hash(cm.m, sizeof(cm.m), h);
+        c = cm.isIdentity() ? 0 : 8;
+    }   break;
+    case Node::BlurNodeType: {
+        unsigned radius = static_cast<BlurNode *>(n)->radius();
+        h = H::hash(&radius, sizeof(radius), h);
+        c = radius > 0 ? 16 : 0;
+    }   break;
+    case Node::ShadowNodeType: {
+        ShadowNode *sn = static_cast<ShadowNode *>(n);
+        unsigned radius = sn->radius();
+        vec2 offset = sn->offset();
+        vec4 color = sn->color();
+        h = H::hash(&radius, sizeof(radius), h);
+        h = H::hash(&offset, sizeof(offset), h);
+        h = H::hash(&color, sizeof(color), h);
+        c = 16;
+    }   break;
+    case Node::ClipNodeType: {
+        rect2d clip = static_cast<ClipNode *>(n)->clipRect();
+        h = H::hash(&clip, sizeof(clip), h);
+    }   break;
+    case Node::RectangleListNodeType:
+    case Node::SpriteListNodeType:
+    case Node::ParticleSystemNodeType:
+    case Node::NinePatchNodeType: {
+        RectangleListNode *ln = static_cast<RectangleListNode *>(n);
+        unsigned serial = ln->serial();
+        unsigned size = ln->size();
+        h = H::hash(&serial, sizeof(serial), h);
+        h = H::hash(&size, sizeof(size), h);
+        // Dirty entries have changed since the list was last drawn
+        if (ln->isDirty())
+            h = H::hash(&m_frameCounter, sizeof(m_frameCounter), h);
+        if (type != Node::RectangleListNodeType) {
+            const Texture *texture = static_cast<SpriteListNode *>(ln)->texture();
+            h = H::hash(&texture, sizeof(texture), h);
+        }
+        c = 1 + size / 16;
+    }   break;
+    case Node::RenderNodeType:
+        // Draws whatever it wants, whenever it wants
+        cacheable = false;
+        break;
+    default:
+        break;
+    }
+
+    for (Node *child = n->child(); child; child = child->sibling()) {
+        uint64_t childHash;
+        unsigned childCost;
+        cacheable &= observe(child, childMatrix, child3d, &childHash, &childCost);
+        h = H::hash(&childHash, sizeof(childHash), h);
+        c += childCost;
+    }
+
+    *hash = h;
+    *cost = c;
+
+    if (!cacheable || in3d || !n->child() || c < m_layerPromotionPolicy.minimumCost)
+        return cacheable;
+
+    observeCandidate(n, &m_layerCache[n], m, h, c);
+    return cacheable;
+}
+
+/*!
+    Updates the layer cache \a entry of the candidate \a n, whose subtree
+    has the hash \a hash and costs \a cost to draw under the device
+    transform \a m.
+ */
+inline void OpenGLRenderer::observeCandidate(Node *n, LayerCacheEntry *entry, const mat4 &m, uint64_t hash, unsigned cost)
+{
+    typedef OpenGLProgramBinaryCache H;
+
+    ++m_layerPromotionStats.candidates;
+
+    // Layers are rendered in device space, so the cached texture can be
+    // reused under an integer translation, but not if the rest of the
+    // transform changes.
+    float linear[] = { m.m[0], m.m[1], m.m[4], m.m[5] };
+    uint64_t subtreeHash = H::hash(linear, sizeof(linear), hash);
+    vec2 translation(m.m[3], m.m[7]);
+
+    bool seenLastFrame = entry->frame + 1 == m_frameCounter;
+    entry->frame = m_frameCounter;
+    entry->cost = cost;
+    entry->contentHash = hash;
+    entry->translation = translation;
+
+    if (seenLastFrame && entry->hash == subtreeHash) {
+        ++entry->stableFrames;
+    } else {
+        if (entry->promoted)
+            demoteLayer(entry);
+        entry->hash = subtreeHash;
+        entry->stableFrames = 0;
+    }
+
+    if (entry->texture) {
+        vec2 delta = translation - entry->cachedTranslation;
+        if (delta.x != std::floor(delta.x) || delta.y != std::floor(delta.y)) {
+            demoteLayer(entry);
+            entry->stableFrames = 0;
+        }
+    }
+
+    if (!entry->promoted && entry->stableFrames >= m_layerPromotionPolicy.stableFrames) {
+        entry->promoted = true;
+        ++m_layerPromotionStats.promotions;
+        logd << "promoting subtree " << n << " to a layer, cost=" << cost << std::endl;
+    }
+}
+
+inline OpenGLRenderer::LayerCacheEntry *OpenGLRenderer::promotedLayerFor(Node *n)
+{
+    auto it = m_layerCache.find(n);
+    if (it == m_layerCache.end() || !it->second.promoted || it->second.frame != m_frameCounter)
+        return nullptr;
+    return &it->second;
+}
+
+/*!
+    Adds the element for a promoted subtree. If the texture is already
+    there, it is a single quad. Otherwise the subtree is built as a layer
+    which is kept after this frame.
+ */
+inline void OpenGLRenderer::buildCachedLayer(Node *n, LayerCacheEntry *entry)
+{
+    entry->usedFrame = m_frameCounter;
+
+    Element *e = m_elements + m_elementIndex++;
+    e->node = n;
+    e->layered = true;
+    e->cached = true;
+    e->vboOffset = m_vertexIndex;
+    vec2 *v = m_vertices + m_vertexIndex;
+
+    if (entry->texture) {
+        vec2 delta = entry->translation - entry->cachedTranslation;
+        rect2d box(entry->bounds.tl + delta, entry->bounds.br + delta);
+        e->texture = entry->texture;
+        v[0] = box.tl;
+        v[1] = vec2(box.left(), box.bottom());
+        v[2] = vec2(box.right(), box.top());
+        v[3] = box.br;
+        m_vertexIndex += 4;
+        if (m_layered)
+            m_layerBoundingBox |= box;
+        ++m_layerPromotionStats.cachedDraws;
+        return;
+    }
+
+    bool storedLayered = m_layered;
+    bool storedClipped = m_clipped;
+    rect2d storedBox = m_layerBoundingBox;
+    const float inf = std::numeric_limits<float>::infinity();
+    m_layerBoundingBox = rect2d(inf, inf, -inf, -inf);
+    m_layered = true;
+    m_inCachedLayer = true;
+    // The texture is reused when the surrounding clip moves, so it has to
+    // have all of the content.
+    m_clipped = false;
+
+    build(n);
+
+    m_inCachedLayer = false;
+    m_clipped = storedClipped;
+    m_layered = storedLayered;
+
+    e->groupSize = (m_elements + m_elementIndex) - e - 1;
+    e->vboOffset = m_vertexIndex;
+    v = m_vertices + m_vertexIndex;
+    rect2d box = m_layerBoundingBox.aligned();
+    v[0] = box.tl;
+    v[1] = vec2(box.left(), box.bottom());
+    v[2] = vec2(box.right(), box.top());
+    v[3] = box.br;
+    m_vertexIndex += 4;
+
+    if (storedLayered)
+        storedBox |= m_layerBoundingBox;
+    m_layerBoundingBox = storedBox;
+
+    ++m_layerPromotionStats.layerRenders;
+}
+
+inline void OpenGLRenderer::demoteLayer(LayerCacheEntry *entry)
+{
+    if (entry->texture) {
+        m_texturePool.release(entry->texture);
+        entry->texture = 0;
+    }
+    if (entry->promoted) {
+        entry->promoted = false;
+        ++m_layerPromotionStats.demotions;
+        logd << "demoting layer, cost=" << entry->cost << std::endl;
+    }
+}
+
+inline void OpenGLRenderer::invalidateLayerCache()
+{
+    for (auto &it : m_layerCache) {
+        if (it.second.texture) {
+            m_texturePool.release(it.second.texture);
+            it.second.texture = 0;
+        }
+    }
+}
+
+/*!
+    Called at the end of the frame. Forgets subtrees which were not seen,
+    releases textures which were not drawn and demotes layers until the
+    cache fits in the memory budget.
+ */
+inline void OpenGLRenderer::updateLayerCache()
+{
+    if (!m_layerPromotion) {
+        if (!m_layerCache.empty()) {
+            invalidateLayerCache();
+            m_layerCache.clear();
+            m_layerPromotionStats.promotedLayers = 0;
+            m_layerPromotionStats.bytes = 0;
+        }
+        return;
+    }
+
+    size_t bytes = 0;
+    unsigned promoted = 0;
+    for (auto it = m_layerCache.begin(); it != m_layerCache.end(); ) {
+        LayerCacheEntry &entry = it->second;
+        if (entry.frame != m_frameCounter) {
+            if (entry.texture)
+                m_texturePool.release(entry.texture);
+            it = m_layerCache.erase(it);
+            continue;
+        }
+        // Inside another promoted layer, or culled
+        if (entry.texture && entry.usedFrame != m_frameCounter) {
+            m_texturePool.release(entry.texture);
+            entry.texture = 0;
+        }
+        if (entry.texture)
+            bytes += entry.bounds.width() * entry.bounds.height() * 4;
+        if (entry.promoted)
+            ++promoted;
+        ++it;
+    }
+
+    while (bytes > m_layerPromotionPolicy.memoryBudget) {
+        LayerCacheEntry *cheapest = nullptr;
+        float cheapestValue = 0;
+        for (auto &it : m_layerCache) {
+            LayerCacheEntry &entry = it.second;
+            if (!entry.texture)
+                continue;
+            float value = entry.cost / (entry.bounds.width() * entry.bounds.height());
+            if (!cheapest || value < cheapestValue) {
+                cheapest = &entry;
+                cheapestValue = value;
+            }
+        }
+        assert(cheapest);
+        bytes -= cheapest->bounds.width() * cheapest->bounds.height() * 4;
+        demoteLayer(cheapest);
+        cheapest->stableFrames = 0;
+        --promoted;
+    }
+
+    m_layerPromotionStats.promotedLayers = promoted;
+    m_layerPromotionStats.bytes = bytes;
+}
+
+/*!
+    Records \a texture as minified this frame if the device space quad \a v
+    is smaller than the mipmap threshold of the texture's size.
+ */
+inline void OpenGLRenderer::trackMinification(const Texture *texture, const vec2 *v)
+{
+    if (texture->mipmapMode() != Texture::AutomaticMipmaps || texture->isMipmapped())
+        return;
+
+    vec2 size = texture->size();
+    float sx = (v[2] - v[0]).length() / size.x;
+    float sy = (v[1] - v[0]).length() / size.y;
+    if (std::max(sx, sy) < m_mipmapScaleThreshold)
+        m_minifiedThisFrame.push_back(texture);
+}
+
+/*!
+    Generates mipmaps for textures which have stayed minified for enough
+    frames. Textures which were not drawn minified this frame start over.
+
+    Called at the end of render(), so all textures which are tracked are
+    still alive and referenced by the scene.
+ */
+inline void OpenGLRenderer::updateMipmaps()
+{
+    if (m_minifiedThisFrame.empty()) {
+        m_minifiedTextures.clear();
+        return;
+    }
+
+    std::unordered_map<const Texture *, unsigned> minified;
+    for (const Texture *texture : m_minifiedThisFrame) {
+        if (minified.find(texture) != minified.end())
+            continue;
+        auto it = m_minifiedTextures.find(texture);
+        unsigned frames = (it != m_minifiedTextures.end() ? it->second : 0) + 1;
+        if (frames >= m_mipmapFrameThreshold) {
+            logd << "generating mipmaps for texture=" << texture << ", size=" << texture->size() << std::endl;
+            // Start over if it fails. Textures that can't be mipmapped bail
+            // out early, so trying again later is cheap.
+            if (!texture->generateMipmaps())
+                minified[texture] = 0;
+        } else {
+            minified[texture] = frames;
+        }
+    }
+    m_minifiedTextures.swap(minified);
+    m_minifiedThisFrame.clear();
+}
+
 inline void rengine_create_texture(int id, int w, int h)
 {
     glBindTexture(GL_TEXTURE_2D, id);
@@ -737,8 +1831,10 @@ inline void OpenGLRenderer::renderToLayer(Element *e)
     m_layered = true;
 
 
-    BlurNode *blurNode = BlurNode::from(e->node);
-    ShadowNode *shadowNode = ShadowNode::from(e->node);
+    // A promoted blur or shadow node has its own layered element inside
+    // the cached one.
+    BlurNode *blurNode = e->cached ? nullptr : BlurNode::from(e->node);
+    ShadowNode *shadowNode = e->cached ? nullptr : ShadowNode::from(e->node);
 
     if (blurNode || shadowNode) {
         devRect.tl -= 1.0f;
@@ -756,6 +1852,18 @@ inline void OpenGLRenderer::renderToLayer(Element *e)
     glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, e->texture, 0);
 
+    // Layers only get a stencil buffer when there are clips which need it.
+    // Clips are only active while rendering, and layers are all rendered
+    // before that, so there is no outer clip state to deal with here.
+    assert(m_clipStack.empty());
+    GLuint stencilBuffer = 0;
+    if (m_numStencilClips > 0) {
+        glGenRenderbuffers(1, &stencilBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, stencilBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_STENCIL_INDEX8, devRect.width(), devRect.height());
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, stencilBuffer);
+    }
+
 #ifndef NDEBUG
     // Only enabled in debug mode because it syncs the GL stack and takes forever..
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
@@ -781,6 +1889,11 @@ inline void OpenGLRenderer::renderToLayer(Element *e)
     glClear(GL_COLOR_BUFFER_BIT);
     render(e + 1, e + e->groupSize + 1);
 
+    if (stencilBuffer) {
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, 0);
+        glDeleteRenderbuffers(1, &stencilBuffer);
+    }
+
     if (blurNode || shadowNode) {
         int tmpTex = e->texture;
         e->texture = m_texturePool.acquire();
@@ -817,6 +1930,13 @@ inline void OpenGLRenderer::renderToLayer(Element *e)
     m_matrixState = UpdateAllPrograms;
     m_surfaceSize = storedSize;
 
+    if (e->cached) {
+        LayerCacheEntry &entry = m_layerCache[e->node];
+        entry.texture = e->texture;
+        entry.bounds = devRect;
+        entry.cachedTranslation = entry.translation;
+    }
+
     // std::cout << space << "- layer is completed..." << std::endl;
 }
 
@@ -835,7 +1955,8 @@ inline void OpenGLRenderer::render(Element *first, Element *last)
         Element *e = first;
         // std::cout << space << "- checking layering for " << e << std::endl;
         while (e < last) {
-            if (e->layered) {
+            // Promoted layers which already have their texture have nothing to render
+            if (e->layered && !e->texture) {
                 // std::cout << space << "- needs layering: " << e << std::endl;
                 // ++recursion;
                 renderToLayer(e);
@@ -850,15 +1971,24 @@ inline void OpenGLRenderer::render(Element *first, Element *last)
     //
     glViewport(0, 0, m_surfaceSize.x, m_surfaceSize.y);
 
+    const size_t clipDepth = m_clipStack.size();
+
     Element *e = first;
     while (e < last) {
         // std::cout << space << "- render(normal) " << e << " node=(" << e->node << ") " << (e->completed ? "*done*" : "") << std::endl;
+        while (m_clipStack.size() > clipDepth && e >= m_clipStack.back().end)
+            popClip();
+
         if (e->completed) {
             ++e;
             continue;
         }
 
-        if (e->node->type() == Node::RectangleNodeType) {
+        if (e->cached) {
+            // Owned by the layer cache, so not released
+            if (e->texture)
+                drawTextureQuad(e->vboOffset, e->texture);
+        } else if (e->node->type() == Node::RectangleNodeType) {
             // std::cout << space << "---> rect quad, vbo=" << e->vboOffset
             //      << " " << m_proj * m_vertices[e->vboOffset] << " " << m_proj * m_vertices[e->vboOffset+3] << std::endl;
             drawColorQuad(e->vboOffset, static_cast<RectangleNode *>(e->node)->color());
@@ -866,6 +1996,11 @@ inline void OpenGLRenderer::render(Element *first, Element *last)
             // std::cout << space << "---> texture quad, vbo=" << e->vboOffset << std::endl;
             const Texture *texture = static_cast<TextureNode *>(e->node)->texture();
             drawTextureQuad(e->vboOffset, texture->textureId(), 1.0f, texture->format());
+        } else if (e->node->type() == Node::RectangleListNodeType
+                   || e->node->type() == Node::SpriteListNodeType
+                   || e->node->type() == Node::ParticleSystemNodeType
+                   || e->node->type() == Node::NinePatchNodeType) {
+            drawListNode(e);
         } else if (e->node->type() == Node::OpacityNodeType && e->layered && e->texture) {
             // std::cout << space << "---> layered texture quad, vbo=" << e->vboOffset << " texture=" << e->texture << std::endl;
             drawTextureQuad(e->vboOffset, e->texture, static_cast<OpacityNode *>(e->node)->opacity());
@@ -889,14 +2024,14 @@ inline void OpenGLRenderer::render(Element *first, Element *last)
             vec2 renderSize = boundingRectFor(e->vboOffset + 8).size();
             mat4 storedProj = m_proj;
             m_proj = m_proj * mat4::translate2D(std::round(shadowNode->offset().x), std::round(shadowNode->offset().y));
-            m_matrixState |= UpdateShadowProgram;
             // std::cout << " - radius: " << shadowNode->radius() << " textureSize=" << textureSize << ", renderSize=" << renderSize << std::endl;
             drawShadowQuad(e->vboOffset + 8, e->texture, shadowNode->radius(), renderSize, textureSize, vec2(0, 1/renderSize.y), shadowNode->color());
             m_proj = storedProj;
-            m_matrixState |= UpdateShadowProgram;
             drawTextureQuad(e->vboOffset + 12, e->sourceTexture);
             m_texturePool.release(e->texture);
             m_texturePool.release(e->sourceTexture);
+        } else if (e->node->type() == Node::ClipNodeType) {
+            pushClip(e);
         } else if (e->projection) {
             std::sort(e + 1, e + e->groupSize + 1);
             // std::cout << space << "---> projection, sorting range: " << (e+1) << " -> " << (e+e->groupSize) << std::endl;
@@ -913,6 +2048,128 @@ inline void OpenGLRenderer::render(Element *first, Element *last)
         e->completed = true;
         ++e;
     }
+
+    while (m_clipStack.size() > clipDepth)
+        popClip();
+}
+
+inline bool OpenGLRenderer::isAxisAligned(const vec2 *v)
+{
+    // Either unrotated or rotated by a multiple of 90 degrees, allowing for
+    // the rounding errors of sin/cos.
+    const float e = 0.001f;
+    return (std::abs(v[0].x - v[1].x) < e && std::abs(v[0].y - v[2].y) < e)
+        || (std::abs(v[0].y - v[1].y) < e && std::abs(v[0].x - v[2].x) < e);
+}
+
+/*!
+    Returns true if the device space quad \a v lies completely outside the
+    current clip during build().
+ */
+inline bool OpenGLRenderer::isCulled(const vec2 *v) const
+{
+    assert(m_clipped);
+    const float inf = std::numeric_limits<float>::infinity();
+    rect2d box(inf, inf, -inf, -inf);
+    for (int i=0; i<4; ++i)
+        box |= v[i];
+    // Degenerate quads have an empty box, so compare the edges directly.
+    return box.br.x <= m_clipBoundingBox.tl.x || box.tl.x >= m_clipBoundingBox.br.x
+        || box.br.y <= m_clipBoundingBox.tl.y || box.tl.y >= m_clipBoundingBox.br.y;
+}
+
+/*!
+    Maps the quad at \a vertexOffset into the viewport of the current
+    render target, rounded to whole pixels, for use with glScissor.
+ */
+inline rect2d OpenGLRenderer::scissorRectFor(unsigned vertexOffset) const
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    rect2d box(inf, inf, -inf, -inf);
+    for (int i=0; i<4; ++i) {
+        vec2 ndc = m_proj * m_vertices[vertexOffset + i];
+        box |= (ndc + 1.0f) * 0.5f * m_surfaceSize;
+    }
+    return rect2d(std::round(box.tl.x), std::round(box.tl.y), std::round(box.br.x), std::round(box.br.y));
+}
+
+inline void OpenGLRenderer::pushClip(Element *e)
+{
+    ClipState clip;
+    clip.end = e + e->groupSize + 1;
+    clip.vboOffset = e->vboOffset;
+    clip.scissor = scissorRectFor(e->vboOffset);
+    if (!m_clipStack.empty())
+        clip.scissor = clip.scissor & m_clipStack.back().scissor;
+    clip.stencil = !isAxisAligned(m_vertices + e->vboOffset);
+    m_clipStack.push_back(clip);
+
+    // The stencil shape is also bounded by the scissor rect, so set that
+    // first.
+    applyClipState();
+
+    if (clip.stencil) {
+        if (m_stencilDepth == 0) {
+            glEnable(GL_STENCIL_TEST);
+            glClearStencil(0);
+            glClear(GL_STENCIL_BUFFER_BIT);
+        }
+        writeStencil(clip.vboOffset, GL_INCR);
+        ++m_stencilDepth;
+        applyClipState();
+    }
+}
+
+inline void OpenGLRenderer::popClip()
+{
+    assert(!m_clipStack.empty());
+    const ClipState &clip = m_clipStack.back();
+    if (clip.stencil) {
+        // The last one is cleared before it is used again
+        if (m_stencilDepth > 1)
+            writeStencil(clip.vboOffset, GL_DECR);
+        --m_stencilDepth;
+    }
+    m_clipStack.pop_back();
+    applyClipState();
+}
+
+/*!
+    Applies \a op to the stencil value of the pixels covered by the quad at
+    \a vertexOffset which are inside the current stencil clip.
+ */
+inline void OpenGLRenderer::writeStencil(unsigned vertexOffset, GLenum op)
+{
+    glColorMask(false, false, false, false);
+    glStencilFunc(GL_EQUAL, m_stencilDepth, 0xff);
+    glStencilOp(GL_KEEP, GL_KEEP, op);
+    drawColorQuad(vertexOffset, vec4(1));
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    glColorMask(true, true, true, true);
+}
+
+inline void OpenGLRenderer::applyClipState()
+{
+    if (m_clipStack.empty()) {
+        glDisable(GL_SCISSOR_TEST);
+        glDisable(GL_STENCIL_TEST);
+        return;
+    }
+
+    const rect2d &r = m_clipStack.back().scissor;
+    glEnable(GL_SCISSOR_TEST);
+    if (r.isEmpty())
+        glScissor(0, 0, 0, 0);
+    else
+        glScissor(r.left(), r.top(), r.width(), r.height());
+
+    if (m_stencilDepth > 0) {
+        glEnable(GL_STENCIL_TEST);
+        glStencilFunc(GL_EQUAL, m_stencilDepth, 0xff);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    } else {
+        glDisable(GL_STENCIL_TEST);
+    }
 }
 
 inline void OpenGLRenderer::setDefaultOpenGLState()
@@ -926,7 +2183,7 @@ inline void OpenGLRenderer::setDefaultOpenGLState()
 
     // Set our default GL state..
     glDisable(GL_DEPTH_TEST);
-    glDisable(GL_STENCIL_TEST);
+    applyClipState();
     glDepthMask(false);
     glEnable(GL_BLEND);
     glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
@@ -940,10 +2197,17 @@ inline bool OpenGLRenderer::render()
         return false;
     }
 
-    vec4 c = fillColor();
+    // Render targets start out transparent
+    vec4 c = m_renderTarget ? vec4() : fillColor();
     glClearColor(c.x, c.y, c.z, c.w);
     glClear(GL_COLOR_BUFFER_BIT);
 
+    // Rendering into a render target is not part of the frame sequence, so
+    // it must not disturb the caches which are maintained per frame.
+    bool storedLayerPromotion = m_layerPromotion;
+    if (m_renderTarget)
+        m_layerPromotion = false;
+
     logd << std::endl;
 
     m_numLayeredNodes = 0;
@@ -952,20 +2216,44 @@ inline bool OpenGLRenderer::render()
     m_numTransformNodes = 0;
     m_numTransformNodesWith3d = 0;
     m_numRenderNodes = 0;
+    m_numListNodes = 0;
+    m_numClipNodes = 0;
+    m_numStencilClips = 0;
     m_additionalQuads = 0;
     m_vertexIndex = 0;
     m_elementIndex = 0;
+    m_requiredPrograms = 0;
+
+    m_layerPromotionStats.candidates = 0;
+    m_layerPromotionStats.cachedDraws = 0;
+    m_layerPromotionStats.layerRenders = 0;
+    if (m_layerPromotion) {
+        uint64_t hash;
+        unsigned cost;
+        unsigned epoch = Node::advanceChangeEpoch();
+        observe(sceneRoot(), mat4(), false, &hash, &cost);
+        m_observedEpoch = epoch;
+    }
+
     prepass(sceneRoot());
 
+    if (unsigned missing = m_requiredPrograms & ~m_compiledPrograms) {
+        for (unsigned bit = UpdateSolidProgram; bit <= UpdateSpriteListProgram; bit <<= 1) {
+            if (missing & bit)
+                compileProgram((ProgramUpdate) bit);
+        }
+    }
+
     unsigned vertexCount = (m_numTextureNodes
                             + m_numLayeredNodes
                             + m_numRectangleNodes
+                            + m_numClipNodes
                             + m_additionalQuads) * 4;
-    if (vertexCount == 0)
+    if (vertexCount == 0 && m_numListNodes == 0)
         return true;
 
     m_vertices = (vec2 *) alloca(vertexCount * sizeof(vec2));
-    unsigned elementCount = (m_numLayeredNodes + m_numTextureNodes + m_numRectangleNodes + m_numTransformNodesWith3d + m_numRenderNodes);
+    unsigned elementCount = (m_numLayeredNodes + m_numTextureNodes + m_numRectangleNodes + m_numTransformNodesWith3d + m_numRenderNodes + m_numListNodes + m_numClipNodes);
     m_elements = (Element *) alloca(elementCount * sizeof(Element));
     memset(m_elements, 0, elementCount * sizeof(Element));
     // std::cout << "render: " << m_numTextureNodes << " textures, "
@@ -978,7 +2266,11 @@ inline bool OpenGLRenderer::render()
     //                    << std::endl;
     build(sceneRoot());
     assert(elementCount > 0);
-    assert(m_elementIndex == elementCount);
+    // Clipped nodes are culled, so we may end up with less than we counted
+    assert(m_elementIndex <= elementCount);
+    assert(m_vertexIndex <= vertexCount);
+    elementCount = m_elementIndex;
+    vertexCount = m_vertexIndex;
     // for (unsigned i=0; i<m_elementIndex; ++i) {
     //     const Element &e = m_elements[i];
     //     std::cout << " " << std::setw(5) << i << ": " << "element=" << &e << " node=" << e.node << " " << e.node->type() << " "
@@ -990,22 +2282,47 @@ inline bool OpenGLRenderer::render()
     // for (unsigned i=0; i<m_vertexIndex; ++i)
     //     std::cout << "vertex[" << std::setw(5) << i << "]=" << m_vertices[i] << std::endl;
 
-    setDefaultOpenGLState();
+    // Everything may have been culled
+    if (elementCount > 0) {
+        setDefaultOpenGLState();
 
-    // setDefaultOpenGLState will leave m_vertexBuffer bound, so we just upload into it..
-    glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(vec2), m_vertices, GL_STATIC_DRAW);
+        // setDefaultOpenGLState will leave m_vertexBuffer bound, so we just upload into it..
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(vec2), m_vertices, GL_STATIC_DRAW);
+
+        if (m_renderTarget) {
+            // Flipped, like layers, so the texture's first row is the top
+            m_surfaceSize = m_renderTarget->size();
+            m_proj = mat4::scale2D(1.0, -1.0)
+                     * mat4::translate2D(-1.0, 1.0)
+                     * mat4::scale2D(2.0f / m_surfaceSize.x, -2.0f / m_surfaceSize.y);
+        } else {
+            m_surfaceSize = targetSurface()->size();
+            m_proj = mat4::translate2D(-1.0, 1.0)
+                     * mat4::scale2D(2.0f / m_surfaceSize.x, -2.0f / m_surfaceSize.y);
+        }
 
-    m_surfaceSize = targetSurface()->size();
-    m_proj = mat4::translate2D(-1.0, 1.0)
-             * mat4::scale2D(2.0f / m_surfaceSize.x, -2.0f / m_surfaceSize.y);
+        assert(!m_layered);
+        assert(!m_render3d);
+        assert(!m_clipped);
+        render(m_elements, m_elements + elementCount);
+        assert(m_clipStack.empty());
+        assert(m_stencilDepth == 0);
 
-    assert(!m_layered);
-    assert(!m_render3d);
-    render(m_elements, m_elements + elementCount);
+        activateShader(0);
+    }
 
-    activateShader(0);
+    if (m_renderTarget) {
+        m_minifiedThisFrame.clear();
+        m_layerPromotion = storedLayerPromotion;
+    } else {
+        updateMipmaps();
+        updateLayerCache();
+        releaseUnusedListBuffers();
+        ++m_frameCounter;
+    }
+    m_listStates.clear();
 
-    assert(m_fbo == 0);
+    assert(m_fbo == m_renderTargetFbo);
     m_vertices = 0;
     m_elements = 0;
 
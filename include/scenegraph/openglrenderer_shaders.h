@@ -27,6 +27,8 @@
 
 #include "opengl.h"
 
+#include <string>
+
 inline const char *openglrenderer_vsh_solid() { return RENGINE_GLSL(
    attribute highp vec2 aV;
    uniform highp mat4 m;
@@ -53,30 +55,26 @@ inline const char *openglrenderer_vsh_texture() { return RENGINE_GLSL(
     }
 ); }
 
-inline const char *openglrenderer_fsh_texture() { return RENGINE_GLSL(
-    uniform lowp sampler2D t;
-    varying highp vec2 vT;
-    void main() {
-        gl_FragColor = texture2D(t, vT);
-    }
-); }
-
-inline const char *openglrenderer_fsh_texture_bgra() { return RENGINE_GLSL(
-    uniform lowp sampler2D t;
-    varying highp vec2 vT;
-    void main() {
-        gl_FragColor = texture2D(t, vT).zyxw;
-    }
-); }
-
-inline const char *openglrenderer_fsh_texture_alpha() { return RENGINE_GLSL(
+// Specialized with RENGINE_BGR and RENGINE_OPACITY, see
+// openglrenderer_specialize().
+inline const char *openglrenderer_fsh_texture() { return RENGINE_GLSL_PREAMBLE R"(
     uniform lowp sampler2D t;
+#ifdef RENGINE_OPACITY
     uniform lowp float alpha;
+#endif
     varying highp vec2 vT;
     void main() {
-        gl_FragColor = texture2D(t, vT) * alpha;
+#ifdef RENGINE_BGR
+        lowp vec4 c = texture2D(t, vT).zyxw;
+#else
+        lowp vec4 c = texture2D(t, vT);
+#endif
+#ifdef RENGINE_OPACITY
+        c *= alpha;
+#endif
+        gl_FragColor = c;
     }
-); }
+)"; }
 
 inline const char *openglrenderer_fsh_texture_colorfilter() { return RENGINE_GLSL(
     uniform lowp sampler2D t;
@@ -87,16 +85,15 @@ inline const char *openglrenderer_fsh_texture_colorfilter() { return RENGINE_GLS
     }
 ); }
 
-// ### Naive implementation with a lot of room for improvement...
-//
-// Compatibility wise, there are several older and lower-end chips that do not
-// support using a uniform in a loop condition. This is not mandated by the
-// GLSL spec, so it won't work everywhere.
+// The blur and shadow programs are specialized with a constant
+// RENGINE_RADIUS_BUCKET, see openglrenderer_specialize(). The loop runs to
+// the bucket size and skips the pairs beyond the actual radius with a uniform
+// branch. This keeps the loop condition constant, which older and lower-end
+// chips require and which lets the compiler unroll it.
 inline const char *openglrenderer_vsh_blur() { return RENGINE_GLSL(
     attribute highp vec2 aV;
     attribute highp vec2 aT;
     uniform highp mat4 m;
-    uniform int radius;
     uniform highp vec4 dims;
     varying highp vec2 vT;
     void main() {
@@ -108,56 +105,120 @@ inline const char *openglrenderer_vsh_blur() { return RENGINE_GLSL(
     }
 ); }
 
-inline const char *openglrenderer_fsh_blur() { return RENGINE_GLSL(
+// Specialized with RENGINE_RADIUS_BUCKET and RENGINE_SHADOW, in which case
+// only the alpha channel is blurred and the result is tinted by 'color'.
+inline const char *openglrenderer_fsh_blur() { return RENGINE_GLSL_PREAMBLE R"(
     uniform lowp sampler2D t;
-    uniform highp vec4 dims;
     uniform highp vec2 step;
     uniform highp float sigma;
     uniform int radius;
+#ifdef RENGINE_SHADOW
+    uniform highp vec4 color;
+#endif
     varying highp vec2 vT;
     highp float gauss(float x) { return exp(-(x*x)/sigma); }
     void main() {
         highp float r = float(radius);
         highp float weights = 0.5 * gauss(r);
-        highp vec4 result = weights * texture2D(t, vT - float(radius) * step);
-        for (int i=-radius+1; i<=radius; i+=2) {
-            highp float p1 = float(i);
-            highp float w1 = gauss(p1);
-            highp float p2 = float(i+1);
-            highp float w2 = gauss(p2);
-            highp float w = w1 + w2;
-            highp float p = (p1 * w1 + p2 * w2) / w;
-            result += w * texture2D(t, vT + p * step);
-            weights += w;
+        highp vec4 result = weights * texture2D(t, vT - r * step);
+        for (int k=0; k<RENGINE_RADIUS_BUCKET; ++k) {
+            if (k < radius) {
+                highp float p1 = float(2 * k + 1) - r;
+                highp float w1 = gauss(p1);
+                highp float p2 = p1 + 1.0;
+                highp float w2 = gauss(p2);
+                highp float w = w1 + w2;
+                highp float p = (p1 * w1 + p2 * w2) / w;
+                result += w * texture2D(t, vT + p * step);
+                weights += w;
+            }
         }
+#ifdef RENGINE_SHADOW
+        gl_FragColor = color * (result.a / weights);
+#else
         gl_FragColor = result / weights;
+#endif
     }
-); }
+)"; }
+
+// Used by RectangleListNode and SpriteListNode, specialized with
+// RENGINE_TEXTURED for the latter. The positions are in the node's local
+// coordinate system. 'm3d' and 'farPlane' apply a 3D projection the same way
+// as OpenGLRenderer::projectQuad(), when farPlane is non-zero.
+inline const char *openglrenderer_vsh_list() { return RENGINE_GLSL_PREAMBLE R"(
+    attribute highp vec2 aV;
+#ifdef RENGINE_TEXTURED
+    attribute highp vec2 aT;
+    varying highp vec2 vT;
+#endif
+    attribute lowp vec4 aC;
+    uniform highp mat4 m;
+    uniform highp mat4 m3d;
+    uniform highp float farPlane;
+    varying lowp vec4 vC;
+    void main() {
+        highp vec4 p = m3d * vec4(aV, 0, 1);
+        if (farPlane > 0.0)
+            p.xy /= (farPlane - p.z) / farPlane;
+        gl_Position = m * vec4(p.xy, 0, 1);
+#ifdef RENGINE_TEXTURED
+        vT = aT;
+#endif
+        vC = aC;
+    }
+)"; }
 
-inline const char *openglrenderer_fsh_shadow() { return RENGINE_GLSL(
+inline const char *openglrenderer_fsh_list() { return RENGINE_GLSL_PREAMBLE R"(
+#ifdef RENGINE_TEXTURED
     uniform lowp sampler2D t;
-    uniform highp vec4 color;
-    uniform highp vec4 dims;
-    uniform highp vec2 step;
-    uniform highp float sigma;
-    uniform int radius;
     varying highp vec2 vT;
-    highp float gauss(float x) { return exp(-(x*x)/sigma); }
+#endif
+    varying lowp vec4 vC;
     void main() {
-        highp float r = float(radius);
-        highp float weights = 0.5 * gauss(r);
-        highp float result = weights * texture2D(t, vT - float(radius) * step).a;
-        for (int i=-radius+1; i<=radius; i+=2) {
-            highp float p1 = float(i);
-            highp float w1 = gauss(p1);
-            highp float p2 = float(i+1);
-            highp float w2 = gauss(p2);
-            highp float w = w1 + w2;
-            highp float p = (p1 * w1 + p2 * w2) / w;
-            result += w * texture2D(t, vT + p * step).a;
-            weights += w;
-        }
-        gl_FragColor = color * (result / weights);
+#ifdef RENGINE_TEXTURED
+        gl_FragColor = texture2D(t, vT) * vC;
+#else
+        gl_FragColor = vC;
+#endif
     }
-); }
+)"; }
+
+enum OpenGLShaderPermutation {
+    PermutationBgr      = 0x1,
+    PermutationOpacity  = 0x2,
+    PermutationShadow   = 0x4,
+    PermutationTextured = 0x8
+};
 
+/*!
+    Returns the size of the radius bucket used for blurs of \a radius, which
+    is the next power of two.
+ */
+inline int openglrenderer_radiusBucket(int radius)
+{
+    int bucket = 1;
+    while (bucket < radius)
+        bucket *= 2;
+    return bucket;
+}
+
+/*!
+    Returns \a source with the defines for the OpenGLShaderPermutation
+    values in \a flags and, when \a radius is non-zero, the radius bucket
+    prepended.
+ */
+inline std::string openglrenderer_specialize(const char *source, unsigned flags, int radius = 0)
+{
+    std::string result;
+    if (flags & PermutationBgr)
+        result += "#define RENGINE_BGR\n";
+    if (flags & PermutationOpacity)
+        result += "#define RENGINE_OPACITY\n";
+    if (flags & PermutationShadow)
+        result += "#define RENGINE_SHADOW\n";
+    if (flags & PermutationTextured)
+        result += "#define RENGINE_TEXTURED\n";
+    if (radius > 0)
+        result += "#define RENGINE_RADIUS_BUCKET " + std::to_string(openglrenderer_radiusBucket(radius)) + "\n";
+    return result + source;
+}
@@ -56,10 +56,27 @@ public:
         return id;
     }
 
-    void initialize(const char *vsh, const char *fsh, const std::vector<const char *> &attrs)
+    /*!
+        Compiles and links the program from \a vsh and \a fsh, binding \a
+        attrs to attribute locations in order. If \a cache is given, the
+        program is loaded from it when possible and stored in it otherwise.
+     */
+    void initialize(const char *vsh, const char *fsh, const std::vector<const char *> &attrs, OpenGLProgramBinaryCache *cache = nullptr)
     {
         assert(m_id == 0);
 
+        m_attributeCount = attrs.size();
+
+        if (cache) {
+            m_id = glCreateProgram();
+            for (unsigned i=0; i<attrs.size(); ++i)
+                glBindAttribLocation(m_id, i, attrs.at(i));
+            if (cache->load(m_id, vsh, fsh, attrs))
+                return;
+            glDeleteProgram(m_id);
+            m_id = 0;
+        }
+
         GLuint vid = createShader(vsh, GL_VERTEX_SHADER);
         GLuint fid = createShader(fsh, GL_FRAGMENT_SHADER);
         assert(vid);
@@ -93,7 +110,8 @@ public:
 
         assert(glGetError() == GL_NO_ERROR);
 
-        m_attributeCount = attrs.size();
+        if (cache)
+            cache->store(m_id, vsh, fsh, attrs);
     }
 
     int attributeCount() const { return m_attributeCount; }
@@ -33,6 +33,8 @@ public:
     OpenGLTexture()
         : m_id(0)
         , m_format(RGBA_32)
+        , m_mipmapMode(NoMipmaps)
+        , m_mipmapped(false)
     {
     }
 
@@ -57,22 +59,82 @@ public:
      */
     GLuint textureId() const { return m_id; }
 
+    /*!
+        Sets how mipmaps are created for this texture. The mode takes effect
+        on the next call to upload(). The default is NoMipmaps, so textures
+        are only mipmapped when asked for.
+     */
+    MipmapMode mipmapMode() const override { return m_mipmapMode; }
+    void setMipmapMode(MipmapMode mode) { m_mipmapMode = mode; }
+
+    bool isMipmapped() const override { return m_mipmapped; }
+
     void upload(int width, int height, void *data)
     {
         if (m_id == 0) {
             glGenTextures(1, &m_id);
             glBindTexture(GL_TEXTURE_2D, m_id);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         } else {
             glBindTexture(GL_TEXTURE_2D, m_id);
         }
         m_size = vec2(width, height);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+
+        // A new base level invalidates whatever mipmap chain we had..
+        m_mipmapped = false;
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+        if (m_mipmapMode == GpuMipmaps)
+            generateMipmaps();
+    }
+
+    /*!
+        Uploads a single mipmap \a level. Level 0 is the base level which is
+        normally set through upload(). Once all levels down to 1x1 have been
+        uploaded, the texture switches to trilinear filtering.
+
+        This is used with CpuMipmaps, where the levels are typically computed
+        by a MipmapJob on the WorkQueue.
+     */
+    void uploadMipmapLevel(int level, int width, int height, const void *data)
+    {
+        assert(m_id);
+        assert(level > 0);
+        glBindTexture(GL_TEXTURE_2D, m_id);
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+        if (width == 1 && height == 1) {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            m_mipmapped = true;
+        }
+    }
+
+    bool generateMipmaps() const override
+    {
+        if (m_mipmapped)
+            return true;
+        if (m_id == 0 || m_mipmapMode == NoMipmaps || m_mipmapMode == CpuMipmaps)
+            return false;
+
+#ifndef RENGINE_OPENGL_DESKTOP
+        // Plain OpenGL ES 2.0 can only mipmap power-of-two textures
+        if (!isPowerOfTwo(width()) || !isPowerOfTwo(height()))
+            return false;
+#endif
+
+        glBindTexture(GL_TEXTURE_2D, m_id);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        m_mipmapped = true;
+        return true;
     }
 
 private:
+    static bool isPowerOfTwo(unsigned v) { return v && (v & (v - 1)) == 0; }
+
     GLuint m_id;
     Format m_format;
+    MipmapMode m_mipmapMode;
+    mutable bool m_mipmapped;
     vec2 m_size;
 
 };
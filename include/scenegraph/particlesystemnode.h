@@ -0,0 +1,283 @@
+/*
+    Copyright (c) 2016, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    The ParticleSystemNode simulates and draws a cloud of particles as a
+    single node.
+
+    Particles are spawned by an emitter at emissionRate() particles per
+    second at random positions inside emitterRect(). Each particle gets a
+    random lifetime and initial velocity from the configured ranges and is
+    accelerated by acceleration() for the rest of its life. Size and color
+    are interpolated from their start to their end values over the
+    particle's lifetime.
+
+    The simulation state is kept in flat arrays, one per component, and
+    advance() updates them in tight loops without branches which the
+    compiler can vectorize. The result is written into the SpriteListNode
+    arrays, so all particles are drawn with a single draw call, in the
+    node's place in the paint order. Particles are drawn with texture() if
+    set, or as solid squares if not.
+
+    Call advance() once per frame with the time since the last one, or
+    start an Animation_ParticleSystemNode to have the AnimationManager do it.
+ */
+class ParticleSystemNode : public SpriteListNode
+{
+public:
+    RENGINE_ALLOCATION_POOL_DECLARATION(ParticleSystemNode, rengine_ParticleSystemNode);
+
+    static ParticleSystemNode *create(unsigned maxParticles, const Texture *texture = nullptr) {
+        auto node = create();
+        node->setMaxParticles(maxParticles);
+        node->setTexture(texture);
+        return node;
+    }
+
+    unsigned maxParticles() const { return m_maxParticles; }
+    void setMaxParticles(unsigned count);
+
+    unsigned particleCount() const { return (unsigned) m_x.size(); }
+
+    rect2d emitterRect() const { return m_emitterRect; }
+    void setEmitterRect(rect2d rect) { m_emitterRect = rect; }
+
+    float emissionRate() const { return m_emissionRate; }
+    void setEmissionRate(float particlesPerSecond) { m_emissionRate = particlesPerSecond; }
+
+    void setLifetime(float min, float max) { m_lifetimeMin = min; m_lifetimeMax = max; }
+    float lifetimeMin() const { return m_lifetimeMin; }
+    float lifetimeMax() const { return m_lifetimeMax; }
+
+    void setVelocity(vec2 min, vec2 max) { m_velocityMin = min; m_velocityMax = max; }
+    vec2 velocityMin() const { return m_velocityMin; }
+    vec2 velocityMax() const { return m_velocityMax; }
+
+    vec2 acceleration() const { return m_acceleration; }
+    void setAcceleration(vec2 acceleration) { m_acceleration = acceleration; }
+
+    void setSize(float start, float end) { m_sizeStart = start; m_sizeEnd = end; }
+    float sizeStart() const { return m_sizeStart; }
+    float sizeEnd() const { return m_sizeEnd; }
+
+    void setColor(vec4 start, vec4 end) { m_colorStart = start; m_colorEnd = end; }
+    vec4 colorStart() const { return m_colorStart; }
+    vec4 colorEnd() const { return m_colorEnd; }
+
+    /*!
+        Seeds the random number generator, so a simulation can be repeated.
+     */
+    void setSeed(unsigned seed) { m_random = seed ? seed : 1; }
+
+    /*!
+        Advances the simulation by \a seconds: ages and moves the live
+        particles, removes the expired ones and emits new ones.
+     */
+    void advance(float seconds);
+
+    /*!
+        Removes all particles.
+     */
+    void clear();
+
+    RENGINE_NODE_DEFINE_FROM_FUNCTION(ParticleSystemNode, ParticleSystemNodeType);
+
+protected:
+    ParticleSystemNode()
+        : SpriteListNode(ParticleSystemNodeType)
+    {
+    }
+
+    float random(float min, float max) {
+        // xorshift32
+        m_random ^= m_random << 13;
+        m_random ^= m_random >> 17;
+        m_random ^= m_random << 5;
+        return min + (max - min) * ((m_random >> 8) * (1.0f / 16777216.0f));
+    }
+
+    void emit(unsigned count);
+    void removeExpired();
+    void updateSprites();
+
+    std::vector<float> m_x;
+    std::vector<float> m_y;
+    std::vector<float> m_vx;
+    std::vector<float> m_vy;
+    std::vector<float> m_age;
+    std::vector<float> m_life;
+
+    rect2d m_emitterRect;
+    vec2 m_velocityMin;
+    vec2 m_velocityMax;
+    vec2 m_acceleration;
+    vec4 m_colorStart = vec4(1, 1, 1, 1);
+    vec4 m_colorEnd = vec4(1, 1, 1, 0);
+    float m_emissionRate = 10.0f;
+    float m_emissionDebt = 0.0f;
+    float m_lifetimeMin = 1.0f;
+    float m_lifetimeMax = 1.0f;
+    float m_sizeStart = 8.0f;
+    float m_sizeEnd = 8.0f;
+    unsigned m_maxParticles = 0;
+    unsigned m_random = 0x2545f491;
+};
+
+inline void ParticleSystemNode::setMaxParticles(unsigned count)
+{
+    m_maxParticles = count;
+    m_x.reserve(count);
+    m_y.reserve(count);
+    m_vx.reserve(count);
+    m_vy.reserve(count);
+    m_age.reserve(count);
+    m_life.reserve(count);
+    if (particleCount() > count) {
+        m_x.resize(count);
+        m_y.resize(count);
+        m_vx.resize(count);
+        m_vy.resize(count);
+        m_age.resize(count);
+        m_life.resize(count);
+        updateSprites();
+    }
+}
+
+inline void ParticleSystemNode::clear()
+{
+    m_x.clear();
+    m_y.clear();
+    m_vx.clear();
+    m_vy.clear();
+    m_age.clear();
+    m_life.clear();
+    m_emissionDebt = 0;
+    updateSprites();
+}
+
+inline void ParticleSystemNode::advance(float seconds)
+{
+    const unsigned count = particleCount();
+    float *x = m_x.data();
+    float *y = m_y.data();
+    float *vx = m_vx.data();
+    float *vy = m_vy.data();
+    float *age = m_age.data();
+    const float ax = m_acceleration.x * seconds;
+    const float ay = m_acceleration.y * seconds;
+
+    for (unsigned i=0; i<count; ++i) {
+        vx[i] += ax;
+        vy[i] += ay;
+        x[i] += vx[i] * seconds;
+        y[i] += vy[i] * seconds;
+        age[i] += seconds;
+    }
+
+    removeExpired();
+
+    m_emissionDebt += m_emissionRate * seconds;
+    unsigned toEmit = (unsigned) m_emissionDebt;
+    m_emissionDebt -= toEmit;
+    emit(std::min(toEmit, m_maxParticles - particleCount()));
+
+    updateSprites();
+}
+
+inline void ParticleSystemNode::removeExpired()
+{
+    // Compact the live particles to the front, keeping their order so the
+    // oldest stay at the bottom of the paint order.
+    unsigned count = particleCount();
+    unsigned live = 0;
+    for (unsigned i=0; i<count; ++i) {
+        if (m_age[i] < m_life[i]) {
+            m_x[live] = m_x[i];
+            m_y[live] = m_y[i];
+            m_vx[live] = m_vx[i];
+            m_vy[live] = m_vy[i];
+            m_age[live] = m_age[i];
+            m_life[live] = m_life[i];
+            ++live;
+        }
+    }
+    if (live < count) {
+        m_x.resize(live);
+        m_y.resize(live);
+        m_vx.resize(live);
+        m_vy.resize(live);
+        m_age.resize(live);
+        m_life.resize(live);
+    }
+}
+
+inline void ParticleSystemNode::emit(unsigned count)
+{
+    for (unsigned i=0; i<count; ++i) {
+        m_x.push_back(random(m_emitterRect.left(), m_emitterRect.right()));
+        m_y.push_back(random(m_emitterRect.top(), m_emitterRect.bottom()));
+        m_vx.push_back(random(m_velocityMin.x, m_velocityMax.x));
+        m_vy.push_back(random(m_velocityMin.y, m_velocityMax.y));
+        m_age.push_back(0);
+        m_life.push_back(random(m_lifetimeMin, m_lifetimeMax));
+    }
+}
+
+inline void ParticleSystemNode::updateSprites()
+{
+    const unsigned count = particleCount();
+    if (count != size())
+        resize(count);
+
+    const float *x = m_x.data();
+    const float *y = m_y.data();
+    const float *age = m_age.data();
+    const float *life = m_life.data();
+    rect2d *rects = m_rects.data();
+    vec4 *colors = m_colors.data();
+    const vec4 dc = m_colorEnd - m_colorStart;
+    const float ds = m_sizeEnd - m_sizeStart;
+
+    for (unsigned i=0; i<count; ++i) {
+        float t = age[i] / life[i];
+        float h = (m_sizeStart + ds * t) * 0.5f;
+        rects[i] = rect2d(x[i] - h, y[i] - h, x[i] + h, y[i] + h);
+        colors[i] = m_colorStart + dc * t;
+    }
+
+    markDirty(0, count);
+}
+
+#define RENGINE_PARTICLESYSTEMNODE_DEFINE_ALLOCATION_POOLS \
+    RENGINE_ALLOCATION_POOL_DEFINITION(rengine::ParticleSystemNode, rengine_ParticleSystemNode);
+
+RENGINE_END_NAMESPACE
@@ -85,16 +85,49 @@ public:
     void setFillColor(vec4 c) { m_fillColor = c; }
     vec4 fillColor() const { return m_fillColor; }
 
-#if 0
+    /*!
+        Renders \a node and its subtree into a new texture, which covers
+        \a sourceRect in the node's coordinate system. The texture can then
+        be drawn with a TextureNode instead of the subtree, which is useful
+        for expensive content which doesn't change, such as blurred
+        backgrounds.
+
+        \a node must not be part of a scene. The ownership of the returned
+        texture is transferred to the caller.
+
+        This function shall never be called during rendering.
+     */
     Texture *createTextureFromSubtree(Node *node, rect2d sourceRect);
-    Texture *createTextureWithBlurFromTexture(Texture *texture, int kernelRadius);
-    Texture *createTextureWithShadowFromTexture(Texture *texture, int kernelRadius, vec2 offset,  color);
-    Texture *createTextureWithColorFilterFromTexture(Texture *texture, mat4 colorMatrix);
+
+    /*!
+        Returns a new texture with \a texture blurred by \a kernelRadius, as
+        a BlurNode would draw it. The result is 2 * \a kernelRadius larger
+        than \a texture in both directions, with the source at (\a
+        kernelRadius, \a kernelRadius).
+     */
+    Texture *createTextureWithBlurFromTexture(const Texture *texture, int kernelRadius);
+
+    /*!
+        Returns a new texture with \a texture on top of its drop shadow, as
+        a ShadowNode would draw it. The result is large enough to hold both.
+        If \a sourcePosition is given, it is set to where the source ended
+        up in the result.
+     */
+    Texture *createTextureWithShadowFromTexture(const Texture *texture, int kernelRadius, vec2 offset, vec4 color, vec2 *sourcePosition = nullptr);
+
+    /*!
+        Returns a new texture with \a colorMatrix applied to \a texture, as
+        a ColorFilterNode would draw it.
+     */
+    Texture *createTextureWithColorFilterFromTexture(const Texture *texture, mat4 colorMatrix);
+
 protected:
 
     /*!
         Creates a render target inside the renderer, like an FBO in OpenGL and
-        makes that render target active.
+        makes that render target active. render() draws into the active
+        render target rather than the target surface and clears it to
+        transparent.
 
         The render target will have \a size dimensions.
 
@@ -111,7 +144,6 @@ protected:
         The ownership of the returned texture is transferred to the caller.
      */
     virtual Texture *closeRenderTarget() = 0;
-#endif
 
 private:
     Node *m_sceneRoot;
@@ -119,66 +151,79 @@ private:
     vec4 m_fillColor;
 };
 
-#if 0
 inline Texture *Renderer::createTextureFromSubtree(Node *node, rect2d sourceRect)
 {
     assert(node);
     assert(!node->parent());
 
-    rect2d rect(floor(sourceRect.tl), ceil(sourceRect.br));
+    rect2d rect(std::floor(sourceRect.tl.x), std::floor(sourceRect.tl.y),
+                std::ceil(sourceRect.br.x), std::ceil(sourceRect.br.y));
+    if (rect.isEmpty())
+        return nullptr;
 
     openRenderTarget(rect.size());
 
-    TransformNode xnode;
-    xnode.setMatrix(mat4::translate2D(-rect.position()));
-    xnode << node;
+    TransformNode *xnode = TransformNode::create(mat4::translate2D(-rect.tl.x, -rect.tl.y));
+    *xnode << node;
 
     Node *oldRoot = sceneRoot();
-    setSceneRoot(&xnode);
+    setSceneRoot(xnode);
     render();
     setSceneRoot(oldRoot);
 
-    xnode.remove(node);
+    xnode->remove(node);
+    xnode->destroy();
 
     return closeRenderTarget();
 }
 
-inline Texture *createTextureWithBlurFromTexture(Texture *texture, int kernelRadius)
+inline Texture *Renderer::createTextureWithBlurFromTexture(const Texture *texture, int kernelRadius)
 {
     assert(kernelRadius > 0);
     assert(texture);
 
-    BlurNode blurNode;
-    blurNode.setRadius(kernelRadius);
+    BlurNode *blurNode = BlurNode::create(kernelRadius);
+    *blurNode << TextureNode::create(rect2d::fromPosSize(vec2(kernelRadius), texture->size()), texture);
 
-    TextureNode textureNode;
-    textureNode.setTexture(texture);
-    textureNode.setGeometry(rect2d::fromPosSize(vec2 (kernelRadius, kernelRadius), texture->size()))
-
-    blurNode.append(&textureNode);
-
-    return createTextureFromSubtree(&blurNode, rect2d(vec2(0, 0), texture->size() + kernelRadius * 2));
+    Texture *result = createTextureFromSubtree(blurNode, rect2d(vec2(0), texture->size() + vec2(kernelRadius * 2)));
+    blurNode->destroy();
+    return result;
 }
 
-inline Texture *createTextureWithShadowFromTexture(Texture *texture, int kernelRadius, vec2 offset,  color)
+inline Texture *Renderer::createTextureWithShadowFromTexture(const Texture *texture, int kernelRadius, vec2 offset, vec4 color, vec2 *sourcePosition)
 {
     assert(kernelRadius > 0);
     assert(texture);
 
-    ShadowNode shadowNode;
-    shadowNode.setRadius(kernelRadius);
-    shadowNode.setOffset(offset);
-    shadowNode.setColor(color);
+    // The shadow is drawn at the rounded offset and spreads out by the
+    // radius. Place the source so the shadow starts at 0 when it is above
+    // or to the left.
+    vec2 o(std::round(offset.x), std::round(offset.y));
+    float r = kernelRadius;
+    vec2 pos(std::max(0.0f, r - o.x), std::max(0.0f, r - o.y));
+    vec2 size = pos + texture->size() + vec2(std::max(0.0f, o.x + r), std::max(0.0f, o.y + r));
+
+    ShadowNode *shadowNode = ShadowNode::create(kernelRadius, offset, color);
+    *shadowNode << TextureNode::create(rect2d::fromPosSize(pos, texture->size()), texture);
+
+    Texture *result = createTextureFromSubtree(shadowNode, rect2d(vec2(0), size));
+    shadowNode->destroy();
+    if (sourcePosition)
+        *sourcePosition = pos;
+    return result;
+}
 
-    TextureNode textureNode;
-    textureNode.setTexture(texture);
-    textureNode.setGeometry(rect2d::fromPosSize(vec2(kernelRadius, kernelRadius), texture->size()))
+inline Texture *Renderer::createTextureWithColorFilterFromTexture(const Texture *texture, mat4 colorMatrix)
+{
+    assert(texture);
 
-    blurNode.append(&textureNode);
+    ColorFilterNode *filterNode = ColorFilterNode::create(colorMatrix);
+    *filterNode << TextureNode::create(rect2d(vec2(0), texture->size()), texture);
 
-    return createTextureFromSubtree(&blurNode, rect2d(vec2(0, 0), texture->size() + kernelRadius * 2));
+    Texture *result = createTextureFromSubtree(filterNode, rect2d(vec2(0), texture->size()));
+    filterNode->destroy();
+    return result;
 }
-#endif
 
 
 RENGINE_END_NAMESPACE
@@ -40,6 +40,13 @@ public:
         BGRx_32 = 4,
     };
 
+    enum MipmapMode {
+        AutomaticMipmaps,   // Mipmaps are generated once the renderer sees the texture drawn minified over time
+        NoMipmaps,          // Never mipmapped, always sampled with linear filtering. The default.
+        GpuMipmaps,         // Mipmaps are generated on the GPU as part of uploading
+        CpuMipmaps          // Mipmap levels are provided by the application, see MipmapJob
+    };
+
     /*!
        The size of the surface in pixels
      */
@@ -63,6 +70,28 @@ public:
      */
     virtual GLuint textureId() const = 0;
 
+    /*!
+        Returns how mipmaps are created for this texture.
+     */
+    virtual MipmapMode mipmapMode() const { return NoMipmaps; }
+
+    /*!
+        Returns true if the texture has a full mipmap chain and is sampled
+        with trilinear filtering when it is minified.
+     */
+    virtual bool isMipmapped() const { return false; }
+
+    /*!
+        Generates the mipmap chain from the texture's base level on the GPU.
+        The renderer calls this for textures in AutomaticMipmaps mode which
+        have been drawn minified for several frames in a row.
+
+        This doesn't change the texture's content, only how it is sampled,
+        hence the function is const. Returns false if mipmaps could not be
+        generated.
+     */
+    virtual bool generateMipmaps() const { return false; }
+
 
     /*!
         A pointer to the backend that created this texture. Can be
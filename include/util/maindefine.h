@@ -47,6 +47,8 @@ RENGINE_END_NAMESPACE
     RENGINE_NODE_DEFINE_SIGNALS                                                                        \
     RENGINE_LAYOUTNODE_DEFINE_SIGNALS                                                                  \
     RENGINE_LAYOUTNODE_DEFINE_ALLOCATION_POOLS                                                         \
+    RENGINE_LISTNODE_DEFINE_ALLOCATION_POOLS                                                           \
+    RENGINE_PARTICLESYSTEMNODE_DEFINE_ALLOCATION_POOLS                                                 \
     RENGINE_DEFINE_ANIMATION_SIGNALS                                                                   \
 
 
@@ -63,5 +65,6 @@ int main(int argc, char **argv) {
     RENGINE_ALLOCATION_POOL(rengine::ColorFilterNode, rengine_ColorFilterNode, 8);                     \
     RENGINE_ALLOCATION_POOL(rengine::BlurNode, rengine_BlurNode, 8);                                   \
     RENGINE_ALLOCATION_POOL(rengine::ShadowNode, rengine_ShadowNode, 8);                               \
+    RENGINE_ALLOCATION_POOL(rengine::ClipNode, rengine_ClipNode, 32);                                  \
     return RENGINE_NAMESPACE_PREFIX rengine_main<InterfaceName>(argc, argv);                           \
 }
@@ -0,0 +1,155 @@
+/*
+    Copyright (c) 2016, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <vector>
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    The MipmapJob class computes a mipmap chain for 32-bit premultiplied
+    image data on a WorkQueue, so the main thread doesn't stall on it.
+
+    The job takes a copy of the base level when it is created. Once the job
+    has completed, the levels can be uploaded into a texture using
+    MipmapJob::uploadTo() on the thread which owns the OpenGL context.
+
+    Each level is reduced from the one above it using a 2x2 box filter,
+    widened to 3 texels along the last row or column of odd sized levels.
+ */
+class MipmapJob : public WorkQueue::Job
+{
+public:
+    struct Level {
+        int width;
+        int height;
+        std::vector<unsigned> pixels;
+    };
+
+    MipmapJob(int width, int height, const void *data)
+        : m_base((const unsigned *) data, (const unsigned *) data + width * height)
+        , m_width(width)
+        , m_height(height)
+    {
+        assert(width > 0);
+        assert(height > 0);
+    }
+
+    void onExecute() override;
+
+    /*!
+        Returns the computed levels, starting at level 1. Only valid after
+        the job has completed.
+     */
+    const std::vector<Level> &levels() const { return m_levels; }
+
+    /*!
+        Uploads all computed levels into \a texture and switches it over to
+        trilinear filtering. The texture's base level must already be
+        uploaded and match the size of this job.
+     */
+    void uploadTo(OpenGLTexture *texture) const;
+
+    /*!
+        Reduces the \a sw by \a sh image in \a src to half its size using a
+        2x2 box filter and stores the result in \a level. When a dimension
+        is odd, the last destination row or column averages three source
+        texels so the edge of the image contributes too.
+     */
+    static void downscale(const unsigned *src, int sw, int sh, Level *level);
+
+private:
+    std::vector<unsigned> m_base;
+    int m_width;
+    int m_height;
+    std::vector<Level> m_levels;
+};
+
+inline void MipmapJob::downscale(const unsigned *src, int sw, int sh, Level *level)
+{
+    level->width = std::max(1, sw / 2);
+    level->height = std::max(1, sh / 2);
+    level->pixels.resize(level->width * level->height);
+
+    // Each destination texel covers a 2x2 block. For odd sizes, the last
+    // row and column also take in the remaining source texels, so the edge
+    // of the image is not lost.
+    for (int y=0; y<level->height; ++y) {
+        int y0 = std::min(y * 2, sh - 1);
+        int y1 = y == level->height - 1 ? sh - 1 : y * 2 + 1;
+        unsigned *dst = level->pixels.data() + y * level->width;
+        for (int x=0; x<level->width; ++x) {
+            int x0 = std::min(x * 2, sw - 1);
+            int x1 = x == level->width - 1 ? sw - 1 : x * 2 + 1;
+            unsigned count = (x1 - x0 + 1) * (y1 - y0 + 1);
+            unsigned sum[4] = { 0, 0, 0, 0 };
+            for (int sy=y0; sy<=y1; ++sy) {
+                for (int sx=x0; sx<=x1; ++sx) {
+                    unsigned p = src[sy * sw + sx];
+                    for (int c=0; c<4; ++c)
+                        sum[c] += (p >> (c * 8)) & 0xff;
+                }
+            }
+            unsigned result = 0;
+            for (int c=0; c<4; ++c)
+                result |= ((sum[c] + count / 2) / count) << (c * 8);
+            dst[x] = result;
+        }
+    }
+}
+
+inline void MipmapJob::onExecute()
+{
+    m_levels.clear();
+
+    const unsigned *src = m_base.data();
+    int sw = m_width;
+    int sh = m_height;
+
+    while (sw > 1 || sh > 1) {
+        Level level;
+        downscale(src, sw, sh, &level);
+        m_levels.push_back(std::move(level));
+        src = m_levels.back().pixels.data();
+        sw = m_levels.back().width;
+        sh = m_levels.back().height;
+    }
+}
+
+inline void MipmapJob::uploadTo(OpenGLTexture *texture) const
+{
+    assert(texture);
+    assert(texture->width() == unsigned(m_width));
+    assert(texture->height() == unsigned(m_height));
+    assert(hasCompleted());
+
+    for (unsigned i=0; i<m_levels.size(); ++i) {
+        const Level &level = m_levels.at(i);
+        texture->uploadMipmapLevel(i + 1, level.width, level.height, level.pixels.data());
+    }
+}
+
+RENGINE_END_NAMESPACE
@@ -0,0 +1,381 @@
+/*
+    Copyright (c) 2016, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <cmath>
+#include <algorithm>
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    A spatial index over the pointer target nodes in a scene, used by
+    StandardSurface so that a pointer event only needs to look at the
+    nodes which may be under it rather than traversing the whole scene.
+
+    The index is a uniform grid over the surface-space bounds of each
+    pointer target. Bounds are derived from the same inverse world matrix
+    the hit test uses, so they are exact for 2D and 3D transforms alike.
+    Nodes whose hit area is unbounded in surface space, or covers a large
+    part of the grid, are kept in a separate list which is checked for
+    every query.
+
+    The index is kept up to date using the nodes' change stamps. On each
+    query it only descends into subtrees which have changed since the last
+    one. When a transform or a geometry has changed, the targets below it
+    are moved to their new cells; the rest of the index is left alone.
+    Only adding, removing or reordering pointer targets in the indexed
+    tree, or toggling their pointer target state, rebuilds the index from
+    scratch. Changes to other trees are never looked at.
+ */
+class PointerTargetIndex
+{
+public:
+    /*!
+        Returns the pointer targets below \a root which may contain \a pos,
+        in surface coordinates, in reverse paint order. This is the order in
+        which a recursive traversal would have delivered the event.
+
+        Candidates still need to be hit tested exactly. The returned vector
+        is valid until the next call.
+     */
+    const std::vector<Node *> &candidatesAt(Node *root, vec2 pos);
+
+    /*!
+        Forces the index to be rebuilt on the next query.
+     */
+    void invalidate() { m_root = nullptr; }
+
+    /*!
+        Returns the number of pointer targets in the index which can be hit.
+     */
+    unsigned targetCount() const { return m_targetCount; }
+
+    /*!
+        Returns how many times the index has been rebuilt from scratch.
+     */
+    unsigned rebuildCount() const { return m_rebuildCount; }
+
+private:
+    struct Entry {
+        Node *node;
+        rect2d bounds;
+        bool bounded;
+        bool hittable;
+        bool inGrid;
+    };
+
+    void sync(Node *root);
+    void rebuild(Node *root);
+    void collect(Node *node);
+    void update(Node *node, bool changed);
+    void computeBounds(Entry *e);
+    void place(unsigned index);
+    void unplace(unsigned index);
+    int column(float x) const;
+    int row(float y) const;
+    bool mayContain(const Entry &e, vec2 pos) const { return !e.bounded || e.bounds.contains(pos); }
+
+    static void insertSorted(std::vector<unsigned> *list, unsigned index) {
+        list->insert(std::lower_bound(list->begin(), list->end(), index), index);
+    }
+    static void eraseSorted(std::vector<unsigned> *list, unsigned index) {
+        auto it = std::lower_bound(list->begin(), list->end(), index);
+        assert(it != list->end() && *it == index);
+        list->erase(it);
+    }
+
+    // The rectangle pointer targets in paint order, so a higher index is
+    // closer to the viewer and should be asked first. Targets which can not
+    // be hit are kept too, so the indices survive transform changes.
+    std::vector<Entry> m_entries;
+    std::unordered_map<Node *, unsigned> m_entryIndex;
+    unsigned m_targetCount = 0;
+
+    // Hittable entries which are not in the grid, in paint order. Targets
+    // which move outside the grid end up here, so once it has grown enough
+    // the index is rebuilt around the new layout.
+    std::vector<unsigned> m_unbounded;
+    unsigned m_unboundedLimit = 0;
+
+    // The entries of each grid cell, in paint order.
+    std::vector<std::vector<unsigned>> m_cells;
+    rect2d m_gridBounds;
+    vec2 m_cellsPerUnit;
+    int m_columns = 0;
+    int m_rows = 0;
+    int m_maxCells = 0;
+
+    Node *m_root = nullptr;
+    unsigned m_epoch = 0;
+    unsigned m_rebuildCount = 0;
+
+    std::vector<Node *> m_candidates;
+};
+
+inline const std::vector<Node *> &PointerTargetIndex::candidatesAt(Node *root, vec2 pos)
+{
+    sync(root);
+
+    m_candidates.clear();
+
+    const unsigned *cellBegin = nullptr;
+    const unsigned *cellEnd = nullptr;
+    if (m_columns > 0
+        && pos.x >= m_gridBounds.tl.x && pos.x <= m_gridBounds.br.x
+        && pos.y >= m_gridBounds.tl.y && pos.y <= m_gridBounds.br.y) {
+        const std::vector<unsigned> &cell = m_cells[row(pos.y) * m_columns + column(pos.x)];
+        cellBegin = cell.data();
+        cellEnd = cell.data() + cell.size();
+    }
+
+    // Merge the cell and the unbounded list, highest index first
+    const unsigned *c = cellEnd;
+    const unsigned *u = m_unbounded.data() + m_unbounded.size();
+    const unsigned *uBegin = m_unbounded.data();
+    while (c != cellBegin || u != uBegin) {
+        unsigned index;
+        if (u == uBegin || (c != cellBegin && c[-1] > u[-1]))
+            index = *--c;
+        else
+            index = *--u;
+        const Entry &e = m_entries[index];
+        if (mayContain(e, pos))
+            m_candidates.push_back(e.node);
+    }
+
+    return m_candidates;
+}
+
+/*!
+    Brings the index up to date with all changes stamped after m_epoch.
+ */
+inline void PointerTargetIndex::sync(Node *root)
+{
+    unsigned epoch = Node::advanceChangeEpoch();
+
+    if (root != m_root || (root && root->subtreeStructureStamp() > m_epoch)) {
+        rebuild(root);
+    } else if (root) {
+        // The root's world matrix also depends on its ancestors
+        bool moved = false;
+        for (Node *n = root; n && !moved; n = n->parent())
+            moved = n->hitTestStamp() > m_epoch;
+        if (moved || root->subtreeChangeStamp() > m_epoch)
+            update(root, moved);
+        if (m_unbounded.size() > m_unboundedLimit)
+            rebuild(root);
+    }
+
+    m_epoch = epoch;
+}
+
+inline void PointerTargetIndex::rebuild(Node *root)
+{
+    ++m_rebuildCount;
+    m_root = root;
+    m_entries.clear();
+    m_entryIndex.clear();
+    m_unbounded.clear();
+    for (std::vector<unsigned> &cell : m_cells)
+        cell.clear();
+    m_targetCount = 0;
+    m_columns = 0;
+    m_rows = 0;
+
+    if (!root)
+        return;
+
+    collect(root);
+
+    unsigned boundedCount = 0;
+    for (const Entry &e : m_entries) {
+        if (e.hittable && e.bounded) {
+            m_gridBounds = boundedCount == 0 ? e.bounds : (m_gridBounds | e.bounds);
+            ++boundedCount;
+        }
+    }
+
+    if (boundedCount > 0) {
+        // Aim for roughly one target per cell in a typical grid-like layout.
+        int side = std::max(1, std::min(128, (int) std::sqrt((float) boundedCount)));
+        m_columns = side;
+        m_rows = side;
+        m_cellsPerUnit = vec2(m_columns / m_gridBounds.width(), m_rows / m_gridBounds.height());
+        if (m_cells.size() < unsigned(m_columns * m_rows))
+            m_cells.resize(m_columns * m_rows);
+
+        // Entries covering a large part of the grid would be duplicated into
+        // many cells, so they are checked for every query instead.
+        m_maxCells = std::max(4, m_columns * m_rows / 8);
+    }
+
+    for (unsigned i=0; i<m_entries.size(); ++i)
+        place(i);
+
+    m_unboundedLimit = m_unbounded.size() + m_entries.size() / 4 + 8;
+}
+
+inline void PointerTargetIndex::collect(Node *node)
+{
+    if (node->isPointerTarget() && RectangleNodeBase::from(node)) {
+        Entry e = { node, rect2d(), false, false, false };
+        computeBounds(&e);
+        m_entryIndex[node] = m_entries.size();
+        m_entries.push_back(e);
+    }
+
+    for (Node *child = node->child(); child; child = child->sibling())
+        collect(child);
+}
+
+/*!
+    Moves the targets at and below \a node to their new bounds, descending
+    only into the subtrees which have changed. If \a changed is set, the
+    world matrix of \a node has changed and so has everything below it.
+ */
+inline void PointerTargetIndex::update(Node *node, bool changed)
+{
+    changed = changed || node->hitTestStamp() > m_epoch;
+    if (changed && node->isPointerTarget()) {
+        auto it = m_entryIndex.find(node);
+        if (it != m_entryIndex.end()) {
+            unsigned index = it->second;
+            unplace(index);
+            computeBounds(&m_entries[index]);
+            place(index);
+        }
+    }
+
+    for (Node *child = node->child(); child; child = child->sibling()) {
+        if (changed || child->subtreeChangeStamp() > m_epoch)
+            update(child, changed);
+    }
+}
+
+inline void PointerTargetIndex::computeBounds(Entry *e)
+{
+    bool invertible = false;
+    mat4 inv = e->node->inverseWorldMatrix(&invertible);
+
+    // Nodes without an inverse can never be hit.
+    e->hittable = invertible;
+    e->bounded = false;
+    e->bounds = rect2d();
+    if (!invertible)
+        return;
+
+    // The hit test maps the position into the node with the 2D part of
+    // the inverse, q = A * p + t. If A is well-conditioned, the positions
+    // which hit the area form a parallelogram and we index its bounds.
+    rect2d area = RectangleNodeBase::from(e->node)->geometry();
+    float a = inv.m[0], b = inv.m[1], c = inv.m[4], d = inv.m[5];
+    float det = a * d - b * c;
+    float norm = std::abs(a) + std::abs(b) + std::abs(c) + std::abs(d);
+    if (!area.isEmpty() && std::abs(det) > 1e-6f * norm * norm) {
+        vec2 t(inv.m[3], inv.m[7]);
+        vec2 corners[] = { area.tl, vec2(area.br.x, area.tl.y), vec2(area.tl.x, area.br.y), area.br };
+        for (int i=0; i<4; ++i) {
+            vec2 v = corners[i] - t;
+            vec2 p((d * v.x - b * v.y) / det, (a * v.y - c * v.x) / det);
+            e->bounds = i == 0 ? rect2d(p, p) : (e->bounds | p);
+        }
+
+        // Pad the bounds so rounding in the exact hit test never makes
+        // it accept a position we have rejected.
+        float magnitude = std::max(std::max(std::abs(e->bounds.tl.x), std::abs(e->bounds.tl.y)),
+                                   std::max(std::abs(e->bounds.br.x), std::abs(e->bounds.br.y)));
+        float pad = 0.001f * (1.0f + magnitude);
+        e->bounds = rect2d(e->bounds.tl - vec2(pad, pad), e->bounds.br + vec2(pad, pad));
+        e->bounded = std::isfinite(e->bounds.tl.x) && std::isfinite(e->bounds.tl.y)
+                  && std::isfinite(e->bounds.br.x) && std::isfinite(e->bounds.br.y);
+    }
+}
+
+/*!
+    Adds entry \a index to the cells its bounds cover, or to the unbounded
+    list if it does not fit the grid.
+ */
+inline void PointerTargetIndex::place(unsigned index)
+{
+    Entry &e = m_entries[index];
+    e.inGrid = false;
+    if (!e.hittable)
+        return;
+    ++m_targetCount;
+
+    if (e.bounded && m_columns > 0
+        && e.bounds.tl.x >= m_gridBounds.tl.x && e.bounds.br.x <= m_gridBounds.br.x
+        && e.bounds.tl.y >= m_gridBounds.tl.y && e.bounds.br.y <= m_gridBounds.br.y) {
+        int x0 = column(e.bounds.tl.x), x1 = column(e.bounds.br.x);
+        int y0 = row(e.bounds.tl.y), y1 = row(e.bounds.br.y);
+        if ((x1 - x0 + 1) * (y1 - y0 + 1) <= m_maxCells) {
+            e.inGrid = true;
+            for (int y=y0; y<=y1; ++y)
+                for (int x=x0; x<=x1; ++x)
+                    insertSorted(&m_cells[y * m_columns + x], index);
+            return;
+        }
+    }
+    insertSorted(&m_unbounded, index);
+}
+
+inline void PointerTargetIndex::unplace(unsigned index)
+{
+    const Entry &e = m_entries[index];
+    if (!e.hittable)
+        return;
+    --m_targetCount;
+
+    if (!e.inGrid) {
+        eraseSorted(&m_unbounded, index);
+        return;
+    }
+    int x0 = column(e.bounds.tl.x), x1 = column(e.bounds.br.x);
+    int y0 = row(e.bounds.tl.y), y1 = row(e.bounds.br.y);
+    for (int y=y0; y<=y1; ++y)
+        for (int x=x0; x<=x1; ++x)
+            eraseSorted(&m_cells[y * m_columns + x], index);
+}
+
+inline int PointerTargetIndex::column(float x) const
+{
+    float f = (x - m_gridBounds.tl.x) * m_cellsPerUnit.x;
+    if (!(f >= 0))
+        return 0;
+    return f >= m_columns ? m_columns - 1 : int(f);
+}
+
+inline int PointerTargetIndex::row(float y) const
+{
+    float f = (y - m_gridBounds.tl.y) * m_cellsPerUnit.y;
+    if (!(f >= 0))
+        return 0;
+    return f >= m_rows ? m_rows - 1 : int(f);
+}
+
+RENGINE_END_NAMESPACE
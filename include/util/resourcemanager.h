@@ -36,6 +36,22 @@
 
 RENGINE_BEGIN_NAMESPACE
 
+/*!
+    Premultiplies \a w by \a h pixels of 8-bit RGBA \a data in place.
+ */
+inline void rengine_premultiply(unsigned char *data, int w, int h)
+{
+    for (int y=0; y<h; ++y) {
+        for (int x=0; x<w; ++x) {
+            unsigned char *p = data + (y * w + x) * 4;
+            unsigned a = p[3];
+            p[0] = (unsigned(p[0]) * a) / 255;
+            p[1] = (unsigned(p[1]) * a) / 255;
+            p[2] = (unsigned(p[2]) * a) / 255;
+        }
+    }
+}
+
 class ResourceManager
 {
 public:
@@ -83,15 +99,7 @@ inline Texture *ResourceManager::onLoadTexture(const std::string &key)
     logd << " -> " << key << ": size=" << w << "x" << h << ", components=" << n << std::endl;
     // Premultiply it...
     if (n == 4) {
-        for (int y=0; y<h; ++y) {
-            for (int x=0; x<w; ++x) {
-                unsigned char *p = data + (y * w + x) * 4;
-                unsigned a = p[3];
-                p[0] = (unsigned(p[0]) * a) / 255;
-                p[1] = (unsigned(p[1]) * a) / 255;
-                p[2] = (unsigned(p[2]) * a) / 255;
-            }
-        }
+        rengine_premultiply(data, w, h);
         logd << " -> premultiplied" << std::endl;
     }
 
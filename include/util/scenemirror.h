@@ -0,0 +1,370 @@
+/*
+    Copyright (c) 2016, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    The SceneMirror keeps a copy of a scene graph which a renderer can draw
+    while the application keeps changing the original, such as with the
+    threaded render loop in StandardSurface.
+
+    sync() walks the source tree, runs its preprocessing and copies the
+    rendering state of each node into its mirror, creating and destroying
+    mirrored nodes as the source tree changes. The nodes' change stamps
+    tell which nodes changed since the last sync, so only those are copied
+    and subtrees without changes are not visited at all. List nodes only
+    copy the range which was marked dirty since the last sync.
+
+    Nodes are mirrored as the type the renderer draws them as, so a
+    LayoutNode becomes a plain Node and a NinePatchNode or
+    ParticleSystemNode becomes a SpriteListNode. RenderNodes call into the
+    application while rendering and can't be mirrored, they are replaced
+    by an empty Node.
+
+    Nothing else may use either tree while sync() runs.
+ */
+class SceneMirror
+{
+public:
+    ~SceneMirror() { clear(); }
+
+    /*!
+        Updates the mirror to match the tree below \a root and returns the
+        mirror's root.
+     */
+    Node *sync(Node *root);
+
+    /*!
+        Returns the mirror of \a source as of the last sync, or null if it
+        isn't mirrored.
+     */
+    Node *mirrorOf(Node *source) const {
+        auto it = m_nodes.find(source);
+        return it != m_nodes.end() ? it->second.node : nullptr;
+    }
+
+    Node *root() const { return m_root; }
+
+    /*!
+        Returns the number of mirrored nodes.
+     */
+    unsigned size() const { return (unsigned) m_nodes.size(); }
+
+    /*!
+        Returns the number of nodes which were copied by the last sync().
+     */
+    unsigned copyCount() const { return m_copyCount; }
+
+    /*!
+        Destroys all mirrored nodes.
+     */
+    void clear();
+
+private:
+    struct Entry {
+        Node *node = nullptr;
+        Node::Type type;
+        unsigned serial;
+    };
+
+    Node *mirror(Node *source);
+    void destroyOrphans();
+    static Node *createMirror(Node *source);
+    static void copy(Node *source, Node *mirror, bool created);
+    static unsigned serialOf(Node *node);
+    void destroyMirror(Node *mirror);
+
+    std::unordered_map<Node *, Entry> m_nodes;
+    std::unordered_map<Node *, Node *> m_sources;
+    std::vector<Node *> m_children;
+    std::vector<Node *> m_detached;
+    Node *m_root = nullptr;
+    unsigned m_epoch = 0;
+    unsigned m_copyCount = 0;
+};
+
+inline Node *SceneMirror::sync(Node *root)
+{
+    if (!root) {
+        clear();
+        return nullptr;
+    }
+
+    unsigned epoch = Node::advanceChangeEpoch();
+    m_copyCount = 0;
+    if (m_root)
+        m_detached.push_back(m_root);
+    m_root = mirror(root);
+    assert(m_children.empty());
+    m_epoch = epoch;
+
+    destroyOrphans();
+    assert(!m_root->parent());
+
+    return m_root;
+}
+
+/*!
+    Destroys the mirrors which were detached during sync() and not put
+    back into the mirrored tree, together with their subtrees. Their
+    sources are no longer part of the tree being mirrored.
+ */
+inline void SceneMirror::destroyOrphans()
+{
+    for (Node *orphan : m_detached) {
+        // Already destroyed, or moved back into the tree
+        if (!m_sources.count(orphan) || orphan->parent() || orphan == m_root)
+            continue;
+        m_children.push_back(orphan);
+        while (!m_children.empty()) {
+            Node *m = m_children.back();
+            m_children.pop_back();
+            auto it = m_sources.find(m);
+            auto entry = m_nodes.find(it->second);
+            // The source's address may have been reused by a node which
+            // has a mirror of its own.
+            if (entry != m_nodes.end() && entry->second.node == m)
+                m_nodes.erase(entry);
+            m_sources.erase(it);
+            for (Node *c = m->child(); c; c = c->sibling())
+                m_children.push_back(c);
+        }
+        orphan->destroy();
+    }
+    m_detached.clear();
+}
+
+inline void SceneMirror::clear()
+{
+    for (auto &it : m_nodes) {
+        Node *m = it.second.node;
+        if (m->parent())
+            m->parent()->remove(m);
+    }
+    for (auto &it : m_nodes)
+        it.second.node->destroy();
+    m_nodes.clear();
+    m_sources.clear();
+    m_detached.clear();
+    m_root = nullptr;
+}
+
+inline Node *SceneMirror::mirror(Node *source)
+{
+    // A subtree which hasn't changed since the last sync is already
+    // mirrored as it is.
+    auto it = m_nodes.find(source);
+    if (it != m_nodes.end()
+        && source->subtreeChangeStamp() <= m_epoch
+        && it->second.type == source->type()
+        && it->second.serial == serialOf(source)) {
+        return it->second.node;
+    }
+
+    // Same as the renderer would do it, in case it changes the tree. A
+    // pending preprocess has stamped the node, so it can't be skipped.
+    source->preprocess();
+
+    Entry &entry = m_nodes[source];
+    bool created = false;
+    // A different node may have been allocated at the address of one which
+    // was destroyed since the last sync.
+    if (!entry.node || entry.type != source->type() || entry.serial != serialOf(source)) {
+        if (entry.node)
+            destroyMirror(entry.node);
+        entry.node = createMirror(source);
+        entry.type = source->type();
+        entry.serial = serialOf(source);
+        m_sources[entry.node] = source;
+        created = true;
+    }
+
+    // 'entry' is not stable across insertions into m_nodes, which happen
+    // when mirroring the children.
+    Node *m = entry.node;
+    if (created || source->changeStamp() > m_epoch) {
+        copy(source, m, created);
+        ++m_copyCount;
+    }
+
+    size_t first = m_children.size();
+    for (Node *child = source->child(); child; child = child->sibling()) {
+        Node *mc = mirror(child);
+        m_children.push_back(mc);
+    }
+
+    // Only relink the children if they changed
+    bool relink = false;
+    Node *mc = m->child();
+    for (size_t i=first; i<m_children.size(); ++i) {
+        if (mc != m_children[i]) {
+            relink = true;
+            break;
+        }
+        mc = mc->sibling();
+    }
+    if (relink || mc) {
+        while (Node *c = m->child()) {
+            m->remove(c);
+            m_detached.push_back(c);
+        }
+        for (size_t i=first; i<m_children.size(); ++i) {
+            Node *c = m_children[i];
+            if (c->parent())
+                c->parent()->remove(c);
+            m->append(c);
+        }
+    }
+    m_children.resize(first);
+
+    return m;
+}
+
+inline void SceneMirror::destroyMirror(Node *m)
+{
+    // The children are mirrors of other nodes and stay alive, unless their
+    // sources are gone too.
+    while (Node *c = m->child()) {
+        m->remove(c);
+        m_detached.push_back(c);
+    }
+    if (m->parent())
+        m->parent()->remove(m);
+    m_sources.erase(m);
+    m->destroy();
+}
+
+inline unsigned SceneMirror::serialOf(Node *node)
+{
+    switch (node->type()) {
+    case Node::RectangleListNodeType:
+    case Node::SpriteListNodeType:
+    case Node::ParticleSystemNodeType:
+    case Node::NinePatchNodeType:
+        return static_cast<RectangleListNode *>(node)->serial();
+    default:
+        return 0;
+    }
+}
+
+inline Node *SceneMirror::createMirror(Node *source)
+{
+    switch (source->type()) {
+    case Node::TransformNodeType: return TransformNode::create();
+    case Node::OpacityNodeType: return OpacityNode::create();
+    case Node::ColorFilterNodeType: return ColorFilterNode::create();
+    case Node::BlurNodeType: return BlurNode::create();
+    case Node::ShadowNodeType: return ShadowNode::create();
+    case Node::ClipNodeType: return ClipNode::create();
+    case Node::RectangleNodeType: return RectangleNode::create();
+    case Node::TextureNodeType: return TextureNode::create();
+    case Node::RectangleListNodeType: return RectangleListNode::create();
+    case Node::SpriteListNodeType:
+    case Node::ParticleSystemNodeType:
+    case Node::NinePatchNodeType:
+        return SpriteListNode::create();
+    case Node::RenderNodeType:
+        logw << "RenderNode " << source << " can't be mirrored and will not be rendered" << std::endl;
+        return Node::create();
+    default:
+        return Node::create();
+    }
+}
+
+inline void SceneMirror::copy(Node *source, Node *m, bool created)
+{
+    switch (source->type()) {
+    case Node::TransformNodeType: {
+        TransformNode *s = static_cast<TransformNode *>(source);
+        TransformNode *t = static_cast<TransformNode *>(m);
+        t->setMatrix(s->matrix());
+        t->setProjectionDepth(s->projectionDepth());
+    } break;
+    case Node::OpacityNodeType:
+        static_cast<OpacityNode *>(m)->setOpacity(static_cast<OpacityNode *>(source)->opacity());
+        break;
+    case Node::ColorFilterNodeType:
+        static_cast<ColorFilterNode *>(m)->setColorMatrix(static_cast<ColorFilterNode *>(source)->colorMatrix());
+        break;
+    case Node::BlurNodeType:
+        static_cast<BlurNode *>(m)->setRadius(static_cast<BlurNode *>(source)->radius());
+        break;
+    case Node::ShadowNodeType: {
+        ShadowNode *s = static_cast<ShadowNode *>(source);
+        ShadowNode *t = static_cast<ShadowNode *>(m);
+        t->setRadius(s->radius());
+        t->setOffset(s->offset());
+        t->setColor(s->color());
+    } break;
+    case Node::ClipNodeType:
+        static_cast<ClipNode *>(m)->setClipRect(static_cast<ClipNode *>(source)->clipRect());
+        break;
+    case Node::RectangleNodeType: {
+        RectangleNode *s = static_cast<RectangleNode *>(source);
+        RectangleNode *t = static_cast<RectangleNode *>(m);
+        t->setGeometry(s->geometry());
+        t->setColor(s->color());
+    } break;
+    case Node::TextureNodeType: {
+        TextureNode *s = static_cast<TextureNode *>(source);
+        TextureNode *t = static_cast<TextureNode *>(m);
+        t->setGeometry(s->geometry());
+        t->setTexture(s->texture());
+    } break;
+    case Node::RectangleListNodeType:
+    case Node::SpriteListNodeType:
+    case Node::ParticleSystemNodeType:
+    case Node::NinePatchNodeType: {
+        RectangleListNode *s = static_cast<RectangleListNode *>(source);
+        RectangleListNode *t = static_cast<RectangleListNode *>(m);
+        bool sprites = source->type() != Node::RectangleListNodeType;
+        if (t->size() != s->size())
+            t->resize(s->size());
+        unsigned begin = created ? 0 : std::min(s->dirtyBegin(), s->size());
+        unsigned end = created ? s->size() : s->dirtyEnd();
+        if (begin < end) {
+            std::copy(s->rects() + begin, s->rects() + end, t->rects() + begin);
+            std::copy(s->colors() + begin, s->colors() + end, t->colors() + begin);
+            if (sprites) {
+                SpriteListNode *ss = static_cast<SpriteListNode *>(s);
+                std::copy(ss->texCoords() + begin, ss->texCoords() + end, static_cast<SpriteListNode *>(t)->texCoords() + begin);
+            }
+            t->markDirty(begin, end - begin);
+        }
+        if (sprites)
+            static_cast<SpriteListNode *>(t)->setTexture(static_cast<SpriteListNode *>(s)->texture());
+        s->resetDirty();
+    } break;
+    default:
+        break;
+    }
+}
+
+RENGINE_END_NAMESPACE
@@ -36,14 +36,19 @@ public:
             printf("running changed...\n");
             requestRender();
         }));
+
+        // Render when a job completes, so update() can pick up the result
+        m_workQueue.setCompletionHandler([this] { requestRender(); });
     }
 
     ~StandardSurface()
     {
-        if (m_renderer) {
-            if (m_renderer->sceneRoot())
-                m_renderer->sceneRoot()->destroy();
+        if (m_renderThread.joinable()) {
+            postToRenderThread(ExitRequest);
+            m_renderThread.join();
         }
+        if (m_sceneRoot)
+            m_sceneRoot->destroySubtree();
     }
 
     // This function is called once at the start of the application before it
@@ -64,27 +69,43 @@ public:
         return root;
     }
 
+    // This function is only called with the threaded render loop. It is
+    // called on the render thread while the main thread is blocked, right
+    // after the scene has been copied for rendering. This is the place to
+    // create textures and other resources which need the OpenGL context.
+    virtual void onSynchronize() { }
+
     virtual void onBeforeRender() { }
     virtual void onAfterRender() { }
 
     void onRender() override {
+        if (m_threadedRenderLoop) {
+            renderThreaded();
+            return;
+        }
+
         if (!beginRender())
             return;
 
         // Initialize the renderer if this is the first time around
         if (!m_renderer) {
             m_renderer.reset(createRenderer());
-            m_renderer->setSceneRoot(build());
+            m_sceneRoot = build();
         }
 
         // Update the scene graph...
-        m_renderer->setSceneRoot(update(m_renderer->sceneRoot()));
+        m_sceneRoot = update(m_sceneRoot);
+        m_renderer->setSceneRoot(m_sceneRoot);
 
-        if (!m_renderer->sceneRoot())
+        if (!m_sceneRoot)
             return;
 
         // Advance the animations just before rendering..
-        m_animationManager.tick();
+        tickAnimations();
+
+        // Run the deferred signal handlers, e.g. bindings, once for all
+        // the changes made by update() and the animations
+        SignalQueue::current()->flush();
 
         // And then render the stuff
         onBeforeRender();
@@ -94,18 +115,39 @@ public:
         commitRender();
         m_renderer->frameSwapped();
 
-        // Schedule a repaint again if there are animations running...
-
-        // ### TODO: Optimize waiting for scheduled animations. Rather than
-        // just keep on rendering, we should figure out how long we need to
-        // wait and schedule an update at that time.
-        if (m_animationManager.animationsRunning() || m_animationManager.animationsScheduled()) {
-            requestRender();
-        }
+        scheduleAnimations();
     }
 
     virtual void onEvent(Event *e) override;
 
+    /*!
+        Enables or disables the threaded render loop. It is disabled by
+        default and can only be changed before the surface has rendered.
+
+        With the threaded render loop, update() and the animations run on
+        the main thread while the previous frame is still being drawn and
+        presented on a dedicated render thread. Once update() is done, the
+        main thread blocks while the render thread copies the scene into
+        a SceneMirror, then continues with events and the next frame while
+        the render thread draws the copy.
+
+        Everything which uses the OpenGL context, including build(),
+        onSynchronize(), onBeforeRender(), onAfterRender() and the
+        renderer() itself, then lives on the render thread. Textures must
+        therefore be created in build() or onSynchronize() rather than in
+        update(). RenderNodes are not supported.
+     */
+    void setThreadedRenderLoop(bool threaded) {
+        assert(!m_renderer && !m_renderThread.joinable());
+        m_threadedRenderLoop = threaded;
+    }
+    bool isThreadedRenderLoop() const { return m_threadedRenderLoop; }
+
+    /*!
+        Returns the root of the application's scene graph.
+     */
+    Node *sceneRoot() const { return m_sceneRoot; }
+
     Renderer *renderer() const { return m_renderer.get(); }
     AnimationManager *animationManager() { return &m_animationManager; }
     WorkQueue *workQueue() { return &m_workQueue; }
@@ -118,16 +160,150 @@ public:
     Node *pointerEventReceiver() const { return m_pointerEventReceiver; }
 
 protected:
+    bool deliverPointerEvent(PointerEvent *e);
     bool deliverPointerEventInScene(Node *n, PointerEvent *e);
+    bool deliverPointerEventToNode(Node *node, PointerEvent *e);
 
     std::unique_ptr<Renderer> m_renderer;
     AnimationManager m_animationManager;
 
+    Node *m_sceneRoot = nullptr;
     Node *m_pointerEventReceiver = nullptr;
+    PointerTargetIndex m_pointerTargetIndex;
 
     WorkQueue m_workQueue;
+
+private:
+    enum RenderThreadRequest {
+        NoRequest,
+        BuildRequest,
+        SyncRequest,
+        ExitRequest
+    };
+
+    void tickAnimations();
+    void scheduleAnimations();
+    void renderThreaded();
+    void postToRenderThread(RenderThreadRequest request);
+    void renderThreadMain();
+
+    bool m_threadedRenderLoop = false;
+    std::thread m_renderThread;
+    std::mutex m_renderMutex;
+    std::condition_variable m_renderCondition;
+    RenderThreadRequest m_renderRequest = NoRequest;
+    SceneMirror m_mirror;
 };
 
+inline void StandardSurface::tickAnimations()
+{
+    // Animate to when the frame will actually be on screen
+    double interval = vsyncInterval();
+    if (interval > 0)
+        m_animationManager.setFrameInterval(interval);
+    m_animationManager.setPresentationTime(presentationTime());
+
+    m_animationManager.tick();
+}
+
+inline void StandardSurface::scheduleAnimations()
+{
+    // Schedule a repaint again if there are animations running...
+    if (m_animationManager.animationsRunning()) {
+        requestRender();
+    } else if (m_animationManager.animationsScheduled()) {
+        // ... or sleep until the frame where the first delayed one starts.
+        std::chrono::duration<double> interval(m_animationManager.frameInterval());
+        requestRenderAt(m_animationManager.nextScheduledStart() - std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval));
+    }
+}
+
+inline void StandardSurface::renderThreaded()
+{
+    if (!m_renderThread.joinable()) {
+        // The backend made the context current on this thread when the
+        // surface was created, so hand it over.
+        releaseRender();
+        m_renderThread = std::thread(&StandardSurface::renderThreadMain, this);
+        postToRenderThread(BuildRequest);
+    }
+
+    // Prepare the next frame while the render thread is still busy
+    // presenting the previous one.
+    m_sceneRoot = update(m_sceneRoot);
+    if (!m_sceneRoot)
+        return;
+
+    tickAnimations();
+    SignalQueue::current()->flush();
+
+    // Blocks until the render thread has finished the previous frame and
+    // taken its copy of this one.
+    postToRenderThread(SyncRequest);
+
+    scheduleAnimations();
+}
+
+inline void StandardSurface::postToRenderThread(RenderThreadRequest request)
+{
+    std::unique_lock<std::mutex> locker(m_renderMutex);
+    assert(m_renderRequest == NoRequest);
+    m_renderRequest = request;
+    m_renderCondition.notify_all();
+    while (m_renderRequest != NoRequest)
+        m_renderCondition.wait(locker);
+}
+
+inline void StandardSurface::renderThreadMain()
+{
+    std::unique_lock<std::mutex> locker(m_renderMutex);
+    while (true) {
+        while (m_renderRequest == NoRequest)
+            m_renderCondition.wait(locker);
+        RenderThreadRequest request = m_renderRequest;
+
+        // The main thread is blocked until the request is cleared, so
+        // both the scene and the node pools are ours until then.
+        bool current = beginRender();
+        if (request == ExitRequest) {
+            m_mirror.clear();
+            m_renderer.reset();
+            if (current)
+                releaseRender();
+            m_renderRequest = NoRequest;
+            m_renderCondition.notify_all();
+            return;
+        }
+
+        if (current && !m_renderer)
+            m_renderer.reset(createRenderer());
+
+        if (!current || request == BuildRequest) {
+            if (current)
+                m_sceneRoot = build();
+            m_renderRequest = NoRequest;
+            m_renderCondition.notify_all();
+            continue;
+        }
+
+        m_renderer->setSceneRoot(m_mirror.sync(m_sceneRoot));
+        onSynchronize();
+
+        m_renderRequest = NoRequest;
+        m_renderCondition.notify_all();
+        locker.unlock();
+
+        onBeforeRender();
+        m_renderer->render();
+        onAfterRender();
+
+        commitRender();
+        m_renderer->frameSwapped();
+
+        locker.lock();
+    }
+}
+
 inline void StandardSurface::onEvent(Event *e)
 {
 
@@ -135,18 +311,20 @@ inline void StandardSurface::onEvent(Event *e)
     case Event::PointerDown:
     case Event::PointerUp:
     case Event::PointerMove:
-        if (m_renderer && m_renderer->sceneRoot()) {
+        if (m_sceneRoot) {
             PointerEvent *pe = PointerEvent::from(e);
             if (m_pointerEventReceiver) {
+                assert(!m_sceneRoot->parent());
                 bool inv = false;
-                mat4 invNodeMatrix = TransformNode::matrixFor(m_pointerEventReceiver, m_renderer->sceneRoot()).inverted(&inv);
+                mat4 invNodeMatrix = m_pointerEventReceiver->inverseWorldMatrix(&inv);
                 if (inv)
                     pe->setPosition(invNodeMatrix * pe->positionInSurface());
                 else
                     pe->setPosition(vec2());
                 m_pointerEventReceiver->onPointerEvent(pe);
             } else {
-                deliverPointerEventInScene(m_renderer->sceneRoot(), pe);
+                assert(!m_sceneRoot->parent());
+                deliverPointerEvent(pe);
             }
         }
         break;
@@ -156,6 +334,44 @@ inline void StandardSurface::onEvent(Event *e)
     }
 }
 
+/*!
+    Delivers \a e to the pointer targets under it, using the spatial index
+    to find candidates in the same order as deliverPointerEventInScene().
+ */
+inline bool StandardSurface::deliverPointerEvent(PointerEvent *e)
+{
+    assert(e);
+
+    unsigned generation = Node::hitTestGeneration();
+    const std::vector<Node *> *candidates = &m_pointerTargetIndex.candidatesAt(m_sceneRoot, e->positionInSurface());
+    std::vector<Node *> visited;
+
+    unsigned i = 0;
+    while (i < candidates->size()) {
+        Node *node = (*candidates)[i++];
+        if (!visited.empty() && std::find(visited.begin(), visited.end(), node) != visited.end())
+            continue;
+        if (deliverPointerEventToNode(node, e))
+            return true;
+
+        // A handler which rejected the event may still have changed the
+        // scene, so the remaining candidates could be stale. Query again and
+        // skip the ones we have already been to.
+        if (Node::hitTestGeneration() != generation) {
+            generation = Node::hitTestGeneration();
+            visited.insert(visited.end(), candidates->begin(), candidates->begin() + i);
+            candidates = &m_pointerTargetIndex.candidatesAt(m_sceneRoot, e->positionInSurface());
+            i = 0;
+        }
+    }
+
+    return false;
+}
+
+/*!
+    Delivers \a e by traversing the scene below \a node in reverse paint
+    order. This is what deliverPointerEvent() does, without the index.
+ */
 inline bool StandardSurface::deliverPointerEventInScene(Node *node, PointerEvent *e)
 {
     assert(node);
@@ -169,24 +385,29 @@ inline bool StandardSurface::deliverPointerEventInScene(Node *node, PointerEvent
             return true;
         child = child->previousSibling();
     }
-    if (node->isPointerTarget()) {
-        RectangleNodeBase *rectNode = RectangleNodeBase::from(node);
-        if (rectNode) {
-            rect2d area = rectNode->geometry();
-            bool inv = false;
-            mat4 nodeInvMatrix = TransformNode::matrixFor(node, m_renderer->sceneRoot()).inverted(&inv);
-
-            // can only be inside if the matrix is invertible, as otherwise
-            // the node will be "collapsed" in some dimension
-            if (inv) {
-                // Note that this doesn't bother to unset the position afterwards as
-                // we will either:
-                // 1. accept it and the value is correct
-                // 2. reject it and the value will be written next time we try..
-                e->setPosition(nodeInvMatrix * e->positionInSurface());
-                if (area.contains(e->position()) && node->onPointerEvent(e))
-                    return true;
-            }
+    return node->isPointerTarget() && deliverPointerEventToNode(node, e);
+}
+
+inline bool StandardSurface::deliverPointerEventToNode(Node *node, PointerEvent *e)
+{
+    RectangleNodeBase *rectNode = RectangleNodeBase::from(node);
+    if (rectNode) {
+        rect2d area = rectNode->geometry();
+        // The world matrices are cached, so only nodes whose transform
+        // or ancestry changed since the last event are recalculated.
+        bool inv = false;
+        mat4 nodeInvMatrix = node->inverseWorldMatrix(&inv);
+
+        // can only be inside if the matrix is invertible, as otherwise
+        // the node will be "collapsed" in some dimension
+        if (inv) {
+            // Note that this doesn't bother to unset the position afterwards as
+            // we will either:
+            // 1. accept it and the value is correct
+            // 2. reject it and the value will be written next time we try..
+            e->setPosition(nodeInvMatrix * e->positionInSurface());
+            if (area.contains(e->position()) && node->onPointerEvent(e))
+                return true;
         }
     }
 
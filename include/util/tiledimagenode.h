@@ -0,0 +1,556 @@
+/*
+    Copyright (c) 2016, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "resourcemanager.h"
+#include "mipmapjob.h"
+
+#include <list>
+#include <unordered_map>
+#include <cstdio>
+#include <cmath>
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    A TileSource provides the pixel data for a TiledImageNode.
+
+    The image is divided into square tiles of tileSize() pixels at
+    levelCount() resolution levels. Level 0 is the full resolution image and
+    each following level is half the size of the one before it.
+
+    loadTile() is called on the WorkQueue's thread and must only touch state
+    which is not accessed from elsewhere.
+ */
+class TileSource
+{
+public:
+    virtual ~TileSource() { }
+
+    /*!
+        Returns the size of the full resolution image.
+     */
+    virtual vec2 imageSize() const = 0;
+
+    virtual int tileSize() const = 0;
+    virtual int levelCount() const = 0;
+
+    /*!
+        Decodes tile \a x, \a y at \a level into \a pixels as 32-bit
+        premultiplied RGBA and stores its dimensions in \a w and \a h. Returns
+        false if the tile could not be loaded.
+     */
+    virtual bool loadTile(int level, int x, int y, int *w, int *h, std::vector<unsigned> *pixels) = 0;
+
+    /*!
+        Returns the number of levels needed for an image of \a size to fit
+        into a single tile of \a tileSize pixels.
+     */
+    static int levelCountFor(vec2 size, int tileSize) {
+        int levels = 1;
+        float extent = std::max(size.x, size.y);
+        while (extent > tileSize) {
+            extent /= 2;
+            ++levels;
+        }
+        return levels;
+    }
+};
+
+/*!
+    Loads tiles from a pyramid of image files on disk, such as those produced
+    by deep zoom tiling tools. The path of each tile is created by passing
+    level, x and y to the printf-style \a pattern, for instance
+    "map/%d/%d_%d.png".
+
+    This is the source to use for images which do not fit in memory.
+ */
+class FileTileSource : public TileSource
+{
+public:
+    FileTileSource(const std::string &pattern, vec2 imageSize, int tileSize, int levelCount = 0)
+        : m_pattern(pattern)
+        , m_imageSize(imageSize)
+        , m_tileSize(tileSize)
+        , m_levelCount(levelCount > 0 ? levelCount : levelCountFor(imageSize, tileSize))
+    {
+    }
+
+    vec2 imageSize() const override { return m_imageSize; }
+    int tileSize() const override { return m_tileSize; }
+    int levelCount() const override { return m_levelCount; }
+
+    bool loadTile(int level, int x, int y, int *w, int *h, std::vector<unsigned> *pixels) override;
+
+private:
+    std::string m_pattern;
+    vec2 m_imageSize;
+    int m_tileSize;
+    int m_levelCount;
+};
+
+/*!
+    Serves tiles from a single image held in memory, which is typically
+    larger than GL_MAX_TEXTURE_SIZE. The lower resolution levels are
+    computed on demand on the WorkQueue using MipmapJob::downscale().
+ */
+class ImageTileSource : public TileSource
+{
+public:
+    ImageTileSource(int width, int height, std::vector<unsigned> pixels, int tileSize = 256)
+        : m_tileSize(tileSize)
+    {
+        assert(pixels.size() == size_t(width * height));
+        m_levels.resize(levelCountFor(vec2(width, height), tileSize));
+        m_levels[0].width = width;
+        m_levels[0].height = height;
+        m_levels[0].pixels = std::move(pixels);
+    }
+
+    /*!
+        Decodes the image file at \a path using stb_image. Returns null if
+        the file could not be loaded.
+     */
+    static ImageTileSource *fromFile(const std::string &path, int tileSize = 256);
+
+    vec2 imageSize() const override { return vec2(m_levels[0].width, m_levels[0].height); }
+    int tileSize() const override { return m_tileSize; }
+    int levelCount() const override { return (int) m_levels.size(); }
+
+    bool loadTile(int level, int x, int y, int *w, int *h, std::vector<unsigned> *pixels) override;
+
+private:
+    std::vector<MipmapJob::Level> m_levels;
+    int m_tileSize;
+};
+
+/*!
+    The TiledImageNode displays images which are too large to fit in a single
+    texture, or even in memory, such as maps and scanned documents.
+
+    The image is rendered in its own coordinate system, with one unit per
+    pixel of the full resolution image, so it is positioned and zoomed using
+    TransformNode ancestors.
+
+    On every frame, the node maps the target surface back into its own
+    coordinate system to find which tiles are visible and picks the
+    resolution level which best matches the current scale. Missing tiles are
+    decoded on the WorkQueue and uploaded as they complete. Until then, the
+    closest lower resolution tile already in the cache is shown in its place.
+
+    Tiles are kept in a least-recently-used cache and evicted once they
+    exceed memoryBudget() bytes. Tiles which are still being decoded, or
+    which failed to load, count as a full tile, so requests for tiles
+    which are scrolled past quickly can't grow the cache beyond the budget.
+    Tiles which are visible in the current frame are never evicted.
+
+    The tile nodes are only relinked when the set of visible tiles changes,
+    so a static view doesn't invalidate world transforms or the pointer
+    target index on every frame.
+
+    The node creates its own TextureNode children; don't add children to it.
+ */
+class TiledImageNode : public Node
+{
+public:
+    static TiledImageNode *create(Renderer *renderer, WorkQueue *workQueue, const std::shared_ptr<TileSource> &source) {
+        return new TiledImageNode(renderer, workQueue, source);
+    }
+
+    const std::shared_ptr<TileSource> &source() const { return m_source; }
+
+    /*!
+        Sets the maximum number of bytes of texture memory used for cached
+        tiles. The default is 64 megabytes.
+     */
+    void setMemoryBudget(unsigned bytes) { m_memoryBudget = bytes; }
+    unsigned memoryBudget() const { return m_memoryBudget; }
+
+    /*!
+        Returns the number of bytes currently held by cached tiles,
+        including the estimated size of tiles still being decoded.
+     */
+    unsigned memoryUsage() const { return m_memoryUsage; }
+
+    /*!
+        Returns the number of tiles in the cache, including the ones which are
+        still being decoded.
+     */
+    unsigned cachedTileCount() const { return (unsigned) m_tiles.size(); }
+
+    /*!
+        Returns the resolution level picked for the last frame.
+     */
+    int currentLevel() const { return m_currentLevel; }
+
+protected:
+    TiledImageNode(Renderer *renderer, WorkQueue *workQueue, const std::shared_ptr<TileSource> &source)
+        : m_renderer(renderer)
+        , m_workQueue(workQueue)
+        , m_source(source)
+    {
+        assert(renderer);
+        assert(workQueue);
+        assert(source);
+        requestPreprocess();
+    }
+
+    ~TiledImageNode();
+
+    void onPreprocess() override;
+
+private:
+    class LoadJob : public WorkQueue::Job
+    {
+    public:
+        LoadJob(const std::shared_ptr<TileSource> &source, int level, int x, int y)
+            : m_source(source), m_level(level), m_x(x), m_y(y) { }
+
+        void onExecute() override {
+            m_ok = m_source->loadTile(m_level, m_x, m_y, &m_width, &m_height, &m_pixels);
+        }
+
+        std::shared_ptr<TileSource> m_source;
+        std::vector<unsigned> m_pixels;
+        int m_level;
+        int m_x;
+        int m_y;
+        int m_width = 0;
+        int m_height = 0;
+        bool m_ok = false;
+    };
+
+    struct Tile {
+        uint64_t key;
+        int level;
+        int x;
+        int y;
+        std::shared_ptr<LoadJob> job;
+        Texture *texture = nullptr;
+        TextureNode *node = nullptr;
+        unsigned bytes = 0;
+        unsigned usedInFrame = 0;
+        unsigned drawnInFrame = 0;
+        bool failed = false;
+        std::list<Tile *>::iterator lru;
+    };
+
+    static uint64_t keyFor(int level, int x, int y) {
+        return (uint64_t(level) << 48) | (uint64_t(y) << 24) | uint64_t(x);
+    }
+
+    Tile *tileAt(int level, int x, int y, bool load);
+    void relink(const std::vector<Tile *> &tiles);
+    bool finishLoading(Tile *tile);
+    void evict();
+    void release(Tile *tile);
+
+    Renderer *m_renderer;
+    WorkQueue *m_workQueue;
+    std::shared_ptr<TileSource> m_source;
+
+    std::unordered_map<uint64_t, Tile *> m_tiles;
+    std::list<Tile *> m_lru;
+    std::vector<Tile *> m_drawList;
+
+    unsigned m_memoryBudget = 64 * 1024 * 1024;
+    unsigned m_memoryUsage = 0;
+    unsigned m_frame = 0;
+    unsigned m_pendingJobs = 0;
+    int m_currentLevel = 0;
+};
+
+inline bool FileTileSource::loadTile(int level, int x, int y, int *w, int *h, std::vector<unsigned> *pixels)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), m_pattern.c_str(), level, x, y);
+
+    int n;
+    unsigned char *data = stbi_load(path, w, h, &n, 4);
+    if (!data) {
+        logw << "failed to load tile: " << path << std::endl;
+        return false;
+    }
+    rengine_premultiply(data, *w, *h);
+    pixels->resize(*w * *h);
+    memcpy(pixels->data(), data, pixels->size() * sizeof(unsigned));
+    STBI_FREE(data);
+    return true;
+}
+
+inline ImageTileSource *ImageTileSource::fromFile(const std::string &path, int tileSize)
+{
+    int w, h, n;
+    unsigned char *data = stbi_load(path.c_str(), &w, &h, &n, 4);
+    if (!data) {
+        logw << "failed to load image: " << path << std::endl;
+        return nullptr;
+    }
+    rengine_premultiply(data, w, h);
+    std::vector<unsigned> pixels(w * h);
+    memcpy(pixels.data(), data, pixels.size() * sizeof(unsigned));
+    STBI_FREE(data);
+    return new ImageTileSource(w, h, std::move(pixels), tileSize);
+}
+
+inline bool ImageTileSource::loadTile(int level, int x, int y, int *w, int *h, std::vector<unsigned> *pixels)
+{
+    assert(level >= 0 && level < levelCount());
+
+    // Levels are only ever built here, on the work queue's thread, so this
+    // doesn't need any locking.
+    for (int l=1; l<=level; ++l) {
+        const MipmapJob::Level &above = m_levels[l - 1];
+        if (m_levels[l].pixels.empty())
+            MipmapJob::downscale(above.pixels.data(), above.width, above.height, &m_levels[l]);
+    }
+
+    const MipmapJob::Level &src = m_levels[level];
+    int sx = x * m_tileSize;
+    int sy = y * m_tileSize;
+    if (sx >= src.width || sy >= src.height)
+        return false;
+    *w = std::min(m_tileSize, src.width - sx);
+    *h = std::min(m_tileSize, src.height - sy);
+    pixels->resize(*w * *h);
+    for (int line=0; line<*h; ++line)
+        memcpy(pixels->data() + line * *w, src.pixels.data() + (sy + line) * src.width + sx, *w * sizeof(unsigned));
+    return true;
+}
+
+inline TiledImageNode::~TiledImageNode()
+{
+    // The tile nodes are owned by the cache, so take them out of the tree
+    // before ~Node() gets to them.
+    while (Node *c = child())
+        remove(c);
+    for (auto it : m_tiles)
+        release(it.second);
+}
+
+inline void TiledImageNode::release(Tile *tile)
+{
+    if (tile->node)
+        tile->node->destroy();
+    delete tile->texture;
+    m_memoryUsage -= tile->bytes;
+    if (tile->job)
+        --m_pendingJobs;
+    // A job which is still running keeps itself alive through the work
+    // queue's reference and its result is simply dropped.
+    delete tile;
+}
+
+inline TiledImageNode::Tile *TiledImageNode::tileAt(int level, int x, int y, bool load)
+{
+    uint64_t key = keyFor(level, x, y);
+    auto it = m_tiles.find(key);
+    Tile *tile = nullptr;
+    if (it != m_tiles.end()) {
+        tile = it->second;
+        m_lru.splice(m_lru.begin(), m_lru, tile->lru);
+    } else if (load) {
+        tile = new Tile();
+        tile->key = key;
+        tile->level = level;
+        tile->x = x;
+        tile->y = y;
+        tile->bytes = m_source->tileSize() * m_source->tileSize() * 4;
+        m_memoryUsage += tile->bytes;
+        tile->job = std::make_shared<LoadJob>(m_source, level, x, y);
+        m_workQueue->schedule(tile->job);
+        ++m_pendingJobs;
+        m_lru.push_front(tile);
+        tile->lru = m_lru.begin();
+        m_tiles[key] = tile;
+    } else {
+        return nullptr;
+    }
+    tile->usedInFrame = m_frame;
+    return tile;
+}
+
+inline bool TiledImageNode::finishLoading(Tile *tile)
+{
+    if (tile->texture || tile->failed)
+        return tile->texture != nullptr;
+    if (!tile->job->hasCompleted())
+        return false;
+
+    std::shared_ptr<LoadJob> job = std::move(tile->job);
+    --m_pendingJobs;
+    if (!job->m_ok) {
+        tile->failed = true;
+        return false;
+    }
+
+    tile->texture = m_renderer->createTextureFromImageData(vec2(job->m_width, job->m_height),
+                                                           Texture::RGBA_32,
+                                                           job->m_pixels.data());
+    // Replace the estimate we charged while the tile was loading
+    m_memoryUsage -= tile->bytes;
+    tile->bytes = job->m_width * job->m_height * 4;
+    m_memoryUsage += tile->bytes;
+
+    // Tiles are positioned in full resolution image coordinates.
+    float scale = float(1 << tile->level);
+    float size = m_source->tileSize() * scale;
+    tile->node = TextureNode::create(rect2d::fromXywh(tile->x * size,
+                                                      tile->y * size,
+                                                      job->m_width * scale,
+                                                      job->m_height * scale),
+                                     tile->texture);
+    return true;
+}
+
+inline void TiledImageNode::relink(const std::vector<Tile *> &tiles)
+{
+    // Relinking invalidates world transforms and the pointer target index
+    // of the whole scene, so leave the children alone if nothing changed.
+    Node *c = child();
+    unsigned i = 0;
+    while (c && i < tiles.size() && c == tiles[i]->node) {
+        c = c->sibling();
+        ++i;
+    }
+    if (!c && i == tiles.size())
+        return;
+
+    while (Node *c = child())
+        remove(c);
+    for (Tile *tile : tiles)
+        append(tile->node);
+}
+
+inline void TiledImageNode::evict()
+{
+    while (m_memoryUsage > m_memoryBudget && !m_lru.empty()) {
+        Tile *tile = m_lru.back();
+        if (tile->usedInFrame == m_frame)
+            break;
+        m_lru.pop_back();
+        m_tiles.erase(tile->key);
+        release(tile);
+    }
+}
+
+inline void TiledImageNode::onPreprocess()
+{
+    // The visible area depends on ancestor transforms which don't notify us,
+    // so we stay in the preprocess pass for every frame.
+    requestPreprocess();
+    ++m_frame;
+
+    Surface *surface = m_renderer->targetSurface();
+    assert(surface);
+
+    mat4 matrix = worldMatrix();
+    bool invertible;
+    mat4 inverse = inverseWorldMatrix(&invertible);
+    if (!invertible) {
+        relink(std::vector<Tile *>());
+        return;
+    }
+
+    // Map the surface into image coordinates and clip it to the image.
+    vec2 surfaceSize = surface->size();
+    vec2 corners[] = { inverse * vec2(0, 0),
+                       inverse * vec2(surfaceSize.x, 0),
+                       inverse * vec2(0, surfaceSize.y),
+                       inverse * surfaceSize };
+    vec2 tl = corners[0];
+    vec2 br = corners[0];
+    for (int i=1; i<4; ++i) {
+        tl = vec2(std::min(tl.x, corners[i].x), std::min(tl.y, corners[i].y));
+        br = vec2(std::max(br.x, corners[i].x), std::max(br.y, corners[i].y));
+    }
+    vec2 imageSize = m_source->imageSize();
+    tl = vec2(std::max(tl.x, 0.0f), std::max(tl.y, 0.0f));
+    br = vec2(std::min(br.x, imageSize.x), std::min(br.y, imageSize.y));
+
+    m_drawList.clear();
+    if (tl.x < br.x && tl.y < br.y) {
+        // Pick the level where one texel is closest to, but no smaller than,
+        // one device pixel.
+        vec2 origin = matrix * vec2(0, 0);
+        float scale = std::max((matrix * vec2(1, 0) - origin).length(),
+                               (matrix * vec2(0, 1) - origin).length());
+        int level = scale > 0 ? (int) std::floor(std::log2(1.0f / scale)) : 0;
+        level = std::max(0, std::min(level, m_source->levelCount() - 1));
+        m_currentLevel = level;
+
+        float tileExtent = m_source->tileSize() * float(1 << level);
+        int x0 = int(tl.x / tileExtent);
+        int y0 = int(tl.y / tileExtent);
+        int x1 = int(std::ceil(br.x / tileExtent));
+        int y1 = int(std::ceil(br.y / tileExtent));
+
+        std::vector<Tile *> ready;
+        for (int y=y0; y<y1; ++y) {
+            for (int x=x0; x<x1; ++x) {
+                Tile *tile = tileAt(level, x, y, true);
+                if (finishLoading(tile)) {
+                    ready.push_back(tile);
+                    continue;
+                }
+                // Cover the hole with the best lower resolution tile we have.
+                for (int l=level+1; l<m_source->levelCount(); ++l) {
+                    int shift = l - level;
+                    Tile *fallback = tileAt(l, x >> shift, y >> shift, false);
+                    if (fallback && finishLoading(fallback)) {
+                        if (fallback->drawnInFrame != m_frame) {
+                            fallback->drawnInFrame = m_frame;
+                            m_drawList.push_back(fallback);
+                        }
+                        break;
+                    }
+                }
+            }
+        }
+
+        // Coarse fallbacks go below, sharper tiles on top.
+        std::stable_sort(m_drawList.begin(), m_drawList.end(), [] (Tile *a, Tile *b) {
+            return a->level > b->level;
+        });
+        m_drawList.insert(m_drawList.end(), ready.begin(), ready.end());
+    }
+    relink(m_drawList);
+
+    // Pick up tiles which completed without being visible this frame so
+    // their memory is accounted for.
+    if (m_pendingJobs > 0) {
+        for (auto it : m_tiles)
+            finishLoading(it.second);
+    }
+
+    evict();
+
+    // Keep frames coming until all the tiles we asked for have arrived.
+    if (m_pendingJobs > 0)
+        surface->requestRender();
+}
+
+RENGINE_END_NAMESPACE
@@ -28,6 +28,7 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <functional>
 
 RENGINE_BEGIN_NAMESPACE
 
@@ -102,6 +103,14 @@ public:
      */
     void schedule(const std::shared_ptr<Job> &job);
 
+    /*!
+        Sets \a handler to be called on the work queue's thread each time
+        a job has completed. StandardSurface uses this to render a new
+        frame, so the application can pick up the result in update()
+        without polling. This must be set before any jobs are scheduled.
+     */
+    void setCompletionHandler(const std::function<void()> &handler) { m_completionHandler = handler; }
+
 private:
 
     /*!
@@ -114,13 +123,16 @@ private:
     std::mutex m_mutex;
     std::condition_variable m_condition;
     std::list<std::shared_ptr<Job>> m_jobs;
+    std::function<void()> m_completionHandler;
 
     bool m_running = true;
 };
 
 inline WorkQueue::WorkQueue()
-    : m_thread(&WorkQueue::run, this)
 {
+    // Started here rather than in the initializer list so that the thread
+    // doesn't see m_running and friends before they are initialized.
+    m_thread = std::thread(&WorkQueue::run, this);
 }
 
 inline WorkQueue::~WorkQueue()
@@ -140,7 +152,9 @@ inline void WorkQueue::run()
     bool running = m_running;
     while (running) {
         std::unique_lock<std::mutex> locker(m_mutex);
-        if (m_jobs.empty()) {
+        // Check m_running as well, so we don't miss the wakeup from the
+        // destructor if it came while we were busy executing a job.
+        if (m_jobs.empty() && m_running) {
             m_condition.wait(locker);
         }
         std::shared_ptr<Job> job;
@@ -162,6 +176,9 @@ inline void WorkQueue::run()
             job->m_completed = true;
             job->m_condition.notify_one();
             job->m_mutex.unlock();
+
+            if (m_completionHandler)
+                m_completionHandler();
         }
     }
 }
@@ -42,8 +42,27 @@ public:
 
     inline Type type() const { return m_type; }
 
+    /*!
+        When the input behind this event happened, as reported by the
+        backend, on the monotonic steady_clock. For a coalesced move, this
+        is the time of the newest sample. Default constructed if not known.
+     */
+    std::chrono::steady_clock::time_point timestamp() const { return m_timestamp; }
+    void setTimestamp(std::chrono::steady_clock::time_point timestamp) { m_timestamp = timestamp; }
+
 private:
 	Type m_type;
+    std::chrono::steady_clock::time_point m_timestamp;
+};
+
+/*!
+    A raw pointer position as reported by the input device, in surface
+    coordinates.
+ */
+struct PointerSample
+{
+    vec2 position;
+    std::chrono::steady_clock::time_point time;
 };
 
 class PointerEvent : public Event
@@ -86,6 +105,35 @@ public:
 	vec2 position() const { return m_pos; }
 
 
+    /*!
+
+        The time the event's position corresponds to. This is the same as
+        timestamp(), except for a resampled move where it is the time the
+        frame is expected to be presented.
+
+     */
+    void setTime(std::chrono::steady_clock::time_point time) { m_time = time; }
+    std::chrono::steady_clock::time_point time() const { return m_time; }
+
+
+    /*!
+
+        When the backend coalesces several moves into one event, the raw
+        samples it was made from are available here, oldest first. The
+        samples are owned by the backend and are only valid during delivery.
+
+     */
+    void setHistory(const PointerSample *samples, unsigned count) {
+        m_history = samples;
+        m_historySize = count;
+    }
+    unsigned historySize() const { return m_historySize; }
+    const PointerSample &history(unsigned i) const {
+        assert(i < m_historySize);
+        return m_history[i];
+    }
+
+
     static PointerEvent *from(Event *e) {
         assert(e->type() == PointerUp || e->type() == PointerDown || e->type() == PointerMove);
         return static_cast<PointerEvent *>(e);
@@ -94,6 +142,9 @@ public:
 private:
     vec2 m_pos;
     vec2 m_posInSurface;
+    std::chrono::steady_clock::time_point m_time;
+    const PointerSample *m_history = nullptr;
+    unsigned m_historySize = 0;
 };
 
 RENGINE_END_NAMESPACE
\ No newline at end of file
@@ -0,0 +1,209 @@
+/*
+    Copyright (c) 2016, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstdlib>
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    Counters kept by the PointerInputStage.
+ */
+struct PointerInputStats
+{
+    // Number of moves reported by the device and delivered to the surface.
+    unsigned long long rawMoveCount = 0;
+    unsigned long long deliveredMoveCount = 0;
+
+    // Seconds from the oldest sample in a coalesced move until it was
+    // delivered, averaged over all delivered moves and the worst case.
+    double averageLatency = 0;
+    double maxLatency = 0;
+
+    // Seconds which resampled moves have been extrapolated beyond the
+    // newest sample, on average.
+    double averagePrediction = 0;
+};
+
+/*!
+    Collects pointer moves from a backend so that they can be delivered
+    once per frame instead of once per device report.
+
+    Moves are queued with addMove() and handed out as a single PointerEvent
+    by takeMove(). The raw samples remain available through the event's
+    history. When resampling is enabled, the delivered position is run
+    through a KalmanFilter2D per axis, as the sfhwc backend does for touch,
+    and extrapolated to the time the frame is expected to be presented,
+    which hides some of the latency between input and display.
+
+    Resampling can be turned off with the RENGINE_POINTER_RESAMPLING=0
+    environment variable.
+ */
+class PointerInputStage
+{
+public:
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    PointerInputStage() {
+        const char *env = std::getenv("RENGINE_POINTER_RESAMPLING");
+        if (env)
+            m_resampling = std::atoi(env) != 0;
+
+        // Unlike touch, a mouse reports exact positions and changes speed
+        // quickly, so let the filter follow the input closely.
+        m_x.setNoise(1.0f, 1000.0f, 0.1f);
+        m_y.setNoise(1.0f, 1000.0f, 0.1f);
+    }
+
+    /*!
+        Queues a move to \a position which the device reported at \a time.
+     */
+    void addMove(vec2 position, time_point time) {
+        m_pending.push_back(PointerSample { position, time });
+        ++m_stats.rawMoveCount;
+    }
+
+    bool hasPendingMoves() const { return !m_pending.empty(); }
+
+    /*!
+        Coalesces all pending moves into \a event and returns true, or
+        returns false if there were none.
+
+        With resampling, the position is predicted for \a targetTime, but
+        never further ahead of the newest sample than maxPrediction(). Pass a
+        default constructed time_point to get the newest sample as is, for
+        instance to flush moves before delivering a press or release.
+
+        The history set on \a event stays valid until the next call.
+     */
+    bool takeMove(PointerEvent *event, time_point targetTime = time_point(),
+                  time_point now = std::chrono::steady_clock::now());
+
+    /*!
+        Discards pending moves and restarts the filter at \a position. Call
+        this when the pointer is pressed or released.
+     */
+    void reset(vec2 position, time_point time);
+
+    bool resamplingEnabled() const { return m_resampling; }
+    void setResamplingEnabled(bool enabled) { m_resampling = enabled; }
+
+    /*!
+        The maximum number of seconds a position is extrapolated. Defaults
+        to 20ms, a little more than one frame at 60Hz.
+     */
+    double maxPrediction() const { return m_maxPrediction; }
+    void setMaxPrediction(double seconds) { m_maxPrediction = seconds; }
+
+    const PointerInputStats &stats() const { return m_stats; }
+    void resetStats() { m_stats = PointerInputStats(); }
+
+private:
+    static double seconds(std::chrono::steady_clock::duration d) {
+        return std::chrono::duration<double>(d).count();
+    }
+
+    std::vector<PointerSample> m_pending;
+    std::vector<PointerSample> m_history;
+
+    KalmanFilter2D m_x;
+    KalmanFilter2D m_y;
+    PointerSample m_last;
+    bool m_filterValid = false;
+
+    bool m_resampling = true;
+    double m_maxPrediction = 0.020;
+
+    PointerInputStats m_stats;
+};
+
+inline bool PointerInputStage::takeMove(PointerEvent *event, time_point targetTime, time_point now)
+{
+    assert(event);
+    assert(event->type() == Event::PointerMove);
+
+    if (m_pending.empty())
+        return false;
+
+    m_history.swap(m_pending);
+    m_pending.clear();
+
+    const PointerSample &newest = m_history.back();
+    vec2 position = newest.position;
+    time_point time = newest.time;
+
+    if (m_resampling) {
+        // Feed the filter once per delivered move, like updateTouch() does
+        // once per frame, with the velocity since the previous delivery.
+        // After a pause, the filter starts over from the newest sample.
+        double dt = seconds(newest.time - m_last.time);
+        if (!m_filterValid || dt > 0.1) {
+            const PointerSample &oldest = m_history.front();
+            double span = seconds(newest.time - oldest.time);
+            vec2 velocity = span > 0 ? (newest.position - oldest.position) / span : vec2();
+            m_x.initialize(newest.position.x, velocity.x);
+            m_y.initialize(newest.position.y, velocity.y);
+            m_filterValid = true;
+        } else if (dt > 0) {
+            vec2 velocity = (newest.position - m_last.position) / dt;
+            m_x.update(newest.position.x, velocity.x, dt);
+            m_y.update(newest.position.y, velocity.y, dt);
+        }
+
+        double prediction = 0;
+        if (targetTime > newest.time)
+            prediction = std::min(seconds(targetTime - newest.time), m_maxPrediction);
+        position = vec2(m_x.position(), m_y.position())
+                 + vec2(m_x.velocity(), m_y.velocity()) * prediction;
+        time = newest.time + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(prediction));
+
+        m_stats.averagePrediction += (prediction - m_stats.averagePrediction) / (m_stats.deliveredMoveCount + 1);
+    }
+    m_last = newest;
+
+    double latency = std::max(0.0, seconds(now - m_history.front().time));
+    ++m_stats.deliveredMoveCount;
+    m_stats.averageLatency += (latency - m_stats.averageLatency) / m_stats.deliveredMoveCount;
+    m_stats.maxLatency = std::max(m_stats.maxLatency, latency);
+
+    event->initialize(position);
+    event->setTime(time);
+    event->setTimestamp(newest.time);
+    event->setHistory(m_history.data(), m_history.size());
+    return true;
+}
+
+inline void PointerInputStage::reset(vec2 position, time_point time)
+{
+    m_pending.clear();
+    m_last = PointerSample { position, time };
+    m_x.initialize(position.x, 0);
+    m_y.initialize(position.y, 0);
+    m_filterValid = true;
+}
+
+RENGINE_END_NAMESPACE
@@ -25,6 +25,10 @@
 
 #pragma once
 
+#ifdef RENGINE_LATENCY_TRACKING
+#include <mutex>
+#endif
+
 RENGINE_BEGIN_NAMESPACE
 
 /*!
@@ -59,6 +63,14 @@ public:
      */
     virtual bool commitRender() = 0;
 
+    /*!
+        Implement in the backend to release the rendering context from the
+        calling thread, so that beginRender() can be called on another
+        thread afterwards. This is used by the threaded render loop in
+        StandardSurface.
+     */
+    virtual void releaseRender() { }
+
     /*!
         Implement in the backend to report the size of a surface to the application
      */
@@ -72,10 +84,18 @@ public:
 
     /*!
         Implement in the backend to respond to requests for Surface::onRender() to
-        be called.
+        be called. This function may be called from any thread.
      */
     virtual void requestRender() = 0;
 
+    /*!
+        Implement in the backend to respond to requests for Surface::onRender()
+        to be called once \a time has been reached, without using any CPU in
+        the meantime. The default implementation requests a render right
+        away, leaving it to the surface to ask again.
+     */
+    virtual void requestRenderAt(std::chrono::steady_clock::time_point time) { requestRender(); }
+
     /*!
         Implement in the backend to create a renderer compatible with this surface
      */
@@ -86,6 +106,27 @@ public:
      */
     virtual vec2 dpi() const = 0;
 
+    /*!
+        Implement in the backend to report the interval between two refreshes
+        of the display in seconds. Returns 0 if it is not known.
+     */
+    virtual double vsyncInterval() const { return 0; }
+
+    /*!
+        Implement in the backend to report when the last frame was presented
+        on screen, or when the display was last refreshed if that is all the
+        backend knows. Returns a default constructed time_point if it is not
+        known. This function may be called from any thread.
+     */
+    virtual std::chrono::steady_clock::time_point presentationTime() const { return std::chrono::steady_clock::time_point(); }
+
+    /*!
+        Implement in the backend to give access to the stage which coalesces
+        and resamples pointer moves, for its settings and statistics.
+        Returns null if the backend delivers moves as they arrive.
+     */
+    virtual PointerInputStage *pointerInput() { return nullptr; }
+
 };
 
 class Surface
@@ -105,20 +146,46 @@ public:
 
     void show() { m_impl->show(); }
 
-    bool beginRender() { return m_impl->beginRender(); }
+    bool beginRender() {
+#ifdef RENGINE_LATENCY_TRACKING
+        latchInput();
+#endif
+        return m_impl->beginRender();
+    }
 
-    bool commitRender() { return m_impl->commitRender(); }
+    bool commitRender() {
+        bool committed = m_impl->commitRender();
+#ifdef RENGINE_LATENCY_TRACKING
+        recordPresentedInput();
+#endif
+        return committed;
+    }
+
+    void releaseRender() { m_impl->releaseRender(); }
 
     vec2 size() const { return m_impl->size(); }
 
     void requestSize(vec2 size) { m_impl->requestSize(size); }
 
-    void requestRender() { m_impl->requestRender(); }
+    void requestRender() {
+#ifdef RENGINE_LATENCY_TRACKING
+        markInput();
+#endif
+        m_impl->requestRender();
+    }
+
+    void requestRenderAt(std::chrono::steady_clock::time_point time) { m_impl->requestRenderAt(time); }
 
     Renderer *createRenderer() { return m_impl->createRenderer(); }
 
     vec2 dpi() const { return m_impl->dpi(); }
 
+    double vsyncInterval() const { return m_impl->vsyncInterval(); }
+
+    std::chrono::steady_clock::time_point presentationTime() const { return m_impl->presentationTime(); }
+
+    PointerInputStage *pointerInput() { return m_impl->pointerInput(); }
+
     /*!
         Reimplement this function get notified when it is time to
         render the surface
@@ -134,7 +201,87 @@ public:
      */
     virtual void onEvent(Event *) { }
 
+    /*!
+        Called by the backend to deliver \a e through onEvent().
+
+        With RENGINE_LATENCY_TRACKING defined, an event which leads to a
+        render request is attributed to the next frame, and the time from
+        the event's timestamp until that frame has been committed is
+        recorded in inputLatency().
+     */
+    void sendEvent(Event *e) {
+#ifdef RENGINE_LATENCY_TRACKING
+        setDeliveringEvent(e);
+        onEvent(e);
+        setDeliveringEvent(nullptr);
+#else
+        onEvent(e);
+#endif
+    }
+
+#ifdef RENGINE_LATENCY_TRACKING
+    /*!
+        Returns a snapshot of the input-to-present latencies of this surface.
+     */
+    LatencyHistogram inputLatency() const {
+        std::lock_guard<std::mutex> locker(m_latencyMutex);
+        return m_inputLatency;
+    }
+
+    void resetInputLatency() {
+        std::lock_guard<std::mutex> locker(m_latencyMutex);
+        m_inputLatency.reset();
+    }
+#endif
+
 private:
+#ifdef RENGINE_LATENCY_TRACKING
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    void setDeliveringEvent(Event *e) {
+        std::lock_guard<std::mutex> locker(m_latencyMutex);
+        m_deliveringEvent = e;
+    }
+
+    // Called from requestRender(), remembers the oldest event which asked
+    // for a new frame.
+    void markInput() {
+        std::lock_guard<std::mutex> locker(m_latencyMutex);
+        if (!m_deliveringEvent || m_deliveringEvent->timestamp() == time_point())
+            return;
+        time_point t = m_deliveringEvent->timestamp();
+        if (m_pendingInput == time_point() || t < m_pendingInput)
+            m_pendingInput = t;
+    }
+
+    // Called when a frame starts, which is while the main thread is
+    // blocked in the threaded render loop, so the frame takes exactly the
+    // input which was synchronized into it.
+    void latchInput() {
+        std::lock_guard<std::mutex> locker(m_latencyMutex);
+        if (m_pendingInput != time_point()
+            && (m_frameInput == time_point() || m_pendingInput < m_frameInput))
+            m_frameInput = m_pendingInput;
+        m_pendingInput = time_point();
+    }
+
+    void recordPresentedInput() {
+        std::lock_guard<std::mutex> locker(m_latencyMutex);
+        if (m_frameInput == time_point())
+            return;
+        double latency = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_frameInput).count();
+        m_inputLatency.record(latency);
+        m_frameInput = time_point();
+        logd << "input-to-present latency: " << latency * 1000 << "ms" << std::endl;
+    }
+
+    Event *m_deliveringEvent = nullptr;
+    mutable std::mutex m_latencyMutex;
+    time_point m_pendingInput;
+    time_point m_frameInput;
+    LatencyHistogram m_inputLatency;
+#endif
+
     SurfaceBackendImpl *m_impl;
 };
 
@@ -0,0 +1,99 @@
+/*
+    Copyright (c) 2016, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "test.h"
+
+class TickRecorder : public AbstractAnimation
+{
+public:
+    void tick(double time) override {
+        times.push_back(time);
+        if (time >= duration())
+            setRunning(false);
+    }
+
+    std::vector<double> times;
+};
+
+void tst_animationManager_fixedStep()
+{
+    AnimationManager manager;
+    manager.setFixedStep(0.25);
+
+    auto animation = std::make_shared<TickRecorder>();
+    manager.start(animation, 0.5);
+    check_true(manager.isRunning());
+    check_true(manager.nextScheduledStart() == manager.nextFrameTime() + std::chrono::milliseconds(500));
+    for (int i=0; i<8; ++i)
+        manager.tick();
+    check_true(manager.nextScheduledStart() == std::chrono::steady_clock::time_point::max());
+
+    // Starts at t=0 on the third tick, then advances one step per tick
+    check_equal(animation->times.size(), 5u);
+    for (unsigned i=0; i<animation->times.size(); ++i)
+        check_equal(animation->times[i], i * 0.25);
+    check_true(!manager.isRunning());
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_animationManager_presentationTime()
+{
+    typedef std::chrono::steady_clock steady_clock;
+
+    AnimationManager manager;
+    manager.setFrameInterval(1.0 / 120.0);
+    steady_clock::duration interval = std::chrono::duration_cast<steady_clock::duration>(std::chrono::duration<double>(1.0 / 120.0));
+
+    // Nothing presented yet, the next refresh is one interval out
+    steady_clock::time_point before = steady_clock::now();
+    steady_clock::time_point t = manager.nextFrameTime();
+    check_true(t > before);
+    check_true(t <= steady_clock::now() + interval);
+
+    // Presented a while ago, the missed refreshes are skipped, but the
+    // phase is kept.
+    steady_clock::time_point presented = before - std::chrono::milliseconds(500) - std::chrono::microseconds(123);
+    manager.setPresentationTime(presented);
+    t = manager.nextFrameTime();
+    check_true(t > before);
+    check_true(t <= steady_clock::now() + interval);
+    check_equal((t - presented).count() % interval.count(), 0);
+
+    // Ticks never go backwards in time
+    manager.tick();
+    manager.setPresentationTime(presented - std::chrono::seconds(1));
+    check_true(manager.nextFrameTime() >= t);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+int main(int, char **)
+{
+    tst_animationManager_fixedStep();
+    tst_animationManager_presentationTime();
+
+    return 0;
+}
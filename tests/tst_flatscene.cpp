@@ -0,0 +1,131 @@
+/*
+    Copyright (c) 2016, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "test.h"
+
+void tst_flatScene_build()
+{
+    FlatScene scene;
+    FlatScene::Handle root = scene.beginGroup();
+    FlatScene::Handle tx = scene.beginTransform(mat4::translate2D(10, 20));
+    FlatScene::Handle r1 = scene.addRectangle(rect2d::fromXywh(0, 0, 5, 5), vec4(1, 0, 0, 1));
+    FlatScene::Handle op = scene.beginOpacity(0.5);
+    FlatScene::Handle r2 = scene.addRectangle(rect2d::fromXywh(1, 1, 5, 5), vec4(0, 1, 0, 1));
+    scene.end();
+    scene.end();
+    FlatScene::Handle r3 = scene.addRectangle(rect2d::fromXywh(2, 2, 5, 5), vec4(0, 0, 1, 1));
+    scene.end();
+
+    // Depth-first order, with the subtrees as ranges
+    check_equal(scene.size(), 6u);
+    check_equal(root, 0u);
+    check_equal(tx, 1u);
+    check_equal(r1, 2u);
+    check_equal(op, 3u);
+    check_equal(r2, 4u);
+    check_equal(r3, 5u);
+    check_equal(scene.subtreeEnd(root), 6u);
+    check_equal(scene.subtreeEnd(tx), 5u);
+    check_equal(scene.subtreeEnd(op), 5u);
+    check_equal(scene.subtreeEnd(r1), 3u);
+    check_equal(scene.parent(r2), op);
+    check_equal(scene.parent(r3), root);
+    check_true(scene.parent(root) == FlatScene::InvalidHandle);
+
+    check_equal(scene.worldMatrix(r2), mat4::translate2D(10, 20));
+    check_equal(scene.worldMatrix(r3), mat4());
+    check_true(fuzzy_equals(scene.worldOpacity(r2), 0.5f));
+    check_true(fuzzy_equals(scene.worldOpacity(r1), 1.0f));
+
+    // Properties change in place
+    scene.setMatrix(tx, mat4::translate2D(1, 2));
+    scene.setOpacity(op, 0.25);
+    scene.setColor(r1, vec4(1, 1, 1, 1));
+    check_equal(scene.worldMatrix(r2), mat4::translate2D(1, 2));
+    check_true(fuzzy_equals(scene.worldOpacity(r2), 0.25f));
+    check_equal(scene.color(r1), vec4(1, 1, 1, 1));
+
+    // Drawables come in paint order
+    std::vector<FlatScene::Handle> drawn;
+    scene.forEachDrawable([&] (FlatScene::Handle h, const mat4 &m, const rect2d &, vec4, const Texture *, float) {
+        check_equal(m, scene.worldMatrix(h));
+        drawn.push_back(h);
+    });
+    check_equal(drawn.size(), 3u);
+    check_equal(drawn[0], r1);
+    check_equal(drawn[1], r2);
+    check_equal(drawn[2], r3);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_flatScene_fromTree()
+{
+    Node *root = Node::create();
+    TransformNode *tx = TransformNode::create();
+    tx->setMatrix(mat4::translate2D(10, 0) * mat4::scale2D(2, 2));
+    OpacityNode *op = OpacityNode::create();
+    op->setOpacity(0.5);
+    RectangleNode *r1 = RectangleNode::create(rect2d::fromXywh(0, 0, 5, 5), vec4(1, 0, 0, 1));
+    RectangleNode *r2 = RectangleNode::create(rect2d::fromXywh(0, 0, 5, 5), vec4(0, 1, 0, 1));
+    TransformNode *inner = TransformNode::create();
+    inner->setMatrix(mat4::translate2D(0, 7));
+    RectangleNode *r3 = RectangleNode::create(rect2d::fromXywh(1, 1, 3, 3), vec4(0, 0, 1, 1));
+    *root << &(*tx << &(*op << r1) << &(*inner << r3)) << r2;
+
+    FlatScene scene;
+    check_equal(scene.build(root), 0u);
+    check_equal(scene.size(), 7u);
+
+    // Same order as a depth-first traversal of the tree
+    Node *expected[] = { root, tx, op, r1, inner, r3, r2 };
+    for (unsigned i=0; i<7; ++i)
+        check_equal(scene.sourceNode(i), expected[i]);
+    check_equal(scene.kind(1), FlatScene::TransformKind);
+    check_equal(scene.kind(2), FlatScene::OpacityKind);
+    check_equal(scene.kind(3), FlatScene::RectangleKind);
+    check_equal(scene.subtreeEnd(1), 6u);
+    check_equal(scene.parent(6), 0u);
+
+    // World matrices match the node tree
+    for (unsigned i=0; i<7; ++i)
+        check_equal(scene.worldMatrix(i), expected[i]->worldMatrix());
+    check_true(fuzzy_equals(scene.worldOpacity(3), 0.5f));
+    check_true(fuzzy_equals(scene.worldOpacity(5), 1.0f));
+    check_equal(scene.geometry(5), r3->geometry());
+    check_equal(scene.color(6), r2->color());
+
+    root->destroy();
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+int main(int, char **)
+{
+    tst_flatScene_build();
+    tst_flatScene_fromTree();
+
+    return 0;
+}
@@ -0,0 +1,94 @@
+/*
+    Copyright (c) 2016, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Always build this test with the instrumentation, so that it compiles.
+#ifndef RENGINE_LATENCY_TRACKING
+#define RENGINE_LATENCY_TRACKING
+#endif
+
+#include "test.h"
+
+void tst_latencyHistogram()
+{
+    LatencyHistogram histogram;
+    check_equal(histogram.count(), 0u);
+    check_equal(histogram.percentile(50), 0.0);
+
+    // 1ms to 100ms in 1ms steps
+    for (int i=1; i<=100; ++i)
+        histogram.record(i / 1000.0);
+
+    check_equal(histogram.count(), 100u);
+    check_true(fuzzy_equals(histogram.min(), 0.001f));
+    check_true(fuzzy_equals(histogram.max(), 0.100f));
+    check_true(fuzzy_equals(histogram.average(), 0.0505f));
+    check_true(fuzzy_equals(histogram.percentile(50), 0.050f, 0.0006f));
+    check_true(fuzzy_equals(histogram.percentile(90), 0.090f, 0.0006f));
+    check_true(fuzzy_equals(histogram.percentile(99), 0.099f, 0.0006f));
+    check_true(fuzzy_equals(histogram.percentile(100), 0.100f));
+    check_equal(histogram.overflowCount(), 0u);
+
+    // Outliers beyond the last bucket report the maximum
+    histogram.record(0.5);
+    histogram.record(0.7);
+    check_equal(histogram.overflowCount(), 2u);
+    check_true(fuzzy_equals(histogram.percentile(100), 0.7f));
+    check_true(fuzzy_equals(histogram.percentile(50), 0.051f, 0.0006f));
+
+    histogram.reset();
+    check_equal(histogram.count(), 0u);
+    check_equal(histogram.overflowCount(), 0u);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_eventTimestamp()
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    PointerEvent pe(Event::PointerDown);
+    check_true(pe.timestamp() == std::chrono::steady_clock::time_point());
+    pe.setTimestamp(now);
+    check_true(pe.timestamp() == now);
+
+    // Coalesced moves carry the time of the newest sample
+    PointerInputStage stage;
+    stage.setResamplingEnabled(false);
+    stage.addMove(vec2(1, 1), now);
+    stage.addMove(vec2(2, 2), now + std::chrono::milliseconds(1));
+    PointerEvent move(Event::PointerMove);
+    check_true(stage.takeMove(&move));
+    check_true(move.timestamp() == now + std::chrono::milliseconds(1));
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+int main(int, char **)
+{
+    tst_latencyHistogram();
+    tst_eventTimestamp();
+
+    return 0;
+}
@@ -258,6 +258,13 @@ void tst_rect2d_intersect()
     check_equal(r.tl, vec2(-4, -8));
     check_equal(r.br, vec2(-1, -2));
 
+    rect2d a(0, 0, 10, 10);
+    check_equal((a & rect2d(5, -5, 20, 5)), rect2d(5, 0, 10, 5));
+    check_true(a.intersects(rect2d(9, 9, 11, 11)));
+    check_true(!a.intersects(rect2d(10, 0, 20, 10)));
+    check_true((a & rect2d(20, 20, 30, 30)).isEmpty());
+    check_true((a & infBox).isEmpty());
+
     cout << __PRETTY_FUNCTION__ << ": ok" << endl;
 }
 
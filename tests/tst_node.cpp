@@ -26,6 +26,8 @@
 
 #include "test.h"
 
+#include <thread>
+
 template <typename T> bool tst_node_cast_helper()
 {
     Node *org = T::create();
@@ -234,15 +236,691 @@ void tst_noderef()
     cout << __FUNCTION__ << ": ok!" << endl;
 }
 
+void tst_rectangleListNode()
+{
+    RectangleListNode *list = RectangleListNode::create(4);
+    check_true(list->isDirty());
+    check_equal(list->dirtyBegin(), 0u);
+    check_equal(list->dirtyEnd(), 4u);
+
+    list->resetDirty();
+    check_true(!list->isDirty());
+
+    list->setRect(2, rect2d::fromXywh(10, 20, 5, 5));
+    list->setRect(1, rect2d::fromXywh(-5, 0, 5, 5));
+    check_equal(list->dirtyBegin(), 1u);
+    check_equal(list->dirtyEnd(), 3u);
+    check_equal(list->boundingRect(), rect2d(-5, 0, 15, 25));
+
+    list->resetDirty();
+    list->markDirty(3, 10);
+    check_equal(list->dirtyEnd(), 4u);
+
+    SpriteListNode *sprites = SpriteListNode::create(2, nullptr);
+    check_equal(sprites->color(1), vec4(1, 1, 1, 1));
+    check_equal(sprites->texCoords(1), rect2d(0, 0, 1, 1));
+    check_true(SpriteListNode::from(sprites) == sprites);
+    check_true(RectangleListNode::from(sprites) == nullptr);
+
+    list->destroy();
+    sprites->destroy();
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_particleSystemNode()
+{
+    ParticleSystemNode *ps = ParticleSystemNode::create(12);
+    ps->setEmitterRect(rect2d(10, 10, 10, 10));
+    ps->setEmissionRate(10);
+    ps->setLifetime(1, 1);
+    ps->setVelocity(vec2(100, 0), vec2(100, 0));
+    ps->setSize(4, 2);
+    ps->setColor(vec4(1, 1, 1, 1), vec4(0, 0, 0, 0));
+
+    // 10 particles/sec for 0.45 sec -> 4 particles, the rest is carried over
+    ps->advance(0.45f);
+    check_equal(ps->particleCount(), 4u);
+    check_equal(ps->size(), 4u);
+    check_equal(ps->rect(0), rect2d(8, 8, 12, 12));
+
+    // Existing particles move and shrink, five more are emitted
+    ps->advance(0.5f);
+    check_equal(ps->particleCount(), 9u);
+    check_equal(ps->rect(0), rect2d(60 - 1.5f, 10 - 1.5f, 60 + 1.5f, 10 + 1.5f));
+    check_equal(ps->color(0), vec4(0.5f, 0.5f, 0.5f, 0.5f));
+
+    // The first four expire, the new ones are capped at maxParticles
+    ps->advance(0.8f);
+    check_equal(ps->particleCount(), 12u);
+
+    // Everything expires when emission stops
+    ps->setEmissionRate(0);
+    ps->advance(1.0f);
+    check_equal(ps->particleCount(), 0u);
+    check_equal(ps->size(), 0u);
+
+    check_true(ParticleSystemNode::from(ps) == ps);
+    check_true(SpriteListNode::from(ps) == nullptr);
+
+    ps->destroy();
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+class NinePatchTexture : public Texture
+{
+public:
+    NinePatchTexture(vec2 size = vec2(30, 30)) : m_size(size) { }
+    vec2 size() const override { return m_size; }
+    Format format() const override { return RGBA_32; }
+    GLuint textureId() const override { return 0; }
+private:
+    vec2 m_size;
+};
+
+static bool fuzzyEqual(rect2d a, rect2d b)
+{
+    return std::abs(a.tl.x - b.tl.x) < 0.0001f && std::abs(a.tl.y - b.tl.y) < 0.0001f
+        && std::abs(a.br.x - b.br.x) < 0.0001f && std::abs(a.br.y - b.br.y) < 0.0001f;
+}
+
+void tst_ninePatchNode()
+{
+    NinePatchTexture texture;
+    const float third = 1.0f / 3.0f;
+    NinePatchNode *node = NinePatchNode::create(&texture, vec4(10, 10, 10, 10), rect2d(0, 0, 100, 50));
+    node->preprocess();
+    check_equal(node->size(), 9u);
+    check_equal(node->rect(0), rect2d(0, 0, 10, 10));
+    check_true(fuzzyEqual(node->texCoords(0), rect2d(0, 0, third, third)));
+    check_equal(node->rect(4), rect2d(10, 10, 90, 40));
+    check_true(fuzzyEqual(node->texCoords(4), rect2d(third, third, 2 * third, 2 * third)));
+    check_equal(node->rect(8), rect2d(90, 40, 100, 50));
+    check_true(fuzzyEqual(node->texCoords(8), rect2d(2 * third, 2 * third, 1, 1)));
+    check_equal(node->boundingRect(), rect2d(0, 0, 100, 50));
+
+    // 65 pixels of middle, tiled 10 at a time: 6 full tiles and a half one
+    node->setGeometry(rect2d(0, 0, 85, 50));
+    node->setEdgeMode(NinePatchNode::Tile, NinePatchNode::Stretch);
+    node->preprocess();
+    check_equal(node->size(), 27u);
+    check_equal(node->rect(1), rect2d(10, 0, 20, 10));
+    check_true(fuzzyEqual(node->texCoords(1), rect2d(third, 0, 2 * third, third)));
+    check_equal(node->rect(7), rect2d(70, 0, 75, 10));
+    check_true(fuzzyEqual(node->texCoords(7), rect2d(third, 0, 0.5f, third)));
+    check_equal(node->rect(8), rect2d(75, 0, 85, 10));
+
+    // Too small for the margins, so they are scaled down
+    node->setGeometry(rect2d(0, 0, 10, 50));
+    node->preprocess();
+    check_equal(node->size(), 6u);
+    check_equal(node->rect(0), rect2d(0, 0, 5, 10));
+    check_equal(node->rect(1), rect2d(5, 0, 10, 10));
+
+    // Swapping the texture through the base class must still regenerate the
+    // texture coordinates for the new size
+    NinePatchTexture larger(vec2(60, 60));
+    node->setGeometry(rect2d(0, 0, 100, 50));
+    node->setEdgeMode(NinePatchNode::Stretch, NinePatchNode::Stretch);
+    node->preprocess();
+    static_cast<SpriteListNode *>(node)->setTexture(&larger);
+    node->preprocess();
+    check_equal(node->size(), 9u);
+    check_true(fuzzyEqual(node->texCoords(0), rect2d(0, 0, 1.0f / 6.0f, 1.0f / 6.0f)));
+    check_true(fuzzyEqual(node->texCoords(8), rect2d(5.0f / 6.0f, 5.0f / 6.0f, 1, 1)));
+
+    check_true(NinePatchNode::from(node) == node);
+    node->destroy();
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_sceneMirror()
+{
+    Node *root = Node::create();
+    RectangleNode *rect = RectangleNode::create(rect2d::fromXywh(1, 2, 3, 4), vec4(1, 0, 0, 1));
+    TransformNode *xform = TransformNode::create(mat4::translate2D(10, 20));
+    RectangleListNode *list = RectangleListNode::create(4);
+    *root << rect << &(*xform << list);
+
+    SceneMirror mirror;
+    Node *mroot = mirror.sync(root);
+    check_true(mroot != root);
+    check_equal(mroot->type(), Node::BasicNodeType);
+    check_equal(mirror.size(), 4u);
+    check_equal(mroot->childCount(), 2);
+
+    RectangleNode *mrect = RectangleNode::from(mroot->child());
+    check_true(mrect == mirror.mirrorOf(rect));
+    check_equal(mrect->geometry(), rect2d::fromXywh(1, 2, 3, 4));
+    check_equal(mrect->color(), vec4(1, 0, 0, 1));
+    TransformNode *mxform = TransformNode::from(mrect->sibling());
+    check_equal(mxform->matrix(), mat4::translate2D(10, 20));
+    RectangleListNode *mlist = RectangleListNode::from(mxform->child());
+    check_equal(mlist->size(), 4u);
+
+    // Properties are copied, only the dirty range of lists
+    check_true(!list->isDirty());
+    mlist->resetDirty();
+    rect->setColor(vec4(0, 1, 0, 1));
+    list->setRect(2, rect2d::fromXywh(5, 5, 5, 5));
+    check_true(mirror.sync(root) == mroot);
+    check_equal(mrect->color(), vec4(0, 1, 0, 1));
+    check_equal(mlist->rect(2), rect2d::fromXywh(5, 5, 5, 5));
+    check_equal(mlist->dirtyBegin(), 2u);
+    check_equal(mlist->dirtyEnd(), 3u);
+
+    // Reordered, moved, added and removed children
+    root->remove(rect);
+    *root << rect;
+    xform->remove(list);
+    *root << list;
+    OpacityNode *opacity = OpacityNode::create(0.5);
+    *xform << opacity;
+    mirror.sync(root);
+    check_equal(mroot->childCount(), 3);
+    check_true(mroot->child() == mxform);
+    check_true(mxform->sibling() == mrect);
+    check_true(mrect->sibling() == mlist);
+    check_equal(OpacityNode::from(mxform->child())->opacity(), 0.5f);
+
+    xform->destroy();
+    mirror.sync(root);
+    check_equal(mirror.size(), 3u);
+    check_equal(mroot->childCount(), 2);
+    check_true(mirror.mirrorOf(xform) == nullptr);
+
+    // Derived types are mirrored as what is rendered
+    NinePatchNode *ninePatch = NinePatchNode::create(nullptr, vec4(), rect2d::fromXywh(0, 0, 10, 10));
+    *root << ninePatch;
+    mirror.sync(root);
+    check_equal(mirror.mirrorOf(ninePatch)->type(), Node::SpriteListNodeType);
+
+    mirror.sync(nullptr);
+    check_equal(mirror.size(), 0u);
+    root->destroy();
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_sceneMirrorIncremental()
+{
+    Node *root = Node::create();
+    std::vector<RectangleNode *> rects;
+    for (int i=0; i<10; ++i) {
+        TransformNode *xform = TransformNode::create(mat4::translate2D(i, 0));
+        for (int j=0; j<10; ++j) {
+            RectangleNode *rect = RectangleNode::create(rect2d::fromXywh(0, j, 1, 1));
+            rects.push_back(rect);
+            *xform << rect;
+        }
+        *root << xform;
+    }
+
+    SceneMirror mirror;
+    Node *mroot = mirror.sync(root);
+    check_equal(mirror.size(), 111u);
+    check_equal(mirror.copyCount(), 111u);
+
+    // Nothing changed, nothing is copied
+    check_true(mirror.sync(root) == mroot);
+    check_equal(mirror.copyCount(), 0u);
+
+    // Only the changed node is copied
+    RectangleNode *rect = rects[57];
+    RectangleNode *mrect = RectangleNode::from(mirror.mirrorOf(rect));
+    rect->setColor(vec4(0, 0, 1, 1));
+    mirror.sync(root);
+    check_equal(mirror.copyCount(), 1u);
+    check_equal(mrect->color(), vec4(0, 0, 1, 1));
+    check_true(mirror.mirrorOf(rect) == mrect);
+
+    // A removed subtree is destroyed, a new node is the only copy
+    Node *xform = root->child();
+    root->remove(xform);
+    *rect->parent() << RectangleNode::create();
+    mirror.sync(root);
+    check_equal(mirror.copyCount(), 1u);
+    check_equal(mirror.size(), 101u);
+    check_true(mirror.mirrorOf(xform) == nullptr);
+    check_true(mirror.mirrorOf(rects[0]) == nullptr);
+    check_equal(mroot->childCount(), 9);
+
+    // Adding it back mirrors it again
+    *root << xform;
+    mirror.sync(root);
+    check_equal(mirror.copyCount(), 11u);
+    check_equal(mirror.size(), 112u);
+    check_true(mirror.mirrorOf(xform)->parent() == mroot);
+    check_equal(mroot->childCount(), 10);
+
+    mirror.clear();
+    root->destroy();
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_worldMatrix()
+{
+    Node *root = Node::create();
+    TransformNode *a = TransformNode::create(mat4::translate2D(10, 20));
+    TransformNode *b = TransformNode::create(mat4::scale2D(2, 2));
+    RectangleNode *rect = RectangleNode::create(rect2d(0, 0, 10, 10));
+    *root << &(*a << &(*b << rect));
+
+    check_equal(rect->worldMatrix(), (mat4::translate2D(10, 20) * mat4::scale2D(2, 2)));
+    check_equal(rect->worldMatrix(), TransformNode::matrixFor(rect, root));
+    check_equal(a->worldMatrix(), mat4::translate2D(10, 20));
+    check_equal(root->worldMatrix(), mat4());
+
+    bool invertible = false;
+    check_equal((rect->inverseWorldMatrix(&invertible) * vec2(30, 40)), vec2(10, 10));
+    check_true(invertible);
+
+    // Changing an ancestor's transform invalidates the cached matrix
+    a->setMatrix(mat4::translate2D(100, 0));
+    check_equal(rect->worldMatrix(), (mat4::translate2D(100, 0) * mat4::scale2D(2, 2)));
+    check_equal((rect->inverseWorldMatrix() * vec2(120, 20)), vec2(10, 10));
+
+    // So does reparenting
+    b->remove(rect);
+    check_equal(rect->worldMatrix(), mat4());
+    *a << rect;
+    check_equal(rect->worldMatrix(), mat4::translate2D(100, 0));
+
+    // Changes in one subtree leave a sibling subtree's matrices intact, and
+    // repeated changes before the next query are all picked up
+    TransformNode *c = TransformNode::create(mat4::translate2D(0, 5));
+    RectangleNode *other = RectangleNode::create(rect2d(0, 0, 10, 10));
+    *root << &(*c << other);
+    check_equal(other->worldMatrix(), mat4::translate2D(0, 5));
+    a->setMatrix(mat4::translate2D(1, 0));
+    a->setMatrix(mat4::translate2D(2, 0));
+    check_equal(b->worldMatrix(), (mat4::translate2D(2, 0) * mat4::scale2D(2, 2)));
+    a->setMatrix(mat4::translate2D(3, 0));
+    check_equal(rect->worldMatrix(), mat4::translate2D(3, 0));
+    check_equal(b->worldMatrix(), (mat4::translate2D(3, 0) * mat4::scale2D(2, 2)));
+    check_equal(other->worldMatrix(), mat4::translate2D(0, 5));
+    c->setMatrix(mat4::translate2D(0, 6));
+    check_equal(other->worldMatrix(), mat4::translate2D(0, 6));
+    a->setMatrix(mat4::translate2D(100, 0));
+
+    // A non-invertible transform
+    b->setMatrix(mat4::scale2D(0, 1));
+    check_equal(b->worldMatrix(), (mat4::translate2D(100, 0) * mat4::scale2D(0, 1)));
+    b->inverseWorldMatrix(&invertible);
+    check_true(!invertible);
+
+    // matrixFor() relative to a node which is not the top of the tree
+    check_equal(TransformNode::matrixFor(rect, a), mat4::translate2D(100, 0));
+    check_equal(TransformNode::matrixFor(b, b), mat4::scale2D(0, 1));
+
+    root->destroy();
+
+    // A tree far deeper than the stack would allow recursing through. It is
+    // built from the bottom up, so every node is still stale.
+    Node *leaf = Node::create();
+    Node *top = leaf;
+    for (int i=0; i<200000; ++i) {
+        TransformNode *t = TransformNode::create(mat4::translate2D(1, 0));
+        *t << top;
+        top = t;
+    }
+    check_equal(leaf->worldMatrix(), mat4::translate2D(200000, 0));
+    TransformNode::from(top)->setMatrix(mat4::translate2D(2, 0));
+    check_equal(leaf->worldMatrix(), mat4::translate2D(200001, 0));
+    top->destroy();
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+static bool isHit(Node *node, vec2 pos)
+{
+    RectangleNodeBase *rect = RectangleNodeBase::from(node);
+    bool invertible = false;
+    mat4 inv = node->inverseWorldMatrix(&invertible);
+    return rect && invertible && rect->geometry().contains(inv * pos);
+}
+
+static void hitsByTraversal(Node *node, vec2 pos, std::vector<Node *> *hits)
+{
+    for (Node *child = node->lastChild(); child; child = child->previousSibling())
+        hitsByTraversal(child, pos, hits);
+    if (node->isPointerTarget() && isHit(node, pos))
+        hits->push_back(node);
+}
+
+static bool checkPointerTargetIndex(PointerTargetIndex *index, Node *root)
+{
+    for (float y=-55; y<600; y+=7.3f) {
+        for (float x=-55; x<600; x+=7.3f) {
+            std::vector<Node *> expected;
+            hitsByTraversal(root, vec2(x, y), &expected);
+            std::vector<Node *> actual;
+            for (Node *n : index->candidatesAt(root, vec2(x, y)))
+                if (isHit(n, vec2(x, y)))
+                    actual.push_back(n);
+            if (actual != expected)
+                return false;
+        }
+    }
+    return true;
+}
+
+void tst_pointerTargetIndex()
+{
+    Node *root = Node::create();
+
+    RectangleNode *background = RectangleNode::create(rect2d(0, 0, 500, 500));
+    background->setPointerTarget(true);
+    *root << background;
+
+    // A grid of targets, some of them inside rotated, scaled and 3D
+    // transforms, and one which can't be inverted.
+    std::vector<RectangleNode *> cells;
+    for (int y=0; y<20; ++y) {
+        TransformNode *rowNode = TransformNode::create(mat4::translate2D(0, y * 25));
+        for (int x=0; x<20; ++x) {
+            RectangleNode *cell = RectangleNode::create(rect2d::fromXywh(x * 25, 0, 20, 20));
+            cell->setPointerTarget((x + y) % 7 != 0);
+            cells.push_back(cell);
+            if (x % 5 == 1)
+                *rowNode << &(*TransformNode::create(mat4::rotate2D(0.3f)) << cell);
+            else if (x % 5 == 2)
+                *rowNode << &(*TransformNode::create(mat4::scale2D(1.5f, 0.5f)) << cell);
+            else if (x % 5 == 3)
+                *rowNode << &(*TransformNode::create(mat4::rotateAroundY(0.8f)) << cell);
+            else if (x == 19 && y == 19)
+                *rowNode << &(*TransformNode::create(mat4::scale2D(0, 1)) << cell);
+            else
+                *rowNode << cell;
+        }
+        *root << rowNode;
+    }
+
+    PointerTargetIndex index;
+    check_true(checkPointerTargetIndex(&index, root));
+    check_equal(index.targetCount(), 343u);
+
+    // Only the nearby cells and the background are candidates
+    check_true(index.candidatesAt(root, vec2(110, 60)).size() < 10);
+    check_true(index.candidatesAt(root, vec2(110, 60)).back() == background);
+
+    // Changes to geometry, transforms, pointer target state and structure
+    // are picked up by the index
+    cells[42]->setGeometry(rect2d(300, 300, 400, 350));
+    static_cast<TransformNode *>(root->lastChild())->setMatrix(mat4::translate2D(50, 50) * mat4::rotate2D(-0.5f));
+    cells[100]->setPointerTarget(!cells[100]->isPointerTarget());
+    cells[200]->parent()->remove(cells[200]);
+    cells[200]->destroy();
+    check_true(checkPointerTargetIndex(&index, root));
+
+    // Moving targets only updates their entries, and changes to leaves
+    // which are not targets or to other trees are ignored, so none of
+    // these rebuild the index
+    unsigned rebuilds = index.rebuildCount();
+    Node *row3 = cells[3 * 20]->parent();
+    static_cast<TransformNode *>(row3)->setMatrix(mat4::translate2D(30, 80) * mat4::rotate2D(0.2f));
+    cells[50]->setGeometry(rect2d(-40, -40, -10, 550));
+    cells[300]->setGeometry(rect2d::fromXywh(5, 3, 10, 10));
+    RectangleNode *decoration = RectangleNode::create(rect2d(0, 0, 5, 5));
+    *row3 << decoration;
+    Node *otherRoot = Node::create();
+    RectangleNode *otherTarget = RectangleNode::create(rect2d(0, 0, 5, 5));
+    otherTarget->setPointerTarget(true);
+    *otherRoot << otherTarget;
+    check_true(checkPointerTargetIndex(&index, root));
+    check_equal(index.rebuildCount(), rebuilds);
+    row3->remove(decoration);
+    decoration->destroy();
+    otherRoot->destroy();
+    check_true(checkPointerTargetIndex(&index, root));
+    check_equal(index.rebuildCount(), rebuilds);
+
+    // Adding a target to the tree does
+    RectangleNode *added = RectangleNode::create(rect2d(0, 0, 40, 40));
+    added->setPointerTarget(true);
+    *row3 << added;
+    check_true(checkPointerTargetIndex(&index, root));
+    check_equal(index.rebuildCount(), rebuilds + 1);
+
+    root->destroy();
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+struct PoolObject
+{
+    PoolObject() { ++alive; }
+    ~PoolObject() { --alive; }
+    static int alive;
+    double payload[3];
+};
+int PoolObject::alive = 0;
+
+void tst_allocationPool()
+{
+    AllocationPool<PoolObject> pool;
+    pool.setChunkSize(4);
+    check_equal(pool.capacity(), 0u);
+
+    // Grows on demand, roughly doubling
+    std::vector<PoolObject *> objects;
+    for (int i=0; i<20; ++i) {
+        PoolObject *o = pool.allocate();
+        check_true(o != 0);
+        check_true(pool.isAllocated(o));
+        objects.push_back(o);
+    }
+    check_equal(PoolObject::alive, 20);
+    check_equal(pool.allocatedCount(), 20u);
+    check_equal(pool.capacity(), 32u);
+    check_equal(pool.chunkCount(), 4u);
+    check_equal(pool.fallbackCount(), 0u);
+
+    PoolObject outside;
+    check_true(!pool.isAllocated(&outside));
+
+    // Freed slots are reused before the pool grows
+    pool.deallocate(objects[3]);
+    check_equal(PoolObject::alive, 20);
+    PoolObject *freed = objects[3];
+    objects.erase(objects.begin() + 3);
+    for (int i=0; i<13; ++i)
+        objects.push_back(pool.allocate());
+    check_equal(pool.capacity(), 32u);
+    check_true(std::find(objects.begin(), objects.end(), freed) != objects.end());
+    check_equal(pool.peakAllocatedCount(), 32u);
+
+    // Empty chunks are kept unless asked to release them
+    for (PoolObject *o : objects)
+        pool.deallocate(o);
+    objects.clear();
+    check_equal(PoolObject::alive, 1);
+    check_equal(pool.allocatedCount(), 0u);
+    check_equal(pool.capacity(), 32u);
+    pool.releaseEmptyChunks();
+    check_equal(pool.capacity(), 0u);
+    check_equal(pool.chunkCount(), 0u);
+
+    pool.setReleaseEmptyChunks(true);
+    pool.reserve(8);
+    check_equal(pool.capacity(), 8u);
+    PoolObject *o = pool.allocate();
+    pool.deallocate(o);
+    check_equal(pool.capacity(), 0u);
+
+    // A limited pool reports when it can't grow
+    pool.setMaxCapacity(6);
+    for (int i=0; i<6; ++i)
+        objects.push_back(pool.allocate());
+    check_true(pool.isExhausted());
+    check_true(pool.allocate() == 0);
+    check_equal(pool.fallbackCount(), 1u);
+    check_equal(pool.capacity(), 6u);
+    for (PoolObject *o : objects)
+        pool.deallocate(o);
+    check_equal(PoolObject::alive, 1);
+
+    // Nodes fall back to new when their pool is full
+    AllocationPool<Node> *nodePool = Node::allocationPool();
+    unsigned maxCapacity = nodePool->maxCapacity();
+    nodePool->reserve(nodePool->allocatedCount() + 4);
+    nodePool->setMaxCapacity(nodePool->capacity());
+    std::vector<Node *> nodes;
+    while (!nodePool->isExhausted())
+        nodes.push_back(Node::create());
+    Node *heapNode = Node::create();
+    check_true(!heapNode->__is_pool_allocated());
+    check_true(nodePool->fallbackCount() > 0);
+    heapNode->destroy();
+    for (Node *n : nodes)
+        n->destroy();
+    nodePool->setMaxCapacity(maxCapacity);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_allocationPool_threaded()
+{
+    AllocationPool<Node> *nodePool = Node::allocationPool();
+    AllocationPool<RectangleNode> *rectPool = RectangleNode::allocationPool();
+    unsigned nodeCount = nodePool->allocatedCount();
+    unsigned rectCount = rectPool->allocatedCount();
+
+    // Build and tear down subtrees on several threads at once, handing
+    // some of them over to be destroyed on another thread
+    const int threadCount = 4;
+    std::vector<Node *> handedOver[threadCount];
+    std::vector<std::thread> threads;
+    for (int t=0; t<threadCount; ++t) {
+        threads.push_back(std::thread([t, &handedOver] {
+            for (int i=0; i<200; ++i) {
+                Node *root = Node::create();
+                for (int j=0; j<20; ++j)
+                    root->append(&(*Node::create() << RectangleNode::create()));
+                if (i % 10 == 0)
+                    handedOver[t].push_back(root);
+                else
+                    root->destroy();
+            }
+        }));
+    }
+    for (std::thread &t : threads)
+        t.join();
+
+    check_equal(nodePool->allocatedCount(), (nodeCount + threadCount * 20 * 21));
+    check_equal(rectPool->allocatedCount(), (rectCount + threadCount * 20 * 20));
+
+    threads.clear();
+    for (int t=0; t<threadCount; ++t) {
+        threads.push_back(std::thread([t, &handedOver] {
+            for (Node *root : handedOver[(t + 1) % threadCount])
+                root->destroy();
+        }));
+    }
+    for (std::thread &t : threads)
+        t.join();
+
+    check_equal(nodePool->allocatedCount(), nodeCount);
+    check_equal(rectPool->allocatedCount(), rectCount);
+
+    // Releasing empty chunks makes other threads hand back their cached
+    // slots the next time they use the pool
+    AllocationPool<PoolObject> pool;
+    std::atomic<int> step(0);
+    std::thread worker([&pool, &step] {
+        std::vector<PoolObject *> objects;
+        for (int i=0; i<10; ++i)
+            objects.push_back(pool.allocate());
+        for (PoolObject *o : objects)
+            pool.deallocate(o);
+        step = 1;
+        while (step != 2)
+            std::this_thread::yield();
+        pool.deallocate(pool.allocate());
+    });
+    while (step != 1)
+        std::this_thread::yield();
+    check_equal(pool.allocatedCount(), 0u);
+    pool.setReleaseEmptyChunks(true);
+    check_true(pool.capacity() > 0);
+    step = 2;
+    worker.join();
+    check_equal(pool.capacity(), 0u);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_destroySubtree()
+{
+    AllocationPool<Node> *nodePool = Node::allocationPool();
+    unsigned nodeCount = nodePool->allocatedCount();
+
+    // Destructors of all nodes run, and the parent is left intact
+    int destroyed = 0;
+    class CountingNode : public Node {
+    public:
+        int *m_counter;
+        CountingNode(int *counter) : m_counter(counter) { }
+        ~CountingNode() { ++*m_counter; }
+    };
+    Node *root = Node::create();
+    Node *keep = Node::create();
+    Node *subtree = new CountingNode(&destroyed);
+    *root << keep << subtree;
+    for (int i=0; i<10; ++i) {
+        Node *n = new CountingNode(&destroyed);
+        subtree->append(n);
+        n->append(new CountingNode(&destroyed));
+    }
+    subtree->destroySubtree();
+    check_equal(destroyed, 21);
+    check_equal(root->child(), keep);
+    check_equal(root->lastChild(), keep);
+    check_true(keep->sibling() == 0);
+    root->destroy();
+
+    // Very wide and very deep trees
+    root = Node::create();
+    for (int i=0; i<20000; ++i)
+        root->append(Node::create());
+    root->destroySubtree();
+    check_equal(nodePool->allocatedCount(), nodeCount);
+
+    root = Node::create();
+    Node *n = root;
+    for (int i=0; i<500000; ++i) {
+        Node *c = Node::create();
+        n->append(c);
+        n = c;
+    }
+    root->destroy();
+    check_equal(nodePool->allocatedCount(), nodeCount);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
 int main(int, char **)
 {
     tst_node_cast();
     tst_node_addRemoveParent();
     // tst_node_injectEvict();
 
-    // tst_node_allocator();
+    tst_node_allocator();
+    tst_allocationPool();
+    tst_allocationPool_threaded();
+    tst_destroySubtree();
 
     tst_noderef();
+    tst_rectangleListNode();
+    tst_particleSystemNode();
+    tst_ninePatchNode();
+    tst_sceneMirror();
+    tst_sceneMirrorIncremental();
+    tst_worldMatrix();
+    tst_pointerTargetIndex();
 
     return 0;
 }
@@ -0,0 +1,123 @@
+/*
+    Copyright (c) 2016, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "test.h"
+
+typedef std::chrono::steady_clock::time_point time_point;
+
+static time_point at(double seconds)
+{
+    return time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds)));
+}
+
+void tst_pointerInput_coalescing()
+{
+    PointerInputStage stage;
+    stage.setResamplingEnabled(false);
+
+    PointerEvent pe(Event::PointerMove);
+    check_true(!stage.takeMove(&pe));
+
+    // 16 moves within one frame become a single event with all of them
+    // in the history
+    for (int i=0; i<16; ++i)
+        stage.addMove(vec2(i, 2 * i), at(1.0 + i * 0.001));
+    check_true(stage.hasPendingMoves());
+    check_true(stage.takeMove(&pe, time_point(), at(1.020)));
+    check_true(!stage.hasPendingMoves());
+
+    check_equal(pe.positionInSurface(), vec2(15, 30));
+    check_true(pe.time() == at(1.015));
+    check_equal(pe.historySize(), 16u);
+    check_equal(pe.history(0).position, vec2(0, 0));
+    check_true(pe.history(0).time == at(1.0));
+    check_equal(pe.history(15).position, vec2(15, 30));
+
+    check_true(!stage.takeMove(&pe));
+
+    const PointerInputStats &stats = stage.stats();
+    check_equal(stats.rawMoveCount, 16u);
+    check_equal(stats.deliveredMoveCount, 1u);
+    check_true(fuzzy_equals(stats.averageLatency, 0.020f));
+    check_true(fuzzy_equals(stats.maxLatency, 0.020f));
+
+    stage.resetStats();
+    check_equal(stage.stats().rawMoveCount, 0u);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_pointerInput_resampling()
+{
+    PointerInputStage stage;
+    stage.setResamplingEnabled(true);
+    stage.setMaxPrediction(0.020);
+    stage.reset(vec2(0, 100), at(1.0));
+
+    // Move at a steady 1000 pixels per second, delivering once per 16ms
+    // frame and predicting 8ms ahead of the newest sample.
+    PointerEvent pe(Event::PointerMove);
+    double t = 1.0;
+    for (int frame=0; frame<30; ++frame) {
+        for (int i=0; i<16; ++i) {
+            t += 0.001;
+            stage.addMove(vec2((t - 1.0) * 1000, 100), at(t));
+        }
+        check_true(stage.takeMove(&pe, at(t + 0.008), at(t)));
+    }
+    check_equal(pe.historySize(), 16u);
+    check_true(pe.time() == at(t + 0.008));
+
+    // The filter has converged on the velocity, so the position is
+    // extrapolated rather than lagging behind the newest sample.
+    float newest = (t - 1.0) * 1000;
+    check_true(fuzzy_equals(pe.positionInSurface().x, newest + 8, 1.0f));
+    check_true(fuzzy_equals(pe.positionInSurface().y, 100, 0.01f));
+    check_true(fuzzy_equals(stage.stats().averagePrediction, 0.008f, 0.0001f));
+
+    // Prediction is capped
+    t += 0.001;
+    stage.addMove(vec2((t - 1.0) * 1000, 100), at(t));
+    check_true(stage.takeMove(&pe, at(t + 1.0), at(t)));
+    check_true(pe.time() == at(t + 0.020));
+
+    // A press starts over, without the old velocity
+    stage.addMove(vec2(500, 500), at(t + 0.001));
+    stage.reset(vec2(500, 500), at(t + 0.001));
+    check_true(!stage.hasPendingMoves());
+    stage.addMove(vec2(500, 500), at(t + 0.002));
+    check_true(stage.takeMove(&pe, at(t + 0.010), at(t + 0.002)));
+    check_true(fuzzy_equals(pe.positionInSurface(), vec2(500, 500), 0.5f));
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+int main(int, char **)
+{
+    tst_pointerInput_coalescing();
+    tst_pointerInput_resampling();
+
+    return 0;
+}
@@ -0,0 +1,157 @@
+/*
+    Copyright (c) 2016, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "test.h"
+
+#include <unistd.h>
+
+// None of this needs an OpenGL context; only the file handling and keying
+// of the cache is tested.
+
+static std::string tst_tempDir()
+{
+    char dir[] = "/tmp/rengine_programcacheXXXXXX";
+    check_true(mkdtemp(dir) != 0);
+    return dir;
+}
+
+static std::vector<char> tst_readFile(const std::string &path)
+{
+    std::vector<char> data;
+    FILE *file = fopen(path.c_str(), "rb");
+    check_true(file != 0);
+    char buffer[256];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data.insert(data.end(), buffer, buffer + n);
+    fclose(file);
+    return data;
+}
+
+static void tst_writeFile(const std::string &path, const std::vector<char> &data)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    check_true(file != 0);
+    if (!data.empty())
+        check_equal(fwrite(data.data(), data.size(), 1, file), 1u);
+    fclose(file);
+}
+
+void tst_programBinaryCache_keys()
+{
+    std::vector<const char *> attrs = { "aV", "aT" };
+    uint64_t key = OpenGLProgramBinaryCache::sourceHash("vsh", "fsh", attrs);
+    check_equal(key, OpenGLProgramBinaryCache::sourceHash("vsh", "fsh", attrs));
+
+    // Every part of the program counts, as do the boundaries between them
+    check_true(key != OpenGLProgramBinaryCache::sourceHash("vsh2", "fsh", attrs));
+    check_true(key != OpenGLProgramBinaryCache::sourceHash("vsh", "fsh2", attrs));
+    check_true(key != OpenGLProgramBinaryCache::sourceHash("vsh", "fsh", { "aV" }));
+    check_true(key != OpenGLProgramBinaryCache::sourceHash("vsh", "fsh", { "aT", "aV" }));
+    check_true(OpenGLProgramBinaryCache::sourceHash("ab", "c", attrs)
+               != OpenGLProgramBinaryCache::sourceHash("a", "bc", attrs));
+
+    OpenGLProgramBinaryCache cache;
+    cache.setDirectory("/some/dir");
+    check_equal(cache.pathFor(0x1234), std::string("/some/dir/0000000000001234.bin"));
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_programBinaryCache_entries()
+{
+    std::string dir = tst_tempDir();
+    std::string path = dir + "/entry.bin";
+    std::string driver = "vendor|renderer|version";
+    std::vector<char> binary = { 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+
+    GLenum format = 0;
+    std::vector<char> loaded;
+
+    // Missing file
+    check_true(!OpenGLProgramBinaryCache::readEntry(path, 42, driver, &format, &loaded));
+
+    // Round trip, without leaving the temporary file behind
+    check_true(OpenGLProgramBinaryCache::writeEntry(path, 42, driver, 0x1234, binary));
+    check_true(access((path + ".tmp").c_str(), F_OK) != 0);
+    check_true(OpenGLProgramBinaryCache::readEntry(path, 42, driver, &format, &loaded));
+    check_equal(format, GLenum(0x1234));
+    check_true(loaded == binary);
+
+    // Other sources or another driver
+    check_true(!OpenGLProgramBinaryCache::readEntry(path, 43, driver, &format, &loaded));
+    check_true(loaded.empty());
+    check_true(!OpenGLProgramBinaryCache::readEntry(path, 42, "vendor|renderer|version2", &format, &loaded));
+    check_true(!OpenGLProgramBinaryCache::readEntry(path, 42, "vendor|renderer|versioX", &format, &loaded));
+
+    std::vector<char> file = tst_readFile(path);
+
+    // Truncated anywhere: in the header, the driver string or the binary
+    for (size_t size : { size_t(0), size_t(4), size_t(20), file.size() - binary.size() - 2, file.size() - 1 }) {
+        tst_writeFile(path, std::vector<char>(file.begin(), file.begin() + size));
+        check_true(!OpenGLProgramBinaryCache::readEntry(path, 42, driver, &format, &loaded));
+    }
+
+    // Trailing garbage
+    std::vector<char> longer = file;
+    longer.push_back(0);
+    tst_writeFile(path, longer);
+    check_true(!OpenGLProgramBinaryCache::readEntry(path, 42, driver, &format, &loaded));
+
+    // A flipped byte in the binary fails the checksum, in the magic it
+    // fails the header check
+    std::vector<char> corrupt = file;
+    corrupt.back() ^= 0xff;
+    tst_writeFile(path, corrupt);
+    check_true(!OpenGLProgramBinaryCache::readEntry(path, 42, driver, &format, &loaded));
+    corrupt = file;
+    corrupt[0] = 'X';
+    tst_writeFile(path, corrupt);
+    check_true(!OpenGLProgramBinaryCache::readEntry(path, 42, driver, &format, &loaded));
+
+    // An absurd length in the header is rejected without reading it
+    corrupt = file;
+    memset(corrupt.data() + 28, 0xff, 4); // Header::length, after magic, version, driverLength, sourceHash and format
+    tst_writeFile(path, corrupt);
+    check_true(!OpenGLProgramBinaryCache::readEntry(path, 42, driver, &format, &loaded));
+
+    // The original still reads fine
+    tst_writeFile(path, file);
+    check_true(OpenGLProgramBinaryCache::readEntry(path, 42, driver, &format, &loaded));
+
+    remove(path.c_str());
+    rmdir(dir.c_str());
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+int main(int, char **)
+{
+    tst_programBinaryCache_keys();
+    tst_programBinaryCache_entries();
+
+    return 0;
+}
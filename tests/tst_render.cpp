@@ -209,6 +209,202 @@ public:
     }
 };
 
+class RectangleLists : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "RectangleLists"; }
+
+    Node *build() override {
+        Node *root = Node::create();
+
+        RectangleListNode *list = RectangleListNode::create(3);
+        list->setRect(0, rect2d::fromXywh(0, 0, 10, 10));
+        list->setColor(0, vec4(1, 0, 0, 1));
+        list->setRect(1, rect2d::fromXywh(10, 0, 10, 10));
+        list->setColor(1, vec4(0, 1, 0, 1));
+        list->setRect(2, rect2d::fromXywh(20, 0, 10, 10));
+        list->setColor(2, vec4(0, 0, 1, 0.5));
+        *root << list;
+
+        // Transformed and inside an opacity layer
+        OpacityNode *opacity = OpacityNode::create(0.5);
+        TransformNode *xform = TransformNode::create(mat4::translate2D(0, 20));
+        RectangleListNode *faded = RectangleListNode::create(1);
+        faded->setRect(0, rect2d::fromXywh(0, 0, 10, 10));
+        faded->setColor(0, vec4(1, 1, 1, 1));
+        *root << &(*opacity << &(*xform << faded));
+
+        return root;
+    }
+
+    void check() override {
+        check_pixel( 5,  5, vec4(1, 0, 0, 1));
+        check_pixel(15,  5, vec4(0, 1, 0, 1));
+        check_pixel(25,  5, vec4(0, 0, 0.5, 1));
+        check_pixel(35,  5, vec4(0, 0, 0, 1));
+        check_pixel( 5, 25, vec4(0.5, 0.5, 0.5, 1));
+        check_pixel(15, 25, vec4(0, 0, 0, 1));
+    }
+};
+
+class Clipping : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "Clipping"; }
+
+    Node *build() override {
+        Node *root = Node::create();
+
+        // Axis-aligned, uses the scissor test. The blue rect is outside
+        // and gets culled.
+        ClipNode *clip = ClipNode::create(rect2d::fromXywh(10, 10, 20, 20));
+        *clip << RectangleNode::create(rect2d::fromXywh(0, 0, 40, 40), vec4(1, 0, 0, 1))
+              << RectangleNode::create(rect2d::fromXywh(50, 0, 10, 10), vec4(0, 0, 1, 1));
+        *root << clip;
+
+        // Nested, the result is the intersection
+        ClipNode *outer = ClipNode::create(rect2d::fromXywh(50, 10, 20, 20));
+        ClipNode *inner = ClipNode::create(rect2d::fromXywh(60, 0, 20, 20));
+        *inner << RectangleNode::create(rect2d::fromXywh(40, 0, 40, 40), vec4(0, 1, 0, 1));
+        *root << &(*outer << inner);
+
+        // Rotated by 45 degrees, uses the stencil buffer
+        TransformNode *xform = TransformNode::create(mat4::translate2D(120, 20) * mat4::rotate2D(M_PI / 4));
+        ClipNode *rotated = ClipNode::create(rect2d::fromXywh(-10, -10, 20, 20));
+        *rotated << RectangleNode::create(rect2d::fromXywh(-20, -20, 40, 40), vec4(1, 1, 1, 1));
+        *root << &(*xform << rotated);
+
+        return root;
+    }
+
+    void check() override {
+        check_pixelsOutside(rect2d::fromXywh(10, 10, 20, 20), vec4(0, 0, 0, 1));
+        check_pixel(10, 10, vec4(1, 0, 0, 1));
+        check_pixel(29, 29, vec4(1, 0, 0, 1));
+        check_pixel(55, 5, vec4(0, 0, 0, 1));
+
+        check_pixel(59, 15, vec4(0, 0, 0, 1));
+        check_pixel(60, 10, vec4(0, 1, 0, 1));
+        check_pixel(69, 19, vec4(0, 1, 0, 1));
+        check_pixel(70, 15, vec4(0, 0, 0, 1));
+        check_pixel(65, 20, vec4(0, 0, 0, 1));
+
+        check_pixel(120, 20, vec4(1, 1, 1, 1));
+        check_pixel(120, 8, vec4(1, 1, 1, 1));
+        check_pixel(111, 11, vec4(0, 0, 0, 1));
+        check_pixel(129, 29, vec4(0, 0, 0, 1));
+    }
+};
+
+class LayerPromotion : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "LayerPromotion"; }
+
+    Node *build() override {
+        Node *root = Node::create();
+        Node *expensive = Node::create();
+        for (int i=0; i<20; ++i)
+            *expensive << RectangleNode::create(rect2d::fromXywh(i * 2, 0, 2, 10), vec4(i / 19.0f, 0, 1, 1));
+        *root << expensive;
+
+        OpenGLRenderer *renderer = static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer());
+        OpenGLRenderer::LayerPromotionPolicy policy;
+        policy.minimumCost = 16;
+        policy.stableFrames = 2;
+        renderer->setLayerPromotionPolicy(policy);
+        renderer->setLayerPromotionEnabled(true);
+
+        // Observed, stable, promoted and rendered into the cache, drawn from the cache
+        renderer->setSceneRoot(root);
+        for (int i=0; i<5; ++i)
+            renderer->render();
+        check_equal(renderer->layerPromotionStats().promotions, 1u);
+        check_equal(renderer->layerPromotionStats().promotedLayers, 1u);
+        check_equal(renderer->layerPromotionStats().cachedDraws, 1u);
+        check_equal(renderer->layerPromotionStats().bytes, size_t(40 * 10 * 4));
+
+        // Changing it demotes it again
+        static_cast<RectangleNode *>(expensive->child())->setColor(vec4(0, 1, 0, 1));
+        renderer->render();
+        check_equal(renderer->layerPromotionStats().demotions, 1u);
+        check_equal(renderer->layerPromotionStats().promotedLayers, 0u);
+        renderer->setSceneRoot(nullptr);
+
+        return root;
+    }
+
+    void check() override {
+        check_pixel(0, 5, vec4(0, 1, 0, 1));
+        check_pixel(39, 5, vec4(1, 0, 1, 1));
+        check_pixel(40, 5, vec4(0, 0, 0, 1));
+    }
+};
+
+class BakedEffects : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "BakedEffects"; }
+
+    Node *build() override {
+        Renderer *renderer = static_cast<StandardSurface *>(surface())->renderer();
+
+        Node *source = RectangleNode::create(rect2d::fromXywh(0, 0, 10, 10), vec4(1, 0, 0, 1));
+        m_source = renderer->createTextureFromSubtree(source, rect2d::fromXywh(0, 0, 10, 10));
+        source->destroy();
+        check_equal(m_source->size(), vec2(10, 10));
+
+        m_blurred = renderer->createTextureWithBlurFromTexture(m_source, 4);
+        check_equal(m_blurred->size(), vec2(18, 18));
+
+        vec2 sourcePosition;
+        m_shadowed = renderer->createTextureWithShadowFromTexture(m_source, 4, vec2(3, 3), vec4(0, 0, 1, 1), &sourcePosition);
+        check_equal(sourcePosition, vec2(1, 1));
+        check_equal(m_shadowed->size(), vec2(18, 18));
+
+        mat4 swapRedAndGreen(0, 1, 0, 0,
+                             1, 0, 0, 0,
+                             0, 0, 1, 0,
+                             0, 0, 0, 1);
+        m_filtered = renderer->createTextureWithColorFilterFromTexture(m_source, swapRedAndGreen);
+        check_equal(m_filtered->size(), vec2(10, 10));
+
+        // Live effects on the left, the baked textures 100 pixels to the right
+        Node *root = Node::create();
+        *root << &(*BlurNode::create(4) << TextureNode::create(rect2d::fromXywh(20, 20, 10, 10), m_source))
+              << TextureNode::create(rect2d::fromXywh(116, 16, 18, 18), m_blurred)
+              << &(*ShadowNode::create(4, vec2(3, 3), vec4(0, 0, 1, 1)) << TextureNode::create(rect2d::fromXywh(20, 60, 10, 10), m_source))
+              << TextureNode::create(rect2d::fromPosSize(vec2(120, 60) - sourcePosition, m_shadowed->size()), m_shadowed)
+              << &(*ColorFilterNode::create(swapRedAndGreen) << TextureNode::create(rect2d::fromXywh(20, 100, 10, 10), m_source))
+              << TextureNode::create(rect2d::fromXywh(120, 100, 10, 10), m_filtered);
+        return root;
+    }
+
+    void check() override {
+        for (int y=10; y<120; ++y) {
+            for (int x=10; x<40; ++x) {
+                if (!fuzzy_equals(pixel(x, y), pixel(x + 100, y), 0.02)) {
+                    cout << "pixels differ: live (" << dec << x << "," << y << ")=" << pixel(x, y)
+                         << "; baked=" << pixel(x + 100, y) << endl;
+                    assert(false);
+                }
+            }
+        }
+        check_pixel(125, 105, vec4(0, 1, 0, 1));
+
+        delete m_source;
+        delete m_blurred;
+        delete m_shadowed;
+        delete m_filtered;
+    }
+
+private:
+    Texture *m_source;
+    Texture *m_blurred;
+    Texture *m_shadowed;
+    Texture *m_filtered;
+};
+
 int main(int argc, char *argv[])
 {
     RENGINE_BACKEND backend;
@@ -218,6 +414,10 @@ int main(int argc, char *argv[])
     testBase.addTest(new ColorsAndPositions());
     testBase.addTest(new TexturesOnViewportEdge());
     testBase.addTest(new OpacityTextures());
+    testBase.addTest(new RectangleLists());
+    testBase.addTest(new Clipping());
+    testBase.addTest(new LayerPromotion());
+    testBase.addTest(new BakedEffects());
     testBase.show();
 
     backend.run();
@@ -0,0 +1,104 @@
+/*
+    Copyright (c) 2016, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "test.h"
+
+class MoveCounter : public Surface
+{
+public:
+    void onRender() override { ++renders; }
+
+    void onEvent(Event *e) override {
+        if (e->type() != Event::PointerMove)
+            return;
+        PointerEvent *pe = PointerEvent::from(e);
+        ++moves;
+        position = pe->positionInSurface();
+        historySize = pe->historySize();
+    }
+
+    unsigned renders = 0;
+    unsigned moves = 0;
+    unsigned historySize = 0;
+    vec2 position;
+};
+
+static void pushMotion(int x, int y)
+{
+    SDL_Event event;
+    event.type = SDL_MOUSEMOTION;
+    event.motion.type = SDL_MOUSEMOTION;
+    event.motion.timestamp = SDL_GetTicks();
+    event.motion.windowID = 0;
+    event.motion.which = 0;
+    event.motion.state = 0;
+    event.motion.x = x;
+    event.motion.y = y;
+    event.motion.xrel = 0;
+    event.motion.yrel = 0;
+    SDL_PushEvent(&event);
+}
+
+void tst_sdlBackend_coalescing(Backend *backend, MoveCounter *surface)
+{
+    surface->pointerInput()->setResamplingEnabled(false);
+
+    // The render requested when the surface was created
+    backend->processEvents();
+    check_equal(surface->renders, 1u);
+    check_equal(surface->moves, 0u);
+
+    // Moves queued ahead of a frame are delivered once, with the frame
+    for (int i=1; i<=5; ++i)
+        pushMotion(i, 2 * i);
+    surface->requestRender();
+    backend->processEvents();
+    check_equal(surface->renders, 2u);
+    check_equal(surface->moves, 1u);
+    check_equal(surface->historySize, 5u);
+    check_equal(surface->position, vec2(5, 10));
+
+    // Without a frame coming up, they are delivered once the queue is empty
+    for (int i=1; i<=3; ++i)
+        pushMotion(10 * i, 10);
+    backend->processEvents();
+    check_equal(surface->renders, 2u);
+    check_equal(surface->moves, 2u);
+    check_equal(surface->historySize, 3u);
+    check_equal(surface->position, vec2(30, 10));
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+int main(int, char **)
+{
+    RENGINE_BACKEND backend;
+    MoveCounter *surface = new MoveCounter();
+
+    tst_sdlBackend_coalescing(&backend, surface);
+
+    delete surface;
+    return 0;
+}
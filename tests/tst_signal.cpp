@@ -108,8 +108,184 @@ void tst_signal_onDestruction()
     cout << __PRETTY_FUNCTION__ << ": ok" << endl;
 }
 
+void tst_signal_manySignals()
+{
+    // More signals than there are bits in the connection mask, so some
+    // of them share a bit
+    std::vector<Signal<int> *> signals;
+    for (int i=0; i<40; ++i)
+        signals.push_back(new Signal<int>());
+    check_true(signals[0]->id() % 32 == signals[32]->id() % 32);
+
+    SignalEmitter emitter;
+    check_true(!emitter.hasConnections());
+
+    std::vector<int> calls;
+    SignalHandler_Function<int> first([&] (int v) { calls.push_back(v); });
+    SignalHandler_Function<int> second([&] (int v) { calls.push_back(-v); });
+
+    signals[32]->connect(&emitter, &first);
+    signals[5]->connect(&emitter, &first);
+    signals[32]->connect(&emitter, &second);
+    check_true(emitter.hasConnections());
+
+    // Sharing a bit does not deliver to the wrong signal
+    signals[0]->emit(&emitter, 1);
+    check_equal(calls.size(), 0u);
+
+    // Handlers are called in the order they were connected
+    signals[32]->emit(&emitter, 2);
+    check_equal(calls.size(), 2u);
+    check_equal(calls[0], 2);
+    check_equal(calls[1], -2);
+
+    signals[5]->emit(&emitter, 3);
+    check_equal(calls.size(), 3u);
+    check_equal(calls[2], 3);
+
+    signals[32]->disconnect(&emitter, &first);
+    signals[32]->emit(&emitter, 4);
+    check_equal(calls.size(), 4u);
+    check_equal(calls[3], -4);
+
+    signals[32]->disconnect(&emitter, &second);
+    signals[5]->disconnect(&emitter, &first);
+    check_true(!emitter.hasConnections());
+    signals[5]->emit(&emitter, 5);
+    check_equal(calls.size(), 4u);
+
+    for (Signal<int> *s : signals)
+        delete s;
+
+    cout << __PRETTY_FUNCTION__ << ": ok" << endl;
+}
+
+void tst_signal_deferred()
+{
+    SignalQueue *queue = SignalQueue::current();
+    check_true(queue->isEmpty());
+
+    RectangleNode *a = RectangleNode::create();
+    RectangleNode *b = RectangleNode::create();
+
+    // A binding on a's x and width, like "b.width: a.x + a.width"
+    int bindingCalls = 0;
+    SignalHandler_Function<> binding([&] () {
+        ++bindingCalls;
+        b->setWidth(a->x() + a->width());
+    });
+    RectangleNodeBase::onXChanged.connect(a, &binding, Signal<>::DeferredConnection);
+    RectangleNodeBase::onWidthChanged.connect(a, &binding, Signal<>::DeferredConnection);
+
+    // A binding depending on the first one, "b.height: b.width * 2"
+    int chainedCalls = 0;
+    SignalHandler_Function<> chained([&] () {
+        ++chainedCalls;
+        b->setHeight(b->width() * 2);
+    });
+    RectangleNodeBase::onWidthChanged.connect(b, &chained, Signal<>::DeferredConnection);
+
+    // Direct connections are still called right away
+    int directCalls = 0;
+    SignalHandler_Function<> direct([&] () { ++directCalls; });
+    RectangleNodeBase::onWidthChanged.connect(a, &direct);
+
+    a->setGeometry(rect2d::fromXywh(1, 2, 3, 4));
+    a->setWidth(5);
+    a->setX(10);
+    check_equal(directCalls, 2);
+    check_equal(bindingCalls, 0);
+    check_equal(queue->size(), 2u);
+
+    // One evaluation of each binding, in dependency order
+    queue->flush();
+    check_true(queue->isEmpty());
+    check_equal(bindingCalls, 1);
+    check_equal(chainedCalls, 1);
+    check_equal(b->width(), 15.0f);
+    check_equal(b->height(), 30.0f);
+
+    // Nothing queued, nothing called
+    queue->flush();
+    check_equal(bindingCalls, 1);
+
+    // Destroying a queued emitter removes it from the queue
+    RectangleNode *c = RectangleNode::create();
+    RectangleNodeBase::onXChanged.connect(c, &binding, Signal<>::DeferredConnection);
+    c->setX(1);
+    a->setX(0);
+    check_equal(queue->size(), 2u);
+    c->destroy();
+    check_equal(queue->size(), 1u);
+    queue->flush();
+    check_equal(bindingCalls, 2);
+    check_equal(b->width(), 5.0f);
+
+    // A diamond: "d.x: a.x + 1", "d.width: a.x + d.x". The second binding
+    // depends on a directly and through the first, and waits for it.
+    RectangleNode *d = RectangleNode::create();
+    int firstCalls = 0;
+    int secondCalls = 0;
+    SignalHandler_Function<> first([&] () {
+        ++firstCalls;
+        d->setX(a->x() + 1);
+    });
+    SignalHandler_Function<> second([&] () {
+        ++secondCalls;
+        d->setWidth(a->x() + d->x());
+    });
+    RectangleNodeBase::onXChanged.connect(a, &first, Signal<>::DeferredConnection);
+    RectangleNodeBase::onXChanged.connect(a, &second, Signal<>::DeferredConnection);
+    RectangleNodeBase::onXChanged.connect(d, &second, Signal<>::DeferredConnection);
+    a->setX(10);
+    queue->flush();
+    check_equal(firstCalls, 1);
+    check_equal(secondCalls, 1);
+    check_equal(d->width(), 21.0f);
+
+    // Once learned, the order holds even when the dependent binding is
+    // triggered first
+    RectangleNodeBase::onXChanged.disconnect(a, &second);
+    RectangleNodeBase::onXChanged.disconnect(a, &first);
+    RectangleNodeBase::onXChanged.connect(a, &second, Signal<>::DeferredConnection);
+    RectangleNodeBase::onXChanged.connect(a, &first, Signal<>::DeferredConnection);
+    a->setX(20);
+    queue->flush();
+    check_equal(firstCalls, 2);
+    check_equal(secondCalls, 2);
+    check_equal(d->width(), 41.0f);
+    RectangleNodeBase::onXChanged.disconnect(a, &second);
+    RectangleNodeBase::onXChanged.disconnect(a, &first);
+    RectangleNodeBase::onXChanged.disconnect(d, &second);
+    d->destroy();
+
+    // A cycle of bindings is broken up
+    int cycleCalls = 0;
+    SignalHandler_Function<> cycle([&] () {
+        ++cycleCalls;
+        b->setX(b->x() + 1);
+    });
+    RectangleNodeBase::onXChanged.connect(b, &cycle, Signal<>::DeferredConnection);
+    b->setX(1);
+    queue->flush();
+    check_equal(cycleCalls, int(SignalQueue::MaxRounds));
+    check_true(queue->isEmpty());
+    RectangleNodeBase::onXChanged.disconnect(b, &cycle);
+
+    RectangleNodeBase::onXChanged.disconnect(a, &binding);
+    RectangleNodeBase::onWidthChanged.disconnect(a, &binding);
+    RectangleNodeBase::onWidthChanged.disconnect(a, &direct);
+    RectangleNodeBase::onWidthChanged.disconnect(b, &chained);
+    a->destroy();
+    b->destroy();
+
+    cout << __PRETTY_FUNCTION__ << ": ok" << endl;
+}
+
 int main(int argc, char **argv)
 {
     tst_signal_basic();
     tst_signal_onDestruction();
+    tst_signal_manySignals();
+    tst_signal_deferred();
 }
\ No newline at end of file
@@ -24,6 +24,7 @@
 */
 
 #include "test.h"
+#include "util/tiledimagenode.h"
 
 static int GLOBAL_COUNTER = 0;
 
@@ -123,10 +124,236 @@ void tst_schedulBatchAndWait()
 
 
 
+// Run a MipmapJob on the queue and verify that the chain goes all the way
+// down to 1x1 and that the levels are box filtered.
+
+void tst_mipmapJob()
+{
+    WorkQueue queue;
+
+    // 4x2 image, left half is opaque white, right half is transparent
+    unsigned pixels[] = { 0xffffffff, 0xffffffff, 0x00000000, 0x00000000,
+                          0xffffffff, 0xffffffff, 0x00000000, 0x00000000 };
+    shared_ptr<MipmapJob> job(new MipmapJob(4, 2, pixels));
+    queue.schedule(job);
+    job->waitForCompletion();
+
+    const std::vector<MipmapJob::Level> &levels = job->levels();
+    check_equal(levels.size(), 2u);
+
+    check_equal(levels.at(0).width, 2);
+    check_equal(levels.at(0).height, 1);
+    check_equal_hex(levels.at(0).pixels.at(0), 0xffffffffu);
+    check_equal_hex(levels.at(0).pixels.at(1), 0x00000000u);
+
+    check_equal(levels.at(1).width, 1);
+    check_equal(levels.at(1).height, 1);
+    check_equal_hex(levels.at(1).pixels.at(0), 0x80808080u);
+
+    // Odd sizes keep the last row and column: a 3x3 image where only the
+    // bottom right pixel is set reduces to a 1x1 average of all nine.
+    unsigned odd[] = { 0, 0, 0,
+                       0, 0, 0,
+                       0, 0, 0x00000090 };
+    MipmapJob::Level level;
+    MipmapJob::downscale(odd, 3, 3, &level);
+    check_equal(level.width, 1);
+    check_equal(level.height, 1);
+    check_equal_hex(level.pixels.at(0), 0x00000010u);
+
+    // 5x1: the last destination texel covers source columns 2 to 4
+    unsigned row[] = { 0x10, 0x10, 0x30, 0x30, 0x30 };
+    MipmapJob::downscale(row, 5, 1, &level);
+    check_equal(level.width, 2);
+    check_equal(level.height, 1);
+    check_equal_hex(level.pixels.at(0), 0x10u);
+    check_equal_hex(level.pixels.at(1), 0x30u);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_imageTileSource()
+{
+    // 6x3 image with tiles of 4 pixels, where every pixel encodes its position
+    std::vector<unsigned> pixels;
+    for (int y=0; y<3; ++y)
+        for (int x=0; x<6; ++x)
+            pixels.push_back((y << 8) | x);
+    ImageTileSource source(6, 3, pixels, 4);
+
+    check_equal(source.levelCount(), 2);
+    check_equal(source.imageSize(), vec2(6, 3));
+
+    int w, h;
+    std::vector<unsigned> tile;
+    check_true(source.loadTile(0, 1, 0, &w, &h, &tile));
+    check_equal(w, 2);
+    check_equal(h, 3);
+    check_equal_hex(tile.at(0), 0x0004u);
+    check_equal_hex(tile.at(1), 0x0005u);
+    check_equal_hex(tile.at(5), 0x0205u);
+
+    check_true(!source.loadTile(0, 2, 0, &w, &h, &tile));
+
+    check_true(source.loadTile(1, 0, 0, &w, &h, &tile));
+    check_equal(w, 3);
+    check_equal(h, 1);
+
+    check_equal(TileSource::levelCountFor(vec2(40000, 1000), 256), 9);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+// A backend, surface and renderer which don't need a display or OpenGL,
+// so TiledImageNode can be driven directly through preprocess().
+
+class StubTexture : public Texture
+{
+public:
+    StubTexture(vec2 size) : m_size(size) { }
+    vec2 size() const override { return m_size; }
+    Format format() const override { return RGBA_32; }
+    GLuint textureId() const override { return 0; }
+private:
+    vec2 m_size;
+};
+
+class StubRenderer : public Renderer
+{
+public:
+    Texture *createTextureFromImageData(vec2 size, Texture::Format, void *) override { return new StubTexture(size); }
+    void initialize() override { }
+    bool render() override { return true; }
+    bool readPixels(int, int, int, int, unsigned *) override { return false; }
+protected:
+    void openRenderTarget(vec2) override { }
+    Texture *closeRenderTarget() override { return nullptr; }
+};
+
+class StubSurfaceImpl : public SurfaceBackendImpl
+{
+public:
+    void hide() override { }
+    void show() override { }
+    bool beginRender() override { return true; }
+    bool commitRender() override { return true; }
+    vec2 size() const override { return vec2(32, 32); }
+    void requestSize(vec2) override { }
+    void requestRender() override { }
+    Renderer *createRenderer() override { return new StubRenderer(); }
+    vec2 dpi() const override { return vec2(96, 96); }
+};
+
+class StubBackend : public Backend
+{
+public:
+    void processEvents() override { }
+    SurfaceBackendImpl *createSurface(Surface *) override { return new StubSurfaceImpl(); }
+    void destroySurface(Surface *, SurfaceBackendImpl *impl) override { delete impl; }
+};
+
+class StubSurface : public Surface { };
+
+// Preprocesses the node until all the visible tiles have been loaded
+static void tst_loadVisibleTiles(TiledImageNode *node, unsigned expectedTiles)
+{
+    for (int i=0; i<200; ++i) {
+        node->preprocess();
+        unsigned count = 0;
+        for (Node *c = node->child(); c; c = c->sibling())
+            ++count;
+        if (count == expectedTiles && node->child()->type() == Node::TextureNodeType)
+            return;
+        this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    check_true(!"tiles did not load");
+}
+
+// Only one backend may exist, so this shares tst_tiledImageNode()'s
+static void tst_destroyTiledImageTree(Renderer *renderer, WorkQueue *queue)
+{
+    std::shared_ptr<TileSource> source(new ImageTileSource(64, 64, std::vector<unsigned>(64 * 64, 0xffffffff), 16));
+    AllocationPool<TextureNode> *texturePool = TextureNode::allocationPool();
+    unsigned textureNodeCount = texturePool->allocatedCount();
+
+    // Destroying the tree from above must let ~TiledImageNode take its
+    // tiles out of the tree and release them, both with destroy() and with
+    // destroySubtree()
+    for (int i=0; i<2; ++i) {
+        Node *root = Node::create();
+        TransformNode *view = TransformNode::create();
+        TiledImageNode *image = TiledImageNode::create(renderer, queue, source);
+        *root << &(*view << image << Node::create());
+        tst_loadVisibleTiles(image, 4);
+        check_equal(texturePool->allocatedCount(), textureNodeCount + 4);
+
+        if (i == 0)
+            root->destroy();
+        else
+            root->destroySubtree();
+        check_equal(texturePool->allocatedCount(), textureNodeCount);
+    }
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_tiledImageNode()
+{
+    WorkQueue queue;
+    StubBackend backend;
+    StubSurface surface;
+    StubRenderer renderer;
+    renderer.setTargetSurface(&surface);
+
+    // 64x64 image with 16x16 tiles, seen through a 32x32 surface
+    std::shared_ptr<TileSource> source(new ImageTileSource(64, 64, std::vector<unsigned>(64 * 64, 0xffffffff), 16));
+    const unsigned tileBytes = 16 * 16 * 4;
+
+    TransformNode *view = TransformNode::create();
+    TiledImageNode *image = TiledImageNode::create(&renderer, &queue, source);
+    view->append(image);
+
+    // Tiles which are still loading count against the budget
+    image->setMemoryBudget(tileBytes);
+    image->preprocess();
+    check_equal(image->cachedTileCount(), 4u);
+    check_equal(image->memoryUsage(), 4 * tileBytes);
+
+    tst_loadVisibleTiles(image, 4);
+    check_equal(image->memoryUsage(), 4 * tileBytes);
+
+    // A static view leaves the tree alone
+    Node *firstTile = image->child();
+    unsigned generation = Node::hitTestGeneration();
+    image->preprocess();
+    image->preprocess();
+    check_equal(Node::hitTestGeneration(), generation);
+    check_equal(image->child(), firstTile);
+
+    // Scrolling to the other corner evicts the tiles which are no longer
+    // visible, loaded or not
+    view->setMatrix(mat4::translate2D(-32, -32));
+    image->preprocess();
+    check_equal(image->cachedTileCount(), 4u);
+    check_equal(image->memoryUsage(), 4 * tileBytes);
+    tst_loadVisibleTiles(image, 4);
+    check_true(image->child() != firstTile);
+
+    // The view takes the image and its tiles with it
+    view->destroy();
+
+    tst_destroyTiledImageTree(&renderer, &queue);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
 int main(int argc, char **argv)
 {
     tst_runOneJob();
     tst_schedulBatchAndWait();
+    tst_mipmapJob();
+    tst_imageTileSource();
+    tst_tiledImageNode();
 
     return 0;
 }